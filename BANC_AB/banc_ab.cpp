@@ -0,0 +1,383 @@
+/*
+    Banc A/B des générations successives des TP2 et TP3 : suivi de contours
+    et polygonisation, sur les mêmes images binarisées.
+
+    make && ./banc_ab [-thr seuil] [-pol seuil_pol] [-w chauffe] [-r repet]
+                      [-csv fichier] [-t delai] [in1|dossier|liste.txt ...]
+
+    1. chaque variante tourne d'abord dans un processus fils : celles qui
+       plantent ou bouclent (plus de -t secondes) sont écartées ;
+    2. les sorties sont comparées à celles de la première variante valide
+       (image marquée, chaînes de Freeman, sommets des polygones) ;
+    3. les variantes sont chronométrées à tour de rôle à chaque répétition,
+       pour que les dérives de la machine les touchent toutes pareil ; le
+       tableau donne la latence par image avec son intervalle de confiance à
+       95% (loi de Student) et le débit en Mpix/s.
+
+    La polygonisation reçoit pour toutes les variantes les contours de la
+    variante TP3 de référence.
+*/
+
+#include "variante.hpp"
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const Variante *toutes_variantes[] = {
+    &variante_tp2, &variante_tp2_V2, &variante_tp2_V3,
+    &variante_tp3, &variante_tp3_V2, &variante_tp3_V3, &variante_tp3_V4,
+};
+
+struct ParamsAB
+{
+    int seuil = 127;
+    int seuil_pol = 600;
+    int nb_chauffe = 1;
+    int nb_repet = 10;
+    int delai = 60;                   // secondes par variante à la validation
+    const char *fichier_csv = NULL;
+    std::vector<std::string> images;
+};
+
+struct ImageAB
+{
+    std::string nom;
+    cv::Mat img_niv;
+};
+
+// Ajoute à la liste un fichier image, le contenu d'un dossier, ou les lignes
+// d'un fichier liste .txt (comme le batch du TP4)
+void lister_images (const char *nom, std::vector<std::string> &liste)
+{
+    DIR *dir = opendir (nom);
+    if (dir) {
+        std::vector<std::string> noms;
+        struct dirent *ent;
+        while ((ent = readdir (dir)) != NULL)
+            if (ent->d_name[0] != '.')
+                noms.push_back (std::string(nom) + "/" + ent->d_name);
+        closedir (dir);
+        std::sort (noms.begin(), noms.end());
+        liste.insert (liste.end(), noms.begin(), noms.end());
+        return;
+    }
+    size_t n = strlen (nom);
+    if (n > 4 && !strcmp (nom + n - 4, ".txt")) {
+        std::ifstream f (nom);
+        std::string ligne;
+        while (std::getline (f, ligne))
+            if (!ligne.empty()) liste.push_back (ligne);
+        return;
+    }
+    liste.push_back (nom);
+}
+
+cv::Mat binariser (const cv::Mat &img_src, int seuil)
+{
+    cv::Mat img_gry, img_niv;
+    cv::cvtColor (img_src, img_gry, cv::COLOR_BGR2GRAY);
+    cv::threshold (img_gry, img_gry, seuil, 255, cv::THRESH_BINARY);
+    img_gry.convertTo (img_niv, CV_32SC1,1., 0.);
+    return img_niv;
+}
+
+
+//---------------------------- V A L I D A T I O N ----------------------------
+
+// Exécute la variante sur tout le corpus dans un processus fils ; faux si
+// elle plante ou dépasse delai secondes (les TP2 sortent de l'image ou
+// bouclent sur certaines formes).
+bool variante_sure (const Variante &v, const std::vector<ImageAB> &corpus,
+                    const std::vector<SortieSuivi> &chaines_ref, double seuil,
+                    int delai)
+{
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) return true;
+    if (pid == 0) {
+        std::cout.rdbuf (NULL);
+        alarm (delai);
+        for (unsigned int k = 0; k < corpus.size(); k++) {
+            SortieSuivi s;
+            v.suivre (corpus[k].img_niv.clone(), s);
+            if (!v.approximer) continue;
+            const SortieSuivi &c = chaines_ref.empty() ? s : chaines_ref[k];
+            SortieApprox a;
+            v.approximer (c, c.img.clone(), seuil, a);
+        }
+        _exit (0);
+    }
+    int statut;
+    waitpid (pid, &statut, 0);
+    return WIFEXITED (statut) && WEXITSTATUS (statut) == 0;
+}
+
+int compter_pixels_differents (const cv::Mat &a, const cv::Mat &b)
+{
+    if (a.rows != b.rows || a.cols != b.cols) return int(a.total());
+    int n = 0;
+    for (int y = 0; y < a.rows; y++)
+    for (int x = 0; x < a.cols; x++)
+        if (a.at<int>(y,x) != b.at<int>(y,x)) n++;
+    return n;
+}
+
+// Nombre de contours dont la chaîne ou le départ diffère de la référence
+int compter_chaines_differentes (const SortieSuivi &a, const SortieSuivi &b)
+{
+    size_t n = std::max (a.chaines.size(), b.chaines.size());
+    size_t m = std::min (a.chaines.size(), b.chaines.size());
+    int d = int(n - m);
+    for (size_t i = 0; i < m; i++)
+        if (a.departs[i] != b.departs[i] || a.chaines[i] != b.chaines[i]) d++;
+    return d;
+}
+
+int compter_polygones_differents (const SortieApprox &a, const SortieApprox &b)
+{
+    size_t n = std::max (a.sommets.size(), b.sommets.size());
+    size_t m = std::min (a.sommets.size(), b.sommets.size());
+    int d = int(n - m);
+    for (size_t i = 0; i < m; i++)
+        if (a.sommets[i] != b.sommets[i]) d++;
+    return d;
+}
+
+
+//---------------------------- S T A T I S T I Q U E S ------------------------
+
+// Quantile 0.975 de la loi de Student à ddl degrés de liberté
+double student_975 (int ddl)
+{
+    static const double t[] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447,
+        2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+        2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+        2.052, 2.048, 2.045, 2.042 };
+    if (ddl < 1) return 0;
+    if (ddl <= 30) return t[ddl];
+    return 1.96 + 2.4 / ddl;
+}
+
+struct Stats
+{
+    double moyenne = 0, ecart_type = 0, demi_ic = 0;
+};
+
+Stats calculer_stats (const std::vector<double> &x)
+{
+    Stats s;
+    int n = x.size();
+    if (n == 0) return s;
+    for (double v : x) s.moyenne += v;
+    s.moyenne /= n;
+    if (n < 2) return s;
+    for (double v : x) s.ecart_type += (v - s.moyenne) * (v - s.moyenne);
+    s.ecart_type = sqrt (s.ecart_type / (n - 1));
+    s.demi_ic = student_975 (n - 1) * s.ecart_type / sqrt (double(n));
+    return s;
+}
+
+
+//------------------------------- M E S U R E S -------------------------------
+
+enum Operation { O_SUIVI, O_APPROX };
+
+struct LigneAB
+{
+    const Variante *v;
+    Operation op;
+    std::string accord;
+    std::vector<double> ms;        // durée du corpus à chaque répétition
+};
+
+double chronometrer (const LigneAB &l, const std::vector<ImageAB> &corpus,
+                     const std::vector<SortieSuivi> &suivis_ref, double seuil)
+{
+    double ms = 0;
+    for (unsigned int k = 0; k < corpus.size(); k++) {
+        cv::Mat img = l.op == O_SUIVI ? corpus[k].img_niv.clone()
+                                      : suivis_ref[k].img.clone();
+        int64 t0 = cv::getTickCount();
+        if (l.op == O_SUIVI) {
+            SortieSuivi s;
+            l.v->suivre (img, s);
+        } else {
+            SortieApprox a;
+            l.v->approximer (suivis_ref[k], img, seuil, a);
+        }
+        ms += (cv::getTickCount() - t0) * 1000. / cv::getTickFrequency();
+    }
+    return ms;
+}
+
+void afficher_tableau (const ParamsAB &pb, const std::vector<LigneAB> &lignes,
+                       const std::vector<ImageAB> &corpus)
+{
+    double mpix = 0;
+    for (const ImageAB &im : corpus) mpix += im.img_niv.total() / 1e6;
+    int nb = corpus.size();
+
+    std::ofstream csv;
+    if (pb.fichier_csv) {
+        csv.open (pb.fichier_csv);
+        csv << "variante,operation,images,repet,ms_image,ic95_ms,ecart_type_ms,"
+               "mpix_s,mpix_s_bas,mpix_s_haut,accord\n";
+    }
+
+    std::cout << nb << " images, " << mpix << " Mpix, " << pb.nb_repet
+              << " répétitions, IC à 95%\n\n"
+              << std::left << std::setw(10) << "variante"
+              << std::setw(8) << "op" << std::right
+              << std::setw(12) << "ms/image" << std::setw(10) << "± IC95"
+              << std::setw(12) << "Mpix/s" << std::setw(20) << "[bas ; haut]"
+              << "  accord\n";
+    std::cout << std::fixed;
+
+    for (const LigneAB &l : lignes) {
+        Stats s = calculer_stats (l.ms);
+        const char *op = l.op == O_SUIVI ? "suivi" : "approx";
+        double debit = s.moyenne > 0 ? mpix * 1e3 / s.moyenne : 0;
+        double bas   = mpix * 1e3 / (s.moyenne + s.demi_ic);
+        double haut  = s.moyenne > s.demi_ic ? mpix * 1e3 / (s.moyenne - s.demi_ic) : 0;
+        std::ostringstream ic;
+        ic << std::fixed << std::setprecision(1) << "[" << bas << " ; " << haut << "]";
+        std::cout << std::left << std::setw(10) << l.v->nom << std::setw(8) << op
+                  << std::right << std::setprecision(3)
+                  << std::setw(12) << s.moyenne / nb
+                  << std::setw(10) << s.demi_ic / nb
+                  << std::setprecision(1) << std::setw(12) << debit
+                  << std::setw(20) << ic.str() << "  " << l.accord << "\n";
+        if (csv)
+            csv << l.v->nom << "," << op << "," << nb << "," << l.ms.size() << ","
+                << s.moyenne / nb << "," << s.demi_ic / nb << ","
+                << s.ecart_type / nb << "," << debit << "," << bas << ","
+                << haut << "," << l.accord << "\n";
+    }
+    std::cout << std::endl;
+}
+
+int effectuer_banc_ab (const ParamsAB &pb)
+{
+    std::vector<ImageAB> corpus;
+    for (const std::string &nom : pb.images) {
+        cv::Mat img_src = cv::imread (nom, cv::IMREAD_COLOR);
+        if (img_src.empty()) {
+            std::cerr << "Ignoré : " << nom << std::endl;
+            continue;
+        }
+        corpus.push_back ({ nom, binariser (img_src, pb.seuil) });
+    }
+    if (corpus.empty()) {
+        std::cerr << "Aucune image lisible" << std::endl;
+        return 1;
+    }
+    double seuil = std::max (pb.seuil_pol, 1) / 1000.0;
+
+    // Validation et référence : la première variante qui ne plante pas ;
+    // pour la polygonisation, la première variante TP3 qui ne plante pas.
+    std::streambuf *cout_buf = std::cout.rdbuf();
+    std::vector<LigneAB> lignes;
+    std::vector<SortieSuivi> suivis_ref, chaines_ref;
+    std::vector<SortieApprox> approx_ref;
+    for (const Variante *v : toutes_variantes) {
+        if (!variante_sure (*v, corpus, chaines_ref, seuil, pb.delai)) {
+            std::cerr << v->nom << " : plante ou boucle sur le corpus, écartée"
+                      << std::endl;
+            continue;
+        }
+
+        std::cout.rdbuf (NULL);
+        std::vector<SortieSuivi> suivis (corpus.size());
+        for (unsigned int k = 0; k < corpus.size(); k++)
+            v->suivre (corpus[k].img_niv.clone(), suivis[k]);
+        bool ref_chaines = v->approximer && chaines_ref.empty();
+        if (ref_chaines) chaines_ref = suivis;
+        std::vector<SortieApprox> approx (v->approximer ? corpus.size() : 0);
+        for (unsigned int k = 0; k < approx.size(); k++)
+            v->approximer (chaines_ref[k], chaines_ref[k].img.clone(), seuil,
+                           approx[k]);
+        std::cout.rdbuf (cout_buf);
+
+        int px = 0, ch = 0, pol = 0, nb_ch = 0, nb_pol = 0;
+        if (suivis_ref.empty()) suivis_ref = suivis;
+        if (approx_ref.empty()) approx_ref = approx;
+        for (unsigned int k = 0; k < corpus.size(); k++) {
+            px += compter_pixels_differents (suivis[k].img, suivis_ref[k].img);
+            if (v->approximer) {
+                ch += compter_chaines_differentes (suivis[k], chaines_ref[k]);
+                pol += compter_polygones_differents (approx[k], approx_ref[k]);
+                nb_ch += chaines_ref[k].chaines.size();
+                nb_pol += approx_ref[k].sommets.size();
+            }
+        }
+
+        std::ostringstream a;
+        a << (px ? std::to_string(px) + " px" : "img =");
+        if (v->approximer)
+            a << ", " << (ch ? std::to_string(ch) + "/" + std::to_string(nb_ch)
+                             + " chaînes" : "chaînes =");
+        lignes.push_back ({ v, O_SUIVI, a.str(), {} });
+        if (v->approximer) {
+            std::string b = pol ? std::to_string(pol) + "/" + std::to_string(nb_pol)
+                                  + " polygones" : "polygones =";
+            lignes.push_back ({ v, O_APPROX, b, {} });
+        }
+    }
+    if (lignes.empty()) return 1;
+
+    // Mesures, les variantes à tour de rôle
+    std::cout.rdbuf (NULL);
+    for (int r = 0; r < pb.nb_chauffe + pb.nb_repet; r++)
+    for (LigneAB &l : lignes) {
+        double ms = chronometrer (l, corpus, chaines_ref, seuil);
+        if (r >= pb.nb_chauffe) l.ms.push_back (ms);
+    }
+    std::cout.rdbuf (cout_buf);
+
+    std::cout << "Référence suivi : " << lignes.front().v->nom;
+    for (const LigneAB &l : lignes)
+        if (l.op == O_APPROX) {
+            std::cout << ", polygonisation : " << l.v->nom;
+            break;
+        }
+    std::cout << std::endl;
+    afficher_tableau (pb, lignes, corpus);
+    return 0;
+}
+
+
+//---------------------------------- M A I N ----------------------------------
+
+void afficher_usage (char *nom_prog) {
+    std::cerr << "Usage: " << nom_prog
+              << " [-thr seuil] [-pol seuil_pol] [-w chauffe] [-r repet]"
+              << " [-csv fichier] [-t delai] [in1|dossier|liste.txt ...]\n"
+              << "  par défaut ../IMAGES" << std::endl;
+}
+
+int main (int argc, char**argv)
+{
+    ParamsAB pb;
+    char *nom_prog = argv[0];
+
+    while (argc-1 > 0 && argv[1][0] == '-') {
+        if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+        if      (!strcmp(argv[1], "-thr")) pb.seuil       = atoi(argv[2]);
+        else if (!strcmp(argv[1], "-pol")) pb.seuil_pol   = atoi(argv[2]);
+        else if (!strcmp(argv[1], "-w"))   pb.nb_chauffe  = atoi(argv[2]);
+        else if (!strcmp(argv[1], "-r"))   pb.nb_repet    = std::max (atoi(argv[2]), 2);
+        else if (!strcmp(argv[1], "-csv")) pb.fichier_csv = argv[2];
+        else if (!strcmp(argv[1], "-t"))   pb.delai       = atoi(argv[2]);
+        else { afficher_usage(nom_prog); return 1; }
+        argc -= 2; argv += 2;
+    }
+    for (int k = 1; k < argc; k++)
+        lister_images (argv[k], pb.images);
+    if (pb.images.empty())
+        lister_images ("../IMAGES", pb.images);
+    return effectuer_banc_ab (pb);
+}
@@ -0,0 +1,49 @@
+/*
+    Interface commune des variantes TP2 et TP3 pour le banc A/B.
+
+    Chaque variante est compilée dans sa propre unité de traduction
+    (variante_*.cpp), qui inclut le source du TP dans un espace de noms : les
+    fonctions homonymes des différentes générations cohabitent ainsi dans le
+    même exécutable sans modifier les TP.
+*/
+
+#ifndef VARIANTE_HPP
+#define VARIANTE_HPP
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Résultat du suivi de contours : l'image marquée, et pour les TP3 les
+// chaînes de Freeman avec leur point de départ.
+struct SortieSuivi
+{
+    cv::Mat img;
+    std::vector<cv::Point> departs;
+    std::vector<std::vector<int>> chaines;
+};
+
+// Résultat de la polygonisation : les sommets retenus de chaque contour
+struct SortieApprox
+{
+    std::vector<std::vector<cv::Point>> sommets;
+};
+
+struct Variante
+{
+    const char *nom;
+    // Suivi sur img_niv binaire CV_32SC1 (0/255), modifiée sur place
+    void (*suivre) (cv::Mat img_niv, SortieSuivi &s);
+    // Polygonisation des contours de suivi, NULL si la variante n'en a pas ;
+    // seuil est ignoré par les variantes qui ont un seuil en dur.
+    void (*approximer) (const SortieSuivi &suivi, cv::Mat img_niv,
+                        double seuil, SortieApprox &s);
+};
+
+extern const Variante variante_tp2, variante_tp2_V2, variante_tp2_V3;
+extern const Variante variante_tp3, variante_tp3_V2, variante_tp3_V3,
+                      variante_tp3_V4;
+
+#endif
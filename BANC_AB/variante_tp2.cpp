@@ -0,0 +1,15 @@
+// Variante TP2 : suivi de contours sans chaînes de Freeman
+
+#include "variante.hpp"
+
+namespace tp2 {
+#include "../TP2/convers_claudet_tp2.cpp"
+}
+
+static void suivre (cv::Mat img_niv, SortieSuivi &s)
+{
+    tp2::effectuer_suivi_contours_c8 (img_niv);
+    s.img = img_niv;
+}
+
+const Variante variante_tp2 = { "tp2", suivre, NULL };
@@ -0,0 +1,15 @@
+// Variante TP2 V3 : suivi de contours sans chaînes de Freeman
+
+#include "variante.hpp"
+
+namespace tp2_V3 {
+#include "../TP2/convers_claudet_tp2_V3.cpp"
+}
+
+static void suivre (cv::Mat img_niv, SortieSuivi &s)
+{
+    tp2_V3::effectuer_suivi_contours_c8 (img_niv);
+    s.img = img_niv;
+}
+
+const Variante variante_tp2_V3 = { "tp2_V3", suivre, NULL };
@@ -0,0 +1,41 @@
+// Variante TP3 V4 : suivi avec chaînes de Freeman et polygonisation
+
+#include "variante.hpp"
+
+namespace tp3_V4 {
+#include "../TP3/convers_claudet_tp3_V4.cpp"
+}
+
+static void suivre (cv::Mat img_niv, SortieSuivi &s)
+{
+    std::vector<tp3_V4::ContourF8> contours =
+        tp3_V4::effectuer_suivi_contours_c8 (img_niv);
+    s.img = img_niv;
+    for (unsigned int i = 0; i < contours.size(); i++) {
+        s.departs.push_back (cv::Point (contours[i].xPointDepart,
+                                        contours[i].yPointDepart));
+        s.chaines.push_back (contours[i].chaineFreeman);
+    }
+}
+
+static void approximer (const SortieSuivi &suivi, cv::Mat img_niv,
+                        double seuil, SortieApprox &s)
+{
+    tp3_V4::seuil_recalc = seuil;
+    for (unsigned int i = 0; i < suivi.chaines.size(); i++) {
+        tp3_V4::ContourF8 cfc;
+        cfc.xPointDepart = suivi.departs[i].x;
+        cfc.yPointDepart = suivi.departs[i].y;
+        cfc.chaineFreeman = suivi.chaines[i];
+        cfc.taillchaineFreeman = cfc.chaineFreeman.size();
+        std::vector<tp3_V4::ContourPol> v =
+            tp3_V4::approximer_contour_c8 (cfc, img_niv);
+        std::vector<cv::Point> sommets;
+        for (unsigned int j = 0; j < v.size(); j++)
+            if (v[j].estSommetApproxPoly)
+                sommets.push_back (cv::Point (v[j].p.x, v[j].p.y));
+        s.sommets.push_back (sommets);
+    }
+}
+
+const Variante variante_tp3_V4 = { "tp3_V4", suivre, approximer };
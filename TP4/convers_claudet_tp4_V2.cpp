@@ -11,10 +11,31 @@
 */
 
 #include <iostream>
+#include <iomanip>
 #include <cstring>
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <climits>
+#include <fstream>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#include <list>
+#include <deque>
+#include <queue>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <functional>
 #define CHECK_MAT_TYPE(mat, format_type) \
     if (mat.type() != int(format_type)) \
         throw std::runtime_error(std::string(__func__) +\
@@ -22,6 +43,25 @@
             "' pour la matrice '" # mat "'");
 
 
+//---------------------------- A N N U L A T I O N ----------------------------
+
+// Annulation coopérative des calculs du fil de fond : les boucles longues
+// appellent verifier_annulation() à chaque ligne, qui lève Annulation dès
+// qu'une demande plus récente est arrivée. Sans effet dans les autres fils.
+
+struct Annulation {};
+
+thread_local const std::atomic<unsigned> *glob_derniere_demande = NULL;
+thread_local unsigned glob_demande_en_cours = 0;
+
+inline void verifier_annulation ()
+{
+    if (glob_derniere_demande && glob_derniere_demande->load
+            (std::memory_order_relaxed) != glob_demande_en_cours)
+        throw Annulation();
+}
+
+
 //--------------------------------- L O U P E ---------------------------------
 
 //int dir_x[] = {1,1,0,-1,-1,-1,0,1};
@@ -70,37 +110,150 @@ class Loupe {
         reborner (res1, res2);
     }
 
+    // À appeler quand l'image représentée (img_coul) a été recalculée :
+    // le prochain rendu sera complet.
+    void invalider ()
+    {
+        rect_valide = false;
+        portion_valide = false;
+    }
+
     void dessiner_rect (cv::Mat &src, cv::Mat &dest)
     {
-        dest = src.clone();
+        CHECK_MAT_TYPE(src, CV_8UC3)
+
+        // On ne recopie src entièrement que si elle a changé ; sinon on efface
+        // seulement l'ancien rectangle en restaurant ses bords depuis src.
+        if (!rect_valide || dest.data == src.data || dest.rows != src.rows
+            || dest.cols != src.cols || dest.type() != src.type()) {
+            if (dest.data == src.data) dest = cv::Mat();
+            src.copyTo (dest);
+            rect_valide = true;
+        } else if (rect_dessine) {
+            restaurer_cadre (src, dest, rect_x0, rect_y0, rect_x1, rect_y1);
+        }
+
+        rect_dessine = false;
         if (zoom == 0) return;
         cv::Point p0 = cv::Point(zoom_x0, zoom_y0),
                   p1 = cv::Point(zoom_x1, zoom_y1);
         cv::rectangle(dest, p0, p1, cv::Scalar (255, 255, 255), 3, 4);
         cv::rectangle(dest, p0, p1, cv::Scalar (  0,   0, 255), 1, 4);
+        rect_dessine = true;
+        rect_x0 = zoom_x0; rect_y0 = zoom_y0;
+        rect_x1 = zoom_x1; rect_y1 = zoom_y1;
     }
 
     void dessiner_portion (cv::Mat &src, cv::Mat &dest)
     {
         CHECK_MAT_TYPE(src, CV_8UC3)
+        CHECK_MAT_TYPE(dest, CV_8UC3)
 
         int bon_zoom = zoom >= 1 ? zoom : 1;
+        int sx = (zoom_x0 - port_x0) * bon_zoom,
+            sy = (zoom_y0 - port_y0) * bon_zoom;
+
+        if (!portion_valide || dest.data != port_data || bon_zoom != port_zoom
+            || abs(sx) >= dest.cols || abs(sy) >= dest.rows) {
+            rendre_zone (src, dest, 0, dest.cols, 0, dest.rows);
+        } else if (sx != 0 || sy != 0) {
+            // Déplacement : on décale ce qui est déjà rendu, puis on ne rend
+            // que les bandes nouvellement découvertes.
+            decaler (dest, sx, sy);
+            int ya = sy > 0 ? 0 : -sy, yb = sy > 0 ? dest.rows - sy : dest.rows;
+            if (sy > 0) rendre_zone (src, dest, 0, dest.cols, yb, dest.rows);
+            if (sy < 0) rendre_zone (src, dest, 0, dest.cols, 0, ya);
+            if (sx > 0) rendre_zone (src, dest, dest.cols - sx, dest.cols, ya, yb);
+            if (sx < 0) rendre_zone (src, dest, 0, -sx, ya, yb);
+        }
 
-        for (int y = 0; y < dest.rows; y++)
-        for (int x = 0; x < dest.cols; x++)
-        {
-            int x0 = zoom_x0 + x / bon_zoom;
-            int y0 = zoom_y0 + y / bon_zoom;
+        portion_valide = true;
+        port_data = dest.data;
+        port_zoom = bon_zoom;
+        port_x0 = zoom_x0; port_y0 = zoom_y0;
+    }
+
+  private :
+    bool rect_valide = false, rect_dessine = false;
+    int rect_x0 = 0, rect_y0 = 0, rect_x1 = 0, rect_y1 = 0;
+    bool portion_valide = false;
+    const unsigned char *port_data = NULL;
+    int port_zoom = 0, port_x0 = 0, port_y0 = 0;
+
+    // Recopie de src dans dest les bandes couvertes par le cadre dessiné par
+    // dessiner_rect (épaisseur 3 autour de chaque côté).
+    static void restaurer_cadre (cv::Mat &src, cv::Mat &dest,
+                                 int x0, int y0, int x1, int y1)
+    {
+        restaurer_zone (src, dest, x0-2, x1+3, y0-2, y0+3);
+        restaurer_zone (src, dest, x0-2, x1+3, y1-2, y1+3);
+        restaurer_zone (src, dest, x0-2, x0+3, y0-2, y1+3);
+        restaurer_zone (src, dest, x1-2, x1+3, y0-2, y1+3);
+    }
+
+    static void restaurer_zone (cv::Mat &src, cv::Mat &dest,
+                                int xa, int xb, int ya, int yb)
+    {
+        xa = std::max(xa, 0); xb = std::min(xb, src.cols);
+        ya = std::max(ya, 0); yb = std::min(yb, src.rows);
+        if (xa >= xb) return;
+        for (int y = ya; y < yb; y++)
+            memcpy (dest.ptr<unsigned char>(y) + 3*xa,
+                    src.ptr<unsigned char>(y) + 3*xa, 3*(xb-xa));
+    }
+
+    // Décale le contenu de dest : le pixel (x,y) reçoit l'ancien (x+sx,y+sy).
+    static void decaler (cv::Mat &dest, int sx, int sy)
+    {
+        int xa = std::max(0, -sx), xb = std::min(dest.cols, dest.cols - sx);
+        int n = 3*(xb-xa);
+        if (sy > 0 || (sy == 0 && sx > 0)) {
+            for (int y = std::max(0, -sy); y < std::min(dest.rows, dest.rows - sy); y++)
+                memmove (dest.ptr<unsigned char>(y) + 3*xa,
+                         dest.ptr<unsigned char>(y+sy) + 3*(xa+sx), n);
+        } else {
+            for (int y = std::min(dest.rows, dest.rows - sy) - 1; y >= std::max(0, -sy); y--)
+                memmove (dest.ptr<unsigned char>(y) + 3*xa,
+                         dest.ptr<unsigned char>(y+sy) + 3*(xa+sx), n);
+        }
+    }
+
+    // Rend les colonnes [xa,xb[ et les lignes [ya,yb[ de dest : chaque pixel
+    // source est dupliqué bon_zoom fois dans la ligne, puis la première ligne
+    // de chaque groupe est recopiée sur les bon_zoom-1 suivantes.
+    void rendre_zone (cv::Mat &src, cv::Mat &dest, int xa, int xb, int ya, int yb)
+    {
+        int bon_zoom = zoom >= 1 ? zoom : 1;
+        int n = 3*(xb-xa);
+        if (n <= 0) return;
 
-            if (x0 < 0 || x0 >= src.cols || y0 < 0 || y0 >= src.rows) {
-                dest.at<cv::Vec3b>(y,x)[0] = 64;
-                dest.at<cv::Vec3b>(y,x)[1] = 64;
-                dest.at<cv::Vec3b>(y,x)[2] = 64;
-                continue;
+        for (int y = ya; y < yb; ) {
+            int y0 = zoom_y0 + y / bon_zoom;
+            int y_fin = std::min(yb, (y / bon_zoom + 1) * bon_zoom);
+            unsigned char *d = dest.ptr<unsigned char>(y) + 3*xa;
+
+            if (y0 < 0 || y0 >= src.rows) memset (d, 64, n);
+            else {
+                const unsigned char *s = src.ptr<unsigned char>(y0);
+                for (int x = xa; x < xb; ) {
+                    int x0 = zoom_x0 + x / bon_zoom;
+                    int x_fin = std::min(xb, (x / bon_zoom + 1) * bon_zoom);
+                    int k = x_fin - x;
+                    if (x0 < 0 || x0 >= src.cols) memset (d, 64, 3*k);
+                    else {
+                        unsigned char b = s[3*x0], g = s[3*x0+1], r = s[3*x0+2];
+                        for (int i = 0; i < k; i++) {
+                            d[3*i] = b; d[3*i+1] = g; d[3*i+2] = r;
+                        }
+                    }
+                    d += 3*k;
+                    x = x_fin;
+                }
             }
-            dest.at<cv::Vec3b>(y,x)[0] = src.at<cv::Vec3b>(y0,x0)[0];
-            dest.at<cv::Vec3b>(y,x)[1] = src.at<cv::Vec3b>(y0,x0)[1];
-            dest.at<cv::Vec3b>(y,x)[2] = src.at<cv::Vec3b>(y0,x0)[2];
+            const unsigned char *ligne = dest.ptr<unsigned char>(y) + 3*xa;
+            for (int yy = y+1; yy < y_fin; yy++)
+                memcpy (dest.ptr<unsigned char>(yy) + 3*xa, ligne, n);
+            y = y_fin;
         }
     }
 };
@@ -108,12 +261,24 @@ class Loupe {
 
 //----------------------- C O U L E U R S   V G A -----------------------------
 
-void representer_en_couleurs_vga (cv::Mat img_niv, cv::Mat img_coul)
+// Nombre de threads pour la mise en couleurs (0 : nombre de coeurs). Le batch
+// le met à 1, ses images étant déjà traitées en parallèle.
+int glob_nb_threads_couleurs = 0;
+
+// Palette VGA en B, G, R indexée par le niveau décalé de LUT_VGA_DECALAGE,
+// pour éviter modulo et abs sur les niveaux courants (labels, distances).
+const int LUT_VGA_TAILLE = 4096, LUT_VGA_DECALAGE = 1024;
+
+int numero_couleur_vga (int g)
 {
-    CHECK_MAT_TYPE(img_niv, CV_32SC1)
-    CHECK_MAT_TYPE(img_coul, CV_8UC3)
+    if (g == 255) return 15;                       // seul 255 est blanc
+    if (g != 0) return 1 + abs(g-1) % 14;          // seul 0 est noir
+    return 0;
+}
 
-    unsigned char couls[16][3] = {  // R, G, B
+const unsigned char (*palette_vga ())[3]
+{
+    static const unsigned char couls[16][3] = {  // R, G, B
         {   0,   0,   0 },   //  0  black           ->  0 uniquement
         {  20,  20, 190 },   //  1  blue            ->  1, 15, 29, ...
         {  30, 200,  30 },   //  2  green           ->  2, 16, 30, ...
@@ -131,20 +296,137 @@ void representer_en_couleurs_vga (cv::Mat img_niv, cv::Mat img_coul)
         { 252, 252,  84 },   // 14  yellow          -> 14, 28, 42, ...
         { 252, 252, 252 },   // 15  white           -> 255 uniquement
     };
+    // Attention img_coul est en B, G, R -> inverser les canaux
+    static unsigned char lut[LUT_VGA_TAILLE + 16][3];
+    static bool init = [] () {
+        for (int i = 0; i < LUT_VGA_TAILLE + 16; i++) {
+            int c = i < LUT_VGA_TAILLE ? numero_couleur_vga (i - LUT_VGA_DECALAGE)
+                                       : i - LUT_VGA_TAILLE;
+            lut[i][0] = couls[c][2];
+            lut[i][1] = couls[c][1];
+            lut[i][2] = couls[c][0];
+        }
+        return true;
+    } ();
+    (void) init;
+    return lut;
+}
 
-    for (int y = 0; y < img_niv.rows; y++)
-    for (int x = 0; x < img_niv.cols; x++)
+void representer_lignes_vga (cv::Mat &img_niv, cv::Mat &img_coul, int y0, int y1)
+{
+    const unsigned char (*lut)[3] = palette_vga();
+
+    for (int y = y0; y < y1; y++)
     {
-        int g = img_niv.at<int>(y,x), c = 0;
-        if (g == 255) c = 15;                      // seul 255 est blanc
-        else if (g != 0) c = 1 + abs(g-1) % 14;    // seul 0 est noir
-        // Attention img_coul est en B, G, R -> inverser les canaux
-        img_coul.at<cv::Vec3b>(y,x)[0] = couls[c][2];
-        img_coul.at<cv::Vec3b>(y,x)[1] = couls[c][1];
-        img_coul.at<cv::Vec3b>(y,x)[2] = couls[c][0];
+        const int *s = img_niv.ptr<int>(y);
+        unsigned char *d = img_coul.ptr<unsigned char>(y);
+        for (int x = 0; x < img_niv.cols; x++, d += 3)
+        {
+            unsigned i = unsigned(s[x] + LUT_VGA_DECALAGE);
+            const unsigned char *c = i < unsigned(LUT_VGA_TAILLE) ? lut[i]
+                : lut[LUT_VGA_TAILLE + numero_couleur_vga (s[x])];
+            d[0] = c[0]; d[1] = c[1]; d[2] = c[2];
+        }
     }
 }
 
+void representer_en_couleurs_vga (cv::Mat img_niv, cv::Mat img_coul)
+{
+    CHECK_MAT_TYPE(img_niv, CV_32SC1)
+    CHECK_MAT_TYPE(img_coul, CV_8UC3)
+
+    // En parallèle par bandes de lignes sur les grandes images
+    int nb_threads = glob_nb_threads_couleurs;
+    if (nb_threads <= 0) nb_threads = std::thread::hardware_concurrency();
+    if (nb_threads <= 0 || img_niv.total() < (1 << 18)) nb_threads = 1;
+    nb_threads = std::min(nb_threads, img_niv.rows);
+
+    std::vector<std::thread> groupe;
+    for (int i = 1; i < nb_threads; i++)
+        groupe.emplace_back (representer_lignes_vga, std::ref(img_niv),
+                             std::ref(img_coul), img_niv.rows * i / nb_threads,
+                             img_niv.rows * (i+1) / nb_threads);
+    representer_lignes_vga (img_niv, img_coul, 0, img_niv.rows / nb_threads);
+    for (auto &t : groupe) t.join();
+}
+
+
+//------------------------------- C A C H E -----------------------------------
+
+// Cache des résultats d'étapes (gris, binaire, contours, polygones, DT par
+// pelage...), indexé par l'étape, la version de l'image source, le seuil, la
+// connexité, la tolérance et le mode de polygonisation. Les entrées les moins
+// récemment utilisées sont libérées au-delà du budget mémoire.
+
+struct ContourF8;
+class IndexContours;
+struct ArbreComposantes;
+
+enum Etape { E_GRIS, E_BINAIRE, E_SUIVI, E_MARQUE_C8, E_MARQUE_C4, E_NUMERO,
+             E_POLY, E_REMPLI, E_PELAGE, E_MAXIMA, E_RDT };
+
+struct CleEtape
+{
+  int etape, version, seuil, connexite, tolerance, mode_polyg;
+
+  bool operator< (const CleEtape &c) const
+  {
+    return std::tie(etape, version, seuil, connexite, tolerance, mode_polyg)
+         < std::tie(c.etape, c.version, c.seuil, c.connexite, c.tolerance,
+                    c.mode_polyg);
+  }
+};
+
+// img partage ses données avec le cache : la cloner avant de la modifier
+struct ResultatEtape
+{
+  cv::Mat img;
+  std::shared_ptr<const std::vector<ContourF8>> contours;  // E_SUIVI
+  size_t octets = 0;
+};
+
+class CacheEtapes
+{
+  public :
+    bool chercher (const CleEtape &cle, ResultatEtape &res)
+    {
+      auto it = index.find(cle);
+      if (it == index.end()) return false;
+      lru.splice(lru.begin(), lru, it->second);
+      res = it->second->second;
+      return true;
+    }
+
+    void ranger (const CleEtape &cle, const ResultatEtape &res)
+    {
+      if (res.octets > budget || index.count(cle)) return;
+      lru.emplace_front(cle, res);
+      index[cle] = lru.begin();
+      taille += res.octets;
+      reduire();
+    }
+
+    void fixer_budget (size_t octets) { budget = octets; reduire(); }
+    size_t limite () const { return budget; }
+    void vider () { lru.clear(); index.clear(); taille = 0; }
+    size_t occupation () const { return taille; }
+
+  private :
+    size_t budget = size_t(256) << 20;           // en octets
+    typedef std::list<std::pair<CleEtape, ResultatEtape>> Liste;
+    Liste lru;                                   // la plus récente en tête
+    std::map<CleEtape, Liste::iterator> index;
+    size_t taille = 0;
+
+    void reduire ()
+    {
+      while (taille > budget) {
+        taille -= lru.back().second.octets;
+        index.erase(lru.back().first);
+        lru.pop_back();
+      }
+    }
+};
 
 //----------------------------------- M Y -------------------------------------
 
@@ -157,6 +439,14 @@ class My {
     int clic_x = 0;
     int clic_y = 0;
     int clic_n = 0;
+    int version_src = 0;          // incrémentée à chaque modification de img_src
+    CacheEtapes cache;
+    std::shared_ptr<IndexContours> index;   // contours du clic droit
+    int version_index = -1, seuil_index = -1;
+    int clic_index_x = -1, clic_index_y = -1;   // clic droit en attente de l'index
+    bool mesures_demandees = false;   // touche 'm', faite par le fil de calcul
+    std::shared_ptr<ArbreComposantes> arbre_max, arbre_min;   // de img_src en gris
+    int version_arbres = -1;
 
     enum Recalc { R_RIEN, R_LOUPE, R_TRANSFOS, R_SEUIL };
     Recalc recalc = R_SEUIL;
@@ -187,59 +477,84 @@ void inverser_couleurs (cv::Mat img)
 }
 
 
+// Type d'élément le plus étroit, parmi CV_8UC1, CV_16UC1 et CV_32SC1, qui
+// contient toutes les valeurs de 0 à valeur_max. Les noyaux sont limités par
+// la bande passante : 1 ou 2 octets par pixel au lieu de 4.
+int type_etroit (long valeur_max)
+{
+    if (valeur_max <= UCHAR_MAX) return CV_8UC1;
+    if (valeur_max <= USHRT_MAX) return CV_16UC1;
+    return CV_32SC1;
+}
+
+// Appelle le lambda générique f avec une valeur du type d'élément de mat,
+// pour instancier le noyau sur ce type. mat est soit en type_noyau, le type
+// étroit choisi pour le noyau et l'image, soit en CV_32SC1 comme avant.
+template <typename F>
+void appeler_selon_type (const char *fonction, const cv::Mat &mat,
+                         int type_noyau, F f)
+{
+    if (mat.type() != type_noyau && mat.type() != CV_32SC1)
+        throw std::runtime_error(std::string(fonction) +
+            ": format non géré '" + std::to_string(mat.type()) + "'");
+    switch (mat.type()) {
+        case CV_8UC1  : f (uint8_t());  break;
+        case CV_16UC1 : f (uint16_t()); break;
+        case CV_16SC1 : f (int16_t());  break;
+        case CV_32SC1 : f (int32_t());  break;
+        default :
+            throw std::runtime_error(std::string(fonction) +
+                ": format non géré '" + std::to_string(mat.type()) + "'");
+    }
+}
+
+// Les marquages et la numérotation écrivent provisoirement le numéro de
+// ligne dans les pixels de la forme, puis des valeurs jusqu'à 255 ; la
+// numérotation écrit aussi -1.
+int type_marquage (int rows)
+{
+    return type_etroit (std::max (rows - 1, 255));
+}
+
+int type_numerotation (int rows)
+{
+    return rows - 1 <= SHRT_MAX ? CV_16SC1 : CV_32SC1;
+}
+
+
 // Placez ici vos fonctions de transformations à la place de ces exemples
 
-void marquer_contours_c4(cv::Mat img_niv)
+template <typename T>
+void marquer_contours_c4_type(cv::Mat img_niv)
 {
 	//PLOP
 	//vector<int> marquage;
-	int check[img_niv.rows][img_niv.cols];
-
-    CHECK_MAT_TYPE(img_niv, CV_32SC1)
+	// Sur le tas : la pile ne suffit pas au-delà de quelques Mpix. Seul le
+	// signe de check compte : un octet par pixel.
+	std::vector<int8_t> check_tas (img_niv.total());
+	int8_t (*check)[img_niv.cols] = (int8_t (*)[img_niv.cols]) check_tas.data();
 
     for (int y = 0; y < img_niv.rows; y++)
     for (int x = 0; x < img_niv.cols; x++)
     {
 		//marquage.append(-1);
 		check[y][x] = -1;
-        int g = img_niv.at<int>(y,x);
+        int g = img_niv.at<T>(y,x);
         if (g > 0)
         {
-            img_niv.at<int>(y,x) = y;
+            img_niv.at<T>(y,x) = y;
         }
     }
-    int valeur_affectation = 1;
     for (int y = 0; y < img_niv.rows-1; y++)
     for (int x = 0; x < img_niv.cols-1; x++)
     {
 
-		if(img_niv.at<int>(y,x) > 0)
-		{
-
-			if(x==0
-			|| y ==0
-			|| img_niv.at<int>(y-1,x) == 0
-			|| img_niv.at<int>(y,x-1) == 0
-			|| img_niv.at<int>(y,x+1) == 0
-			|| img_niv.at<int>(y+1,x) == 0
-			|| img_niv.at<int>(y+1,x+1) == 0
-			|| img_niv.at<int>(y-1,x-1) == 0
-			|| img_niv.at<int>(y-1,x+1) == 0
-			|| img_niv.at<int>(y+1,x-1) == 0)
-			{
-				check[y][x] = valeur_affectation;
-			}
-			else
-			{
-				valeur_affectation++;
-				check[y][x] = valeur_affectation;
-			}
-			//valeur_affectation++;
-				//check[y][x] = valeur_affectation;
-		}
+		if(img_niv.at<T>(y,x) > 0)
+			check[y][x] = 1;
 
     }
-    int check2 [img_niv.rows][img_niv.cols];
+    std::vector<int8_t> check2_tas (img_niv.total());
+    int8_t (*check2)[img_niv.cols] = (int8_t (*)[img_niv.cols]) check2_tas.data();
     for (int y = 1; y < img_niv.rows-1; y++)
     for (int x = 1; x < img_niv.cols-1; x++)
 		check2[y][x] = check[y][x];
@@ -267,7 +582,7 @@ void marquer_contours_c4(cv::Mat img_niv)
     {
 		if(check[y][x] > 0)
 		{
-			img_niv.at<int>(y,x) = 255;
+			img_niv.at<T>(y,x) = 255;
 			if(color_change && check[y][x+1] < 0)
 				color_change = false;
 			else if(check[y][x+1] < 0 && !color_change)
@@ -275,16 +590,16 @@ void marquer_contours_c4(cv::Mat img_niv)
 		}
 		else
 		{
-			//img_niv.at<int>(y,x) = 1;
+			//img_niv.at<T>(y,x) = 1;
 		}
 
 		if(check[y][x] < 0 && !color_change)
 		{
-			//img_niv.at<int>(y,x) = 0;
+			//img_niv.at<T>(y,x) = 0;
 		}
 		if(check[y][x] < 0 && color_change)
 		{
-			//img_niv.at<int>(y,x) = 1;
+			//img_niv.at<T>(y,x) = 1;
 		}
 	}
 		color_change = false;
@@ -293,60 +608,49 @@ void marquer_contours_c4(cv::Mat img_niv)
 	{
     for (int x = 0; x < img_niv.cols; x++)
     {
-		if(img_niv.at<int>(y,x) !=255 && img_niv.at<int>(y,x) > 0)
+		if(img_niv.at<T>(y,x) !=255 && img_niv.at<T>(y,x) > 0)
 		{
-			img_niv.at<int>(y,x) = 1;
+			img_niv.at<T>(y,x) = 1;
 		}
 	}
 	}
 }
 
-void marquer_contours_c8(cv::Mat img_niv)
+template <typename T>
+void marquer_contours_c8_type(cv::Mat img_niv)
 {
 	//PLOP
 	//vector<int> marquage;
-	int check[img_niv.rows][img_niv.cols];
-
-    CHECK_MAT_TYPE(img_niv, CV_32SC1)
+	// Sur le tas : la pile ne suffit pas au-delà de quelques Mpix. Seul le
+	// signe de check compte : un octet par pixel.
+	std::vector<int8_t> check_tas (img_niv.total());
+	int8_t (*check)[img_niv.cols] = (int8_t (*)[img_niv.cols]) check_tas.data();
 
     for (int y = 0; y < img_niv.rows; y++)
     for (int x = 0; x < img_niv.cols; x++)
     {
 		//marquage.append(-1);
 		check[y][x] = -1;
-        int g = img_niv.at<int>(y,x);
+        int g = img_niv.at<T>(y,x);
         if (g > 0)
         {
-            img_niv.at<int>(y,x) = y;
+            img_niv.at<T>(y,x) = y;
         }
     }
-    int valeur_affectation = 1;
     for (int y = 0; y < img_niv.rows-1; y++)
     for (int x = 0; x < img_niv.cols-1; x++)
     {
 
-		if(img_niv.at<int>(y,x) > 0)
+		if(img_niv.at<T>(y,x) > 0)
 		{
 
-			if(x==0
-			|| y ==0
-			|| img_niv.at<int>(y-1,x) == 0
-			|| img_niv.at<int>(y,x-1) == 0
-			|| img_niv.at<int>(y,x+1) == 0
-			|| img_niv.at<int>(y+1,x) == 0)
-			{
-				check[y][x] = valeur_affectation;
-			}
-			else
-			{
-				valeur_affectation++;
-				check[y][x] = valeur_affectation;
-			}
+			check[y][x] = 1;
 
 		}
 
     }
-    int check2 [img_niv.rows][img_niv.cols];
+    std::vector<int8_t> check2_tas (img_niv.total());
+    int8_t (*check2)[img_niv.cols] = (int8_t (*)[img_niv.cols]) check2_tas.data();
     for (int y = 1; y < img_niv.rows-1; y++)
     for (int x = 1; x < img_niv.cols-1; x++)
 		check2[y][x] = check[y][x];
@@ -380,7 +684,7 @@ void marquer_contours_c8(cv::Mat img_niv)
     {
 		if(check[y][x] > 0)
 		{
-			img_niv.at<int>(y,x) = 255;
+			img_niv.at<T>(y,x) = 255;
 			if(color_change)
 				color_change = false;
 			else
@@ -389,11 +693,11 @@ void marquer_contours_c8(cv::Mat img_niv)
 
 		if(check[y][x] < 0 && !color_change)
 		{
-			//img_niv.at<int>(y,x) = 0;
+			//img_niv.at<T>(y,x) = 0;
 		}
 		if(check[y][x] < 0 && color_change)
 		{
-			//img_niv.at<int>(y,x) = 1;
+			//img_niv.at<T>(y,x) = 1;
 		}
 	}
 		color_change = false;
@@ -402,35 +706,38 @@ void marquer_contours_c8(cv::Mat img_niv)
 	{
     for (int x = 0; x < img_niv.cols; x++)
     {
-		if(img_niv.at<int>(y,x) !=255 && img_niv.at<int>(y,x) > 0)
+		if(img_niv.at<T>(y,x) !=255 && img_niv.at<T>(y,x) > 0)
 		{
-			img_niv.at<int>(y,x) = 1;
+			img_niv.at<T>(y,x) = 1;
 		}
 	}
 	}
 }
 
-void numeroter_contours_c8(cv::Mat img_niv)
+template <typename T, typename L>
+void numeroter_contours_c8_type(cv::Mat img_niv)
 {
 	//PLOP
 	//vector<int> marquage;
-	int check[img_niv.rows][img_niv.cols];
-
-    CHECK_MAT_TYPE(img_niv, CV_32SC1)
+	// Sur le tas : la pile ne suffit pas au-delà de quelques Mpix. Les
+	// étiquettes sont de type L, assez large pour img_niv.total(). La ligne
+	// précédant l'image, lue pour y = 0, vaut -1.
+	std::vector<L> check_tas (img_niv.total() + img_niv.cols + 1, -1);
+	L (*check)[img_niv.cols] = (L (*)[img_niv.cols]) (check_tas.data() + img_niv.cols + 1);
 
     for (int y = 0; y < img_niv.rows; y++)
     for (int x = 0; x < img_niv.cols; x++)
     {
 		//marquage.append(-1);
 		check[y][x] = -1;
-        int g = img_niv.at<int>(y,x);
+        int g = img_niv.at<T>(y,x);
         if (g > 0)
         {
-            img_niv.at<int>(y,x) = y;
+            img_niv.at<T>(y,x) = y;
         }
     }
     int size = img_niv.rows * img_niv.cols;
-	int list_eq[size];
+	std::vector<L> list_eq (size);
     int valeur_affectation = 1;
 
     for(int i=0;i<size;i++)
@@ -441,15 +748,15 @@ void numeroter_contours_c8(cv::Mat img_niv)
     {
 
 
-		if(img_niv.at<int>(y,x) > 0)
+		if(img_niv.at<T>(y,x) > 0)
 		{
 
 			if(x==0
 			|| y ==0
-			|| img_niv.at<int>(y-1,x) == 0
-			|| img_niv.at<int>(y,x-1) == 0
-			|| img_niv.at<int>(y,x+1) == 0
-			|| img_niv.at<int>(y+1,x) == 0)
+			|| img_niv.at<T>(y-1,x) == 0
+			|| img_niv.at<T>(y,x-1) == 0
+			|| img_niv.at<T>(y,x+1) == 0
+			|| img_niv.at<T>(y+1,x) == 0)
 			{
 
 				//int k = check[y][x];
@@ -531,7 +838,7 @@ void numeroter_contours_c8(cv::Mat img_niv)
     int i=1;
     int nb_elem = 1;
 
-    int list_eq2[size];
+    std::vector<L> list_eq2 (size);
 
 
     for(int i=0;i<size;i++)
@@ -572,7 +879,7 @@ void numeroter_contours_c8(cv::Mat img_niv)
 		if(check[y][x] > 0)
 		{
 			int j = check[y][x];
-			img_niv.at<int>(y,x) = list_eq2[j] %255;
+			img_niv.at<T>(y,x) = list_eq2[j] %255;
 			//std::cout<<" "<<list_eq2[j];
 			std::cout<<" j : "<<j<<" "<<list_eq[j];
 
@@ -581,17 +888,46 @@ void numeroter_contours_c8(cv::Mat img_niv)
 
 		if(check[y][x] < 0 && !color_change)
 		{
-			img_niv.at<int>(y,x) = 0;
+			img_niv.at<T>(y,x) = 0;
 		}
 		if(check[y][x] < 0 && color_change)
 		{
-			//img_niv.at<int>(y,x) = 1;
+			//img_niv.at<T>(y,x) = 1;
 		}
 	}
 		color_change = false;
 	}
 }
 
+// img_niv binaire en type_marquage ou CV_32SC1 (type_numerotation pour la
+// numérotation)
+void marquer_contours_c4 (cv::Mat img_niv)
+{
+    appeler_selon_type (__func__, img_niv, type_marquage (img_niv.rows),
+                        [&] (auto t) {
+        marquer_contours_c4_type<decltype(t)> (img_niv);
+    });
+}
+
+void marquer_contours_c8 (cv::Mat img_niv)
+{
+    appeler_selon_type (__func__, img_niv, type_marquage (img_niv.rows),
+                        [&] (auto t) {
+        marquer_contours_c8_type<decltype(t)> (img_niv);
+    });
+}
+
+void numeroter_contours_c8 (cv::Mat img_niv)
+{
+    appeler_selon_type (__func__, img_niv, type_numerotation (img_niv.rows),
+                        [&] (auto t) {
+        if (img_niv.total() <= SHRT_MAX)
+            numeroter_contours_c8_type<decltype(t), int16_t> (img_niv);
+        else
+            numeroter_contours_c8_type<decltype(t), int32_t> (img_niv);
+    });
+}
+
 void transformer_bandes_verticales (cv::Mat img_niv)
 {
     CHECK_MAT_TYPE(img_niv, CV_32SC1)
@@ -633,6 +969,59 @@ struct ContourF8
   //----
   std::vector<int> chaineFreeman;
   int taillchaineFreeman;
+  bool trou = false;      // bord d'un trou (départ avec le fond à droite)
+};
+
+// Arbre des contours (bords extérieurs et leurs trous) en tableaux plats,
+// indexés comme les contours : parent (-1 pour le cadre de l'image), premier
+// fils et frère suivant (-1 si aucun), profondeur. Les racines sont chaînées
+// par frere_suivant depuis premiere_racine ; ordre donne le parcours
+// préfixe, chaque contour avant ses fils.
+struct HierarchieContours
+{
+  std::vector<int32_t> parent, premier_fils, frere_suivant, profondeur, ordre;
+  int32_t premiere_racine = -1;
+
+  void ajouter(int32_t p)
+  {
+    int32_t id = parent.size();
+    parent.push_back(p);
+    premier_fils.push_back(-1);
+    frere_suivant.push_back(-1);
+    profondeur.push_back(p < 0 ? 0 : profondeur[p] + 1);
+    dernier_fils.push_back(-1);
+    // Les frères restent dans l'ordre du balayage
+    int32_t & dernier = p < 0 ? derniere_racine : dernier_fils[p];
+    if (dernier < 0) (p < 0 ? premiere_racine : premier_fils[p]) = id;
+    else frere_suivant[dernier] = id;
+    dernier = id;
+  }
+
+  void calculer_ordre()
+  {
+    ordre.clear();
+    ordre.reserve(parent.size());
+    std::vector<int32_t> pile;
+    for (int32_t r = premiere_racine; r >= 0; r = frere_suivant[r])
+    {
+      pile.push_back(r);
+      while (!pile.empty())
+      {
+        int32_t c = pile.back();
+        pile.pop_back();
+        ordre.push_back(c);
+        // Empilés à l'envers pour sortir dans l'ordre des frères
+        size_t base = pile.size();
+        for (int32_t f = premier_fils[c]; f >= 0; f = frere_suivant[f])
+          pile.push_back(f);
+        std::reverse(pile.begin() + base, pile.end());
+      }
+    }
+  }
+
+  private:
+    std::vector<int32_t> dernier_fils;
+    int32_t derniere_racine = -1;
 };
 struct point_img
 {
@@ -646,7 +1035,9 @@ struct ContourPol
 
 //std::vector<int *> freeman_chains;
 //------TP3------
-double seuil_recalc = 0.6;
+// thread_local : en mode batch chaque travailleur fixe son propre seuil
+// dans effectuer_transformations
+thread_local double seuil_recalc = 0.6;
 //double seuil_pol = 4.0;
 std::vector<ContourPol> suivit_chaine_freeman(ContourF8 cfc,cv::Mat img)
 {
@@ -928,11 +1319,140 @@ std::vector<ContourPol> approximer_contour_c8(ContourF8 cfc, cv::Mat img)
   return vect_contour_pol;
 
 }
+
+//------DSS------
+// Reconnaissance arithmétique des segments de droite discrète (DSS) le long
+// de la chaîne de Freeman, en un seul parcours O(n).
+//
+// Un DSS 8-connexe n'utilise que deux codes voisins c et c+1 (mod 8) : l'un
+// est axial (pair), l'autre diagonal (impair). On se ramène au premier
+// octant en comptant un pas pair comme (1,0) et un pas impair comme (1,1),
+// puis on maintient la droite naïve mu <= a*x - b*y < mu + b (0 <= a <= b)
+// avec ses points d'appui (Debled-Rennesson & Reveillès).
+
+enum ModePolyg { P_DOUGLAS_PEUCKER, P_DSS };
+// thread_local : le fil de calcul de fond reçoit ses propres valeurs avec
+// chaque demande (voir CalculFond)
+thread_local ModePolyg glob_mode_polyg = P_DOUGLAS_PEUCKER;
+
+struct SegmentDSS
+{
+  int a, b, mu;
+  point_img u_f, u_l, l_f, l_l;  // points d'appui supérieurs et inférieurs
+  point_img fin;                 // dernier point, en coordonnées locales
+  int code1, code2;              // codes de Freeman rencontrés (-1 si aucun)
+};
+
+void initialiser_dss(SegmentDSS * s)
+{
+  point_img o;
+  o.x = 0; o.y = 0;
+  s->a = 0; s->b = 1; s->mu = 0;
+  s->u_f = s->u_l = s->l_f = s->l_l = s->fin = o;
+  s->code1 = s->code2 = -1;
+}
+
+// Tente d'étendre le segment d'un pas de code d ; renvoie false (sans
+// modifier le segment) si le point suivant sort du DSS.
+bool etendre_dss(SegmentDSS * s, int d)
+{
+  int code1 = s->code1, code2 = s->code2;
+  if(code1 < 0) code1 = d;
+  else if(d != code1)
+  {
+    if(code2 < 0)
+    {
+      int ecart = (d - code1 + 8) % 8;
+      if(ecart != 1 && ecart != 7) return false;
+      code2 = d;
+    }
+    else if(d != code2) return false;
+  }
+
+  point_img m;
+  m.x = s->fin.x + 1;
+  m.y = s->fin.y + (d % 2);
+  int r = s->a * m.x - s->b * m.y;
+
+  if(r >= s->mu && r < s->mu + s->b)
+  {
+    if(r == s->mu) s->u_l = m;
+    if(r == s->mu + s->b - 1) s->l_l = m;
+  }
+  else if(r == s->mu - 1)
+  {
+    // point faiblement extérieur au-dessus : la pente augmente
+    s->l_f = s->l_l;
+    s->u_l = m;
+    s->a = m.y - s->u_f.y;
+    s->b = m.x - s->u_f.x;
+    s->mu = s->a * m.x - s->b * m.y;
+  }
+  else if(r == s->mu + s->b)
+  {
+    // point faiblement extérieur en dessous : la pente diminue
+    s->u_f = s->u_l;
+    s->l_l = m;
+    s->a = m.y - s->l_f.y;
+    s->b = m.x - s->l_f.x;
+    s->mu = s->a * s->u_f.x - s->b * s->u_f.y;
+  }
+  else return false;
+
+  s->fin = m;
+  s->code1 = code1;
+  s->code2 = code2;
+  return true;
+}
+
+std::vector<ContourPol> approximer_contour_c8_dss(ContourF8 cfc)
+{
+  std::vector<ContourPol> vect_contour_pol;
+  vect_contour_pol.reserve(cfc.chaineFreeman.size());
+  point_img pts;
+  pts.x=cfc.xPointDepart;
+  pts.y=cfc.yPointDepart;
+  ContourPol cp;
+  cp.estSommetApproxPoly = false;
+  for(unsigned int i = 0; i< cfc.chaineFreeman.size();i++)
+  {
+    pts.x=pts.x +dir_x[cfc.chaineFreeman[i]];
+    pts.y=pts.y +dir_y[cfc.chaineFreeman[i]];
+    cp.p = pts;
+    vect_contour_pol.push_back(cp);
+  }
+  if(vect_contour_pol.empty()) return vect_contour_pol;
+
+  // Segments maximaux gloutons : chaque pas refusé ferme le segment courant
+  // sur le point précédent, qui devient le départ du suivant.
+  SegmentDSS seg;
+  initialiser_dss(&seg);
+  for(unsigned int i = 0; i < cfc.chaineFreeman.size(); i++)
+  {
+    int d = cfc.chaineFreeman[i];
+    if(!etendre_dss(&seg, d))
+    {
+      vect_contour_pol.at(i-1).estSommetApproxPoly = true;
+      initialiser_dss(&seg);
+      etendre_dss(&seg, d);
+    }
+  }
+  vect_contour_pol.back().estSommetApproxPoly = true;
+  return vect_contour_pol;
+}
+
+std::vector<ContourPol> approximer_contour(ContourF8 cfc, cv::Mat img)
+{
+  if(glob_mode_polyg == P_DSS)
+    return approximer_contour_c8_dss(cfc);
+  return approximer_contour_c8(cfc, img);
+}
+//-----_DSS_-----
 //-----_TP3_-----
 
 //------TP4------
 
-int glob_connex = 4;
+thread_local int glob_connex = 4;   // idem glob_mode_polyg
 void remplir_polyg(cv::Mat img,std::vector<ContourPol> vec_pol,int color)
 {
   std::vector<cv::Point> vec_pts;
@@ -949,15 +1469,20 @@ void remplir_polyg(cv::Mat img,std::vector<ContourPol> vec_pol,int color)
   cv::fillPoly(img, elementPoints, &nb_point, 1, cv::Scalar(color));
 }
 
+bool contour_est_trou(const ContourF8 & cfc)
+{
+  return cfc.trou;
+}
+
 void approximer_et_remplir_contour_c8(cv::Mat img,std::vector<ContourF8> vec,double seuil)
 {
   //nettoyage de l'image
   img.setTo(0);
   for(unsigned int i = 0; i< vec.size();i++)
   {
-    std::vector<ContourPol> vec_pol = approximer_contour_c8(vec.at(i), img);
+    std::vector<ContourPol> vec_pol = approximer_contour(vec.at(i), img);
     int color = 255;
-    if(vec.at(i).dir_init == 2 || vec.at(i).dir_init == 0)
+    if(contour_est_trou(vec.at(i)))
     {
       color = 0;
     }
@@ -985,6 +1510,7 @@ void effectuer_pelage_DT(cv::Mat img, int connexite)
     out = true;
     for(int y = 0; y< img.rows; y++)
   	{
+      verifier_annulation();
   		for (int x = 0; x < img.cols; x++)
   		{
 
@@ -1060,26 +1586,29 @@ void effectuer_pelage_RDT(cv::Mat img, int connexite)
   for (int m = max-1; m > 0; m--)
   {
     for (int y = 0; y < img.rows; y++)// +1 -1
-    for (int x = 0; x < img.cols; x++)// +1 -1
     {
-      if (img.at<int>(y,x) < m){
-        unsigned int nv = 8;
-        if(connexite == 8)
-        {
-          nv = 4;
-        }
-        for(unsigned i = 0 ; i < nv ; i++)
-        {
-          int x_temp = x + dir_x[i];
-          int y_temp = y + dir_y[i];
-          if( x_temp > img.cols-1 || y_temp > img.rows-1 ||x_temp < 0 || y_temp < 0)
+      verifier_annulation();
+      for (int x = 0; x < img.cols; x++)// +1 -1
+      {
+        if (img.at<int>(y,x) < m){
+          unsigned int nv = 8;
+          if(connexite == 8)
           {
-            continue;
+            nv = 4;
           }
-          if(img.at<int>(y_temp,x_temp) > m)
+          for(unsigned i = 0 ; i < nv ; i++)
           {
-            img.at<int>(y,x) = m;
-            break;
+            int x_temp = x + dir_x[i];
+            int y_temp = y + dir_y[i];
+            if( x_temp > img.cols-1 || y_temp > img.rows-1 ||x_temp < 0 || y_temp < 0)
+            {
+              continue;
+            }
+            if(img.at<int>(y_temp,x_temp) > m)
+            {
+              img.at<int>(y,x) = m;
+              break;
+            }
           }
         }
       }
@@ -1097,37 +1626,62 @@ int next(cv::Mat img,int x,int y,int d)
 //variable stockant chaque chaine de freeman;
 //ContourF8 cdf;
 
-void marquer_un_contour_c8(cv::Mat img,int xa,int ya,int dira,int num_contour,ContourF8 * cdf)
+// Marquage d'un pixel de contour à la manière de Suzuki & Abe : négatif si
+// son voisin de droite (fond ou hors image) a été examiné pendant le suivi,
+// ce qui interdit d'y faire partir un autre trou ; sinon le numéro du
+// contour, seulement si le pixel n'était pas déjà marqué. Les pixels rendus
+// négatifs sont notés dans negatifs pour être remis en positif à la fin.
+void marquer_pixel_c8(cv::Mat img,int x,int y,bool droite_vue,int num_contour,
+                      std::vector<cv::Point> * negatifs)
+{
+	int & v = img.at<int>(y,x);
+	if(droite_vue)
+	{
+		if(v > 0 && negatifs) negatifs->push_back(cv::Point(x,y));
+		v = -num_contour;
+	}
+	else if(v == 255)
+	{
+		v = num_contour;
+	}
+}
+
+void marquer_un_contour_c8(cv::Mat img,int xa,int ya,int dira,int num_contour,ContourF8 * cdf,
+                           std::vector<cv::Point> * negatifs = NULL)
 {
 	std::cout << "suivre contour " << xa << " , " << ya <<std::endl;
-	int dir_finale ;
+	int dir_finale = -1;
 	for(int i = 0; i<8; i++)
 	{
 		int d= (dira+i)%8;
 		int xb = xa + dir_x[d];
 		int yb = ya + dir_y[d];
-		int q = img.at<int>(yb,xb);
-		if(q > 0 && (yb)>=0 && (xb)>=0
-			&& (yb)<=img.rows-1 && (xb)<=img.cols-1)
+		if (xb < 0 || yb < 0 || xb >= img.cols || yb >= img.rows) continue;
+		if(img.at<int>(yb,xb) != 0)
 		{
 			dir_finale = (d+4)%8;
 			break;
 		}
 	}
+	if(dir_finale < 0)
+	{
+		// pixel isolé
+		marquer_pixel_c8(img,xa,ya,true,num_contour,negatifs);
+		return;
+	}
 
 	int x = xa;
 	int y = ya;
 	int dir = dir_finale;
 	int cpt = 0;
-	int q;
 	do
 	{
 		cpt++;
 		//if (cpt > 300)break;
 		std::cout << "do"<<std::endl;
-		img.at<int>(y,x) =  num_contour;
 		dir = (dir + 4 -1)%8;
 		int i = 0;
+		bool droite_vue = false;
 
 		for(;i<8;i++)
 		{
@@ -1136,22 +1690,21 @@ void marquer_un_contour_c8(cv::Mat img,int xa,int ya,int dira,int num_contour,Co
 
 			int xb = x + dir_x[d];
 			int yb = y + dir_y[d];
-			q = img.at<int>(yb,xb);
 
-			if (xb < 0 || yb < 0 || xb >= img.cols || yb >= img.rows) continue;
-				q = img.at<int>(yb, xb);
-			if(q>0 && (xb)>=0 && (yb)>=0
-			&& (yb)<=img.rows-1 && (xb)<=img.cols-1)
+			if (xb < 0 || yb < 0 || xb >= img.cols || yb >= img.rows
+				|| img.at<int>(yb, xb) == 0)
 			{
-				x = xb;
-				y = yb;
-				dir = d;
-
-				cdf->chaineFreeman.push_back(dir);
-				//std::cout<<"if dir"<<dir<<std::endl;;
-				break;
+				if(d == 0) droite_vue = true;
+				continue;
 			}
-			//std::cout << "   after if"<<std::endl;
+			marquer_pixel_c8(img,x,y,droite_vue,num_contour,negatifs);
+			x = xb;
+			y = yb;
+			dir = d;
+
+			cdf->chaineFreeman.push_back(dir);
+			//std::cout<<"if dir"<<dir<<std::endl;;
+			break;
 		}
 		if(i == 8)//8?
 		{
@@ -1163,144 +1716,1794 @@ void marquer_un_contour_c8(cv::Mat img,int xa,int ya,int dira,int num_contour,Co
 
 }
 
-void suivre_un_contour_c8(cv::Mat img,int xa,int ya,int dira,int num_contour,ContourF8 * cdf)
+void suivre_un_contour_c8(cv::Mat img,int xa,int ya,int dira,int num_contour,ContourF8 * cdf,
+                         std::vector<cv::Point> * negatifs = NULL)
 {
 
-	marquer_un_contour_c8(img, xa,ya,dira,num_contour,cdf);
+	marquer_un_contour_c8(img, xa,ya,dira,num_contour,cdf,negatifs);
 	//return img;
 }
-std::vector<ContourF8> effectuer_suivi_contours_c8(cv::Mat img_niv)
+// Numéro de marquage du contour d'indice i, et inversement (255 est réservé
+// aux pixels d'objet pas encore suivis)
+inline int numero_marquage(int i) { return i + 1 < 255 ? i + 1 : i + 2; }
+inline int indice_marquage(int v) { return v < 255 ? v - 1 : v - 2; }
+
+// Suivi de tous les contours en un balayage ligne par ligne, selon Suzuki &
+// Abe : un bord extérieur part d'un pixel d'objet non suivi dont le voisin de
+// gauche est du fond (dir_init = 4), un trou part d'un pixel d'objet
+// non négatif dont le voisin de droite est du fond (dir_init = 0), même déjà
+// marqué par un autre contour. Chaque paire composante d'objet / composante
+// de fond voisine donne ainsi exactement un contour, et la nature du contour
+// est connue dès son départ.
+//
+// Si hier est donné, l'arbre des contours est construit pendant le même
+// balayage : le dernier pixel de contour rencontré sur la ligne à gauche du
+// départ désigne le bord B que l'on vient de franchir ; le nouveau contour
+// est fils de B si l'un est un trou et l'autre un bord extérieur, sinon
+// frère de B.
+std::vector<ContourF8> effectuer_suivi_contours_c8(cv::Mat img_niv,
+                                                   HierarchieContours * hier = NULL)
 {
 	//------TP3------
 	//
 	int max_iter = 0;
 
 	std::vector<ContourF8 > contours;
-	bool estCoordDepart = true;
-	//int tailleChaineCourante = 0;
-	ContourF8 contourCourrant;
+	std::vector<cv::Point> negatifs;
 	//------_TP3_------
 	int new_contour = 1;
 	int dir;
+	if(hier) *hier = HierarchieContours();
 	for(int y = 0; y< img_niv.rows; y++)
 	{
+		verifier_annulation();
+		int dernier_bord = -1;   // -1 : cadre de l'image
 		for (int x = 0; x < img_niv.cols; x++)
 		{
+			int v = img_niv.at<int>(y,x);
+			if(v == 0) continue;
 
 			ContourF8 cdf ;
 			//std::cout<< "pixel : " << x << ", "<< y << std::endl;
-			if(img_niv.at<int>(y,x) == 255)
+			dir = -1;
+			if(v == 255 && (x==0 || img_niv.at<int>(y,x-1) == 0))
 			{
-				//------TP3------
-				if(estCoordDepart)
-				{
-				  contourCourrant.xPointDepart = x;
-				  contourCourrant.yPointDepart = y;
-				  cdf.xPointDepart = x;
-				  cdf.yPointDepart = y;
-          cdf.dir_init = 0; // WARNING
-				  estCoordDepart = false;
-				}
-				//-----_TP3_-----
-				dir = -1;
-				if(x==img_niv.cols-1 || img_niv.at<int>(y,x+1) == 0)
-				{
-					dir = 0;
-				}
-				else if(y==img_niv.rows-1 || img_niv.at<int>(y+1,x) == 0)
-				{
-					dir = 2;
-				}
-				else if(x==0 || img_niv.at<int>(y,x-1) == 0)
+				dir = 4;
+			}
+			else if(v > 0 && (x==img_niv.cols-1 || img_niv.at<int>(y,x+1) == 0))
+			{
+				dir = 0;
+				if(v != 255) dernier_bord = indice_marquage(v);
+			}
+			if(dir>=0)
+			{
+				cdf.xPointDepart = x;
+				cdf.yPointDepart = y;
+				cdf.dir_init = dir;
+				cdf.trou = dir == 0;
+				suivre_un_contour_c8(img_niv,x,y,dir,new_contour,&cdf,&negatifs);
+				new_contour++;
+				if(new_contour == 255)
 				{
-					dir = 4;
+					new_contour++;
 				}
-				else if(y==0 || img_niv.at<int>(y-1,x) == 0)
+				//------TP3------
+				cdf.taillchaineFreeman = cdf.chaineFreeman.size();
+				if(hier)
 				{
-					dir = 6;
+					int b = dernier_bord;
+					if(b < 0) hier->ajouter(-1);
+					else hier->ajouter(cdf.trou != contours.at(b).trou ? b : hier->parent.at(b));
 				}
-				//------TP3------
-				//contourCourrant.chaineFreeman.push_back(dir);
-				//tailleChaineCourante ++;
-				//------_TP3_------
-				if(dir>=0)
+				contours.push_back(cdf);
+				std::cout <<"contour : "<<new_contour<< " premier point : "<<cdf.xPointDepart<<" "
+				<<cdf.yPointDepart<<" taille chaine freeman"<<cdf.taillchaineFreeman<<"\n";
+				std::cout <<" chaine de Freeman :\n";
+
+				for(unsigned int i=0; i<cdf.chaineFreeman.size(); i++)
 				{
-          cdf.xPointDepart = x;
-				  cdf.yPointDepart = y;
-          cdf.dir_init = dir;
-					suivre_un_contour_c8(img_niv,x,y,dir,new_contour,&cdf);
-					new_contour++;
-					if(new_contour == 255)
-					{
-						new_contour++;
-					}
-					//------TP3------
-					estCoordDepart = true;
-					//contourCourrant.taillchaineFreeman = tailleChaineCourante;
-					cdf.taillchaineFreeman = cdf.chaineFreeman.size();
-					//contours.push_back(contourCourrant);
-					contours.push_back(cdf);
-					std::cout <<"contour : "<<new_contour<< " premier point : "<<cdf.xPointDepart<<" "
-					<<cdf.yPointDepart<<" taille chaine freeman"<<cdf.taillchaineFreeman<<"\n";
-					std::cout <<" chaine de Freeman :\n";
-
-					for(unsigned int i=0; i<cdf.chaineFreeman.size(); i++)
-					{
-						std::cout <<" "<< cdf.chaineFreeman.at(i);
-					}
-
-					std::cout <<"\n";
-					//tailleChaineCourante = 0;
-					//if(max_iter<3)approximer_contour_c8(cdf, img_niv);
-					max_iter++;
-					//cdf.chaineFreeman.clear();
-					ContourF8 contourCourrant;
-					//-----_TP3_-----
+					std::cout <<" "<< cdf.chaineFreeman.at(i);
 				}
+
+				std::cout <<"\n";
+				max_iter++;
+				//-----_TP3_-----
 			}
+			v = img_niv.at<int>(y,x);
+			if(v != 255) dernier_bord = indice_marquage(std::abs(v));
 		}
 	}
+	// les marques négatives ne servaient qu'au balayage
+	for(unsigned int i = 0; i < negatifs.size(); i++)
+	{
+		int & v = img_niv.at<int>(negatifs[i].y, negatifs[i].x);
+		v = std::abs(v);
+	}
 	return contours;
 }
 
-void dessiner_contours_poly(cv::Mat img)
+// Refait sur l'image binaire img_niv le marquage que laisse
+// effectuer_suivi_contours_c8, à partir des seules chaînes. En chaque pixel,
+// le suivi examine les directions de (arrivée + 3) jusqu'au code suivant non
+// compris, en tournant dans le sens direct : ce sont des pixels de fond, et
+// le voisin de droite est vu si la direction 0 en fait partie. L'arrivée au
+// pixel de départ est le dernier code de la chaîne.
+void remarquer_contours_c8(cv::Mat img_niv, const std::vector<ContourF8> & contours)
 {
-  std::vector<ContourF8> contours = effectuer_suivi_contours_c8(img);
-	for(unsigned int i = 0;i<contours.size();i++)
+	std::vector<cv::Point> negatifs;
+	for(unsigned int i = 0; i < contours.size(); i++)
 	{
-		std::cout<<"step : "<< i <<std::endl;
-		std::vector<ContourPol> vect_contour_pol = approximer_contour_c8(contours.at(i), img);
-    colorier_morceaux(vect_contour_pol,img);
-		std::cout<<"pomdeter "<<std::endl;
+		const ContourF8 & cdf = contours[i];
+		int num = numero_marquage(i);
+		int x = cdf.xPointDepart;
+		int y = cdf.yPointDepart;
+		size_t n = cdf.chaineFreeman.size();
+		if(n == 0)
+		{
+			// pixel isolé
+			marquer_pixel_c8(img_niv,x,y,true,num,&negatifs);
+			continue;
+		}
+		int arrivee = cdf.chaineFreeman[n-1];
+		for(size_t k = 0; k < n; k++)
+		{
+			int d = cdf.chaineFreeman[k];
+			bool droite_vue = false;
+			for(int e = (arrivee + 3)%8; e != d; e = (e + 7)%8)
+				if(e == 0) droite_vue = true;
+			marquer_pixel_c8(img_niv,x,y,droite_vue,num,&negatifs);
+			x += dir_x[d];
+			y += dir_y[d];
+			arrivee = d;
+		}
+	}
+	for(unsigned int i = 0; i < negatifs.size(); i++)
+	{
+		int & v = img_niv.at<int>(negatifs[i].y, negatifs[i].x);
+		v = std::abs(v);
 	}
 }
 
-void dessiner_approx_poly(cv::Mat img)
+//------FICHIER CONTOURS------
+// Format binaire des contours, lisible par mmap sans copie :
+//
+//   EnteteFichierContours                         40 octets
+//   pour chaque contour, aligné sur 8 octets :
+//     EnregistrementContour                       16 octets
+//     codes de Freeman sur 3 bits, bit de poids faible d'abord
+//   index : nb_contours positions uint64 depuis le début du fichier
+//
+// Les entiers sont dans l'ordre natif de la machine. L'empreinte est celle de
+// l'image binaire tracée, pour savoir si le fichier est encore valable.
+
+struct EnteteFichierContours
 {
-	std::vector<ContourF8> contours = effectuer_suivi_contours_c8(img);
-  //int cpt = 1;
-	for(unsigned int i = 0;i<contours.size();i++)
-	{
-		std::cout<<"step : "<< i <<std::endl;
-		std::vector<ContourPol> vect_contour_pol = approximer_contour_c8(contours.at(i), img);
-    colorier_morceaux(vect_contour_pol,img);
+  char     magie[4];      // "GDC8"
+  uint32_t version;
+  int32_t  rows, cols;
+  uint64_t empreinte;
+  uint32_t nb_contours;
+  uint32_t reserve;
+  uint64_t pos_index;
+};
 
-    //remplir_polyg(img,vect_contour_pol,cpt);
-    //cpt++;
-    //if(cpt == 255)cpt++;
-		std::cout<<"pomdeter "<<std::endl;
-	}
+struct EnregistrementContour
+{
+  int32_t  x, y;
+  uint32_t nb_codes;
+  uint8_t  dir_init;
+  uint8_t  drapeaux;      // bit 0 : trou
+  uint16_t reserve;
+};
+
+const uint32_t VERSION_FICHIER_CONTOURS = 2;   // 2 : départs de Suzuki & Abe
+const uint8_t  DRAPEAU_TROU = 1;
+
+// Empreinte FNV-1a de l'image binaire (pixel > 0 ou non)
+uint64_t calculer_empreinte_binaire(cv::Mat img_niv)
+{
+  CHECK_MAT_TYPE(img_niv, CV_32SC1)
+
+  uint64_t h = 14695981039346656037ULL;
+  for (int y = 0; y < img_niv.rows; y++)
+  {
+    const int *ligne = img_niv.ptr<int>(y);
+    for (int x = 0; x < img_niv.cols; x++)
+    {
+      h ^= (ligne[x] > 0);
+      h *= 1099511628211ULL;
+    }
+  }
+  return h;
+}
+
+// Vue en lecture seule sur un contour du fichier projeté en mémoire
+struct VueContourF8
+{
+  const EnregistrementContour * e;
+  const uint8_t * codes;
+
+  int code(uint32_t k) const
+  {
+    uint32_t bit = 3 * k;
+    unsigned mot = codes[bit >> 3] | (codes[(bit >> 3) + 1] << 8);
+    return (mot >> (bit & 7)) & 7;
+  }
+
+  ContourF8 convertir() const
+  {
+    ContourF8 cfc;
+    cfc.xPointDepart = e->x;
+    cfc.yPointDepart = e->y;
+    cfc.dir_init = e->dir_init;
+    cfc.trou = e->drapeaux & DRAPEAU_TROU;
+    cfc.chaineFreeman.resize(e->nb_codes);
+    for (uint32_t k = 0; k < e->nb_codes; k++)
+      cfc.chaineFreeman[k] = code(k);
+    cfc.taillchaineFreeman = e->nb_codes;
+    return cfc;
+  }
+};
+
+bool ecrire_fichier_contours_flux(const char * nom, const std::vector<ContourF8> & contours,
+                                  int rows, int cols, uint64_t empreinte)
+{
+  std::ofstream f(nom, std::ios::binary);
+  if (!f) return false;
+
+  EnteteFichierContours ent;
+  memcpy(ent.magie, "GDC8", 4);
+  ent.version = VERSION_FICHIER_CONTOURS;
+  ent.rows = rows;
+  ent.cols = cols;
+  ent.empreinte = empreinte;
+  ent.nb_contours = contours.size();
+  ent.reserve = 0;
+  ent.pos_index = 0;
+  f.write((const char *) &ent, sizeof(ent));
+
+  std::vector<uint64_t> index;
+  index.reserve(contours.size());
+  uint64_t pos = sizeof(ent);
+  std::vector<uint8_t> codes;
+  for (unsigned int i = 0; i < contours.size(); i++)
+  {
+    const ContourF8 & cfc = contours.at(i);
+    EnregistrementContour e;
+    e.x = cfc.xPointDepart;
+    e.y = cfc.yPointDepart;
+    e.nb_codes = cfc.chaineFreeman.size();
+    e.dir_init = cfc.dir_init;
+    e.drapeaux = contour_est_trou(cfc) ? DRAPEAU_TROU : 0;
+    e.reserve = 0;
+
+    // un octet de plus pour que VueContourF8::code lise toujours 16 bits,
+    // puis alignement sur 8 octets
+    size_t taille = (3 * (size_t) e.nb_codes + 7) / 8 + 1;
+    taille = (sizeof(e) + taille + 7) / 8 * 8 - sizeof(e);
+    codes.assign(taille, 0);
+    for (uint32_t k = 0; k < e.nb_codes; k++)
+    {
+      uint32_t bit = 3 * k;
+      unsigned mot = (cfc.chaineFreeman[k] & 7) << (bit & 7);
+      codes[bit >> 3] |= mot & 255;
+      codes[(bit >> 3) + 1] |= mot >> 8;
+    }
+
+    index.push_back(pos);
+    f.write((const char *) &e, sizeof(e));
+    f.write((const char *) codes.data(), taille);
+    pos += sizeof(e) + taille;
+  }
+
+  f.write((const char *) index.data(), index.size() * sizeof(uint64_t));
+  ent.pos_index = pos;
+  f.seekp(0);
+  f.write((const char *) &ent, sizeof(ent));
+  f.close();
+  return (bool) f;
+}
+
+// empreinte : celle de l'image binaire avant le suivi, qui la marque.
+// Écrit dans un fichier temporaire puis le renomme : un lecteur qui projette
+// l'ancien fichier garde son inode et ne voit jamais un fichier à moitié
+// écrit.
+bool ecrire_fichier_contours(const char * nom, const std::vector<ContourF8> & contours,
+                             int rows, int cols, uint64_t empreinte)
+{
+  std::string temp = std::string(nom) + ".tmp" + std::to_string(getpid());
+  bool ok = ecrire_fichier_contours_flux(temp.c_str(), contours, rows, cols, empreinte)
+            && rename(temp.c_str(), nom) == 0;
+  if (!ok) {
+    std::cout << "Erreur d'écriture de " << nom << std::endl;
+    unlink(temp.c_str());
+  }
+  return ok;
+}
+
+class FichierContours
+{
+  public:
+    FichierContours() {}
+    ~FichierContours() { fermer(); }
+    FichierContours(const FichierContours &) = delete;
+    FichierContours & operator= (const FichierContours &) = delete;
+
+    bool ouvrir(const char * nom)
+    {
+      fermer();
+      int fd = open(nom, O_RDONLY);
+      if (fd < 0) return false;
+      struct stat st;
+      if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(EnteteFichierContours)) {
+        close(fd);
+        return false;
+      }
+      taille = st.st_size;
+      void * p = mmap(NULL, taille, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (p == MAP_FAILED) return false;
+      base = (const uint8_t *) p;
+
+      const EnteteFichierContours * ent = entete();
+      if (memcmp(ent->magie, "GDC8", 4) != 0
+          || ent->version != VERSION_FICHIER_CONTOURS
+          || ent->pos_index % 8 != 0 || ent->pos_index > taille
+          || ent->nb_contours > (taille - ent->pos_index) / sizeof(uint64_t)) {
+        std::cout << "Fichier de contours invalide : " << nom << std::endl;
+        fermer();
+        return false;
+      }
+      index = (const uint64_t *) (base + ent->pos_index);
+      for (uint32_t i = 0; i < ent->nb_contours; i++)
+        if (!enregistrement_valide(index[i])) {
+          std::cout << "Fichier de contours invalide : " << nom
+                    << " (contour " << i << ")" << std::endl;
+          fermer();
+          return false;
+        }
+      return true;
+    }
+
+    void fermer()
+    {
+      if (base) munmap((void *) base, taille);
+      base = NULL;
+      index = NULL;
+      taille = 0;
+    }
+
+    bool est_ouvert() const { return base != NULL; }
+    const EnteteFichierContours * entete() const
+      { return (const EnteteFichierContours *) base; }
+    uint32_t nombre() const { return base ? entete()->nb_contours : 0; }
+
+    VueContourF8 contour(uint32_t i) const
+    {
+      VueContourF8 v;
+      v.e = (const EnregistrementContour *) (base + index[i]);
+      v.codes = (const uint8_t *) (v.e + 1);
+      return v;
+    }
+
+    std::vector<ContourF8> charger() const
+    {
+      std::vector<ContourF8> contours;
+      contours.reserve(nombre());
+      for (uint32_t i = 0; i < nombre(); i++)
+        contours.push_back(contour(i).convertir());
+      return contours;
+    }
+
+  private:
+    // L'enregistrement et ses codes (avec l'octet de plus lu par
+    // VueContourF8::code) tiennent dans le fichier ; tout est écrit pour ne
+    // pas déborder quelles que soient les valeurs lues.
+    bool enregistrement_valide(uint64_t pos) const
+    {
+      if (pos % 8 != 0 || pos < sizeof(EnteteFichierContours)
+          || pos > taille || taille - pos < sizeof(EnregistrementContour))
+        return false;
+      const EnregistrementContour * e = (const EnregistrementContour *) (base + pos);
+      uint64_t octets = (3 * (uint64_t) e->nb_codes + 7) / 8 + 1;
+      return octets <= taille - pos - sizeof(EnregistrementContour);
+    }
+
+    const uint8_t * base = NULL;
+    const uint64_t * index = NULL;
+    size_t taille = 0;
+};
+
+// Fichier de cache des contours, donné par l'option -ctr (NULL sinon)
+const char * glob_fichier_contours = NULL;
+
+// Le fichier de cache ouvert dans fc correspond-il à l'image binaire
+// img_niv, d'empreinte empreinte ?
+bool cache_contours_valable(const FichierContours & fc, cv::Mat img_niv,
+                            uint64_t empreinte)
+{
+  return fc.est_ouvert()
+      && fc.entete()->rows == img_niv.rows
+      && fc.entete()->cols == img_niv.cols
+      && fc.entete()->empreinte == empreinte;
+}
+
+// Relit les contours dans le fichier de cache s'il correspond à l'image
+// binaire img_niv, sinon effectue le suivi et réécrit le fichier. Dans les
+// deux cas img_niv ressort marquée comme par le suivi. L'arbre hier n'est
+// rempli que par un suivi, il reste vide après une relecture.
+// Cette forme reçoit le fichier déjà ouvert (ou non) et l'empreinte de
+// img_niv, pour ne les calculer qu'une fois avec mesurer_contours_c8.
+std::vector<ContourF8> obtenir_contours_c8(cv::Mat img_niv, HierarchieContours * hier,
+                                           FichierContours & fc, uint64_t empreinte)
+{
+  if (cache_contours_valable(fc, img_niv, empreinte))
+  {
+    std::cout << "Contours relus dans " << glob_fichier_contours << std::endl;
+    if (hier) *hier = HierarchieContours();
+    std::vector<ContourF8> contours = fc.charger();
+    remarquer_contours_c8(img_niv, contours);
+    return contours;
+  }
+  fc.fermer();
+
+  std::vector<ContourF8> contours = effectuer_suivi_contours_c8(img_niv, hier);
+  if (ecrire_fichier_contours(glob_fichier_contours, contours,
+                              img_niv.rows, img_niv.cols, empreinte))
+    std::cout << "Contours enregistrés dans " << glob_fichier_contours << std::endl;
+  return contours;
+}
+
+std::vector<ContourF8> obtenir_contours_c8(cv::Mat img_niv,
+                                           HierarchieContours * hier = NULL)
+{
+  if (glob_fichier_contours == NULL)
+    return effectuer_suivi_contours_c8(img_niv, hier);
+
+  FichierContours fc;
+  fc.ouvrir(glob_fichier_contours);
+  return obtenir_contours_c8(img_niv, hier, fc, calculer_empreinte_binaire(img_niv));
+}
+//-----_FICHIER CONTOURS_-----
+
+//------ENVELOPPE CONVEXE------
+// Enveloppe convexe d'un contour en temps linéaire, en parcourant sa chaîne
+// de Freeman. L'algorithme de Melkman suppose une ligne polygonale simple ;
+// une chaîne 8-connexe repasse deux fois sur les parties d'un pixel de
+// large et le test « à gauche des deux arêtes du dernier sommet » y perd
+// des sommets. On garde donc, pendant le parcours, les y extrêmes de chaque
+// colonne : ces points sont déjà triés par x, et la chaîne monotone
+// d'Andrew en tire l'enveloppe sans tri, en O(n + largeur) = O(n).
+//
+// Chaque sommet garde son rang dans la chaîne. Entre deux sommets
+// consécutifs dans l'ordre de la chaîne, la portion parcourue forme une
+// poche (défaut de convexité), dont la profondeur est la plus grande
+// distance de ses points à la corde qui relie les deux sommets.
+
+const double SEUIL_DEFAUT = 1.0;   // profondeur minimale d'une poche comptée
+
+struct EnveloppeConvexe
+{
+  std::vector<point_img> sommets;   // dans l'ordre de la chaîne
+  std::vector<uint32_t>  rangs;     // rang de chaque sommet dans la chaîne
+  double aire = 0, perimetre = 0;
+  double profondeur_max = 0;        // poche la plus profonde
+  uint32_t nb_defauts = 0;          // poches d'au moins SEUIL_DEFAUT
+};
+
+struct SommetEnveloppe
+{
+  int x, y;
+  uint32_t rang;
+};
+
+// > 0 si c est à gauche de (a,b), dans le repère de l'image
+inline int64_t tourner(const SommetEnveloppe & a, const SommetEnveloppe & b,
+                       const SommetEnveloppe & c)
+{
+  return int64_t(b.x - a.x) * (c.y - a.y) - int64_t(b.y - a.y) * (c.x - a.x);
+}
+
+// Enveloppe de la chaîne de n codes partant de (x0,y0) ; code(k) donne le
+// k-ième code, comme pour mesurer_chaine
+template <typename Codes>
+void envelopper_chaine(int x0, int y0, uint32_t n, Codes code, EnveloppeConvexe & e)
+{
+  e = EnveloppeConvexe();
+
+  // Une chaîne fermée de n pas reste dans [-n/2, n/2] autour du départ
+  int dec = n / 2 + 1;
+  std::vector<SommetEnveloppe> ymin(2 * dec + 1, { 0, INT_MAX, 0 }),
+                               ymax(2 * dec + 1, { 0, INT_MIN, 0 });
+  SommetEnveloppe p = { 0, 0, 0 };
+  int xmin = 0, xmax = 0;
+  for (uint32_t k = 0; ; k++)
+  {
+    SommetEnveloppe & a = ymin[p.x + dec], & b = ymax[p.x + dec];
+    if (p.y < a.y) a = p;
+    if (p.y > b.y) b = p;
+    xmin = std::min(xmin, p.x);
+    xmax = std::max(xmax, p.x);
+    if (k + 1 >= n) break;   // le point n revient au départ
+    p.x += dir_x[code(k)];
+    p.y += dir_y[code(k)];
+    p.rang = k + 1;
+  }
+
+  std::vector<SommetEnveloppe> c;
+  c.reserve(2 * (xmax - xmin + 1));
+  for (int x = xmin; x <= xmax; x++)
+  {
+    c.push_back(ymin[x + dec]);
+    if (ymax[x + dec].y != ymin[x + dec].y) c.push_back(ymax[x + dec]);
+  }
+
+  // Chaîne monotone : bord inférieur puis bord supérieur
+  std::vector<SommetEnveloppe> s(2 * c.size());
+  size_t h = 0;
+  for (size_t i = 0; i < c.size(); i++)
+  {
+    while (h >= 2 && tourner(s[h-2], s[h-1], c[i]) <= 0) h--;
+    s[h++] = c[i];
+  }
+  for (size_t i = c.size() - 1, t = h + 1; i-- > 0; )
+  {
+    while (h >= t && tourner(s[h-2], s[h-1], c[i]) <= 0) h--;
+    s[h++] = c[i];
+  }
+  if (c.size() > 1) h--;   // le premier point est répété à la fin
+  s.resize(h);
+
+  int64_t aire2 = 0;
+  for (size_t i = 0; i < h; i++)
+  {
+    const SommetEnveloppe & u = s[i], & v = s[(i + 1) % h];
+    aire2 += int64_t(u.x) * v.y - int64_t(v.x) * u.y;
+    if (h > 1) e.perimetre += hypot(v.x - u.x, v.y - u.y);
+  }
+  e.aire = fabs(aire2 / 2.0);
+
+  // Sommets remis dans l'ordre de la chaîne
+  std::sort(s.begin(), s.end(),
+            [] (const SommetEnveloppe & u, const SommetEnveloppe & v) { return u.rang < v.rang; });
+  e.sommets.resize(h);
+  e.rangs.resize(h);
+  for (size_t i = 0; i < h; i++)
+  {
+    e.sommets[i] = { x0 + s[i].x, y0 + s[i].y };
+    e.rangs[i] = s[i].rang;
+  }
+
+  // Poches : second parcours de la chaîne depuis le premier sommet, chaque
+  // point étant mesuré par rapport à la corde qui l'enjambe
+  if (h < 2) return;
+  size_t j = 0;
+  double prof = 0;
+  p = s[0];
+  for (uint32_t r = 1; r <= n; r++)
+  {
+    uint32_t k = (s[0].rang + r - 1) % n;
+    p.x += dir_x[code(k)];
+    p.y += dir_y[code(k)];
+    const SommetEnveloppe & u = s[j], & v = s[(j + 1) % h];
+    if ((k + 1) % n == v.rang)
+    {
+      if (prof >= SEUIL_DEFAUT) e.nb_defauts++;
+      e.profondeur_max = std::max(e.profondeur_max, prof);
+      prof = 0;
+      j = (j + 1) % h;
+      continue;
+    }
+    double l = hypot(v.x - u.x, v.y - u.y);
+    prof = std::max(prof, fabs(double(tourner(u, v, p))) / l);
+  }
+}
+
+EnveloppeConvexe calculer_enveloppe(const ContourF8 & c)
+{
+  EnveloppeConvexe e;
+  envelopper_chaine(c.xPointDepart, c.yPointDepart, c.chaineFreeman.size(),
+                    [&c] (uint32_t k) { return c.chaineFreeman[k]; }, e);
+  return e;
+}
+//-----_ENVELOPPE CONVEXE_-----
+
+//------MESURES------
+// Mesures géométriques de chaque contour, calculées en un seul parcours de
+// sa chaîne de Freeman, sans repasser par l'image. Le contour est le
+// polygone des centres des pixels suivis ; par la formule de Green, chaque
+// pas (x,y) -> (x+dx,y+dy) apporte c = x*dy - y*dx à l'aire (shoelace), et
+// c pondéré par des polynômes en x, y aux moments d'ordre 1 et 2.
+//
+// Estimateurs du périmètre :
+//   pas       nombre de pas de la chaîne
+//   pondere   pas axiaux + sqrt(2) * pas diagonaux
+//   coins     0.980 ne + 1.406 no - 0.091 nc (Vossepoel & Smeulders), nc
+//             étant le nombre de changements de code
+//   dss       somme des cordes des segments DSS maximaux gloutons, ceux de
+//             approximer_contour_c8_dss
+//
+// Défauts de convexité, d'après l'enveloppe de envelopper_chaine : solidité
+// (aire / aire de l'enveloppe), convexité (périmètre de l'enveloppe /
+// périmètre pondéré, le périmètre exact du polygone), profondeur de la
+// poche la plus profonde et nombre de poches d'au moins SEUIL_DEFAUT.
+//
+// Les mesures sont rangées par colonnes (une table SoA) : un filtre sur une
+// mesure ne lit que sa colonne, ce qui reste rapide pour des millions de
+// contours.
+
+struct TableMesuresContours
+{
+  std::vector<int32_t>  x, y;                   // point de départ
+  std::vector<uint32_t> nb_pas;
+  std::vector<double>   aire;                   // aire du polygone, >= 0
+  std::vector<double>   perim_pas, perim_pondere, perim_coins, perim_dss;
+  std::vector<double>   cx, cy;                 // centroïde
+  std::vector<double>   mu20, mu02, mu11;       // moments centrés d'ordre 2
+  std::vector<double>   aire_env, perim_env;    // enveloppe convexe
+  std::vector<double>   solidite, convexite;    // aire / aire_env, perim_env / pondere
+  std::vector<double>   prof_defaut;            // poche la plus profonde
+  std::vector<uint32_t> nb_defauts;
+  std::vector<uint8_t>  trou;
+  std::vector<int32_t>  parent;                 // -1 : cadre, -2 : arbre inconnu
+
+  size_t size() const { return aire.size(); }
+
+  void reserver(size_t n)
+  {
+    x.reserve(n); y.reserve(n); nb_pas.reserve(n); aire.reserve(n);
+    perim_pas.reserve(n); perim_pondere.reserve(n);
+    perim_coins.reserve(n); perim_dss.reserve(n);
+    cx.reserve(n); cy.reserve(n);
+    mu20.reserve(n); mu02.reserve(n); mu11.reserve(n);
+    aire_env.reserve(n); perim_env.reserve(n);
+    solidite.reserve(n); convexite.reserve(n);
+    prof_defaut.reserve(n); nb_defauts.reserve(n);
+    trou.reserve(n); parent.reserve(n);
+  }
+
+  // Indices des contours dont la mesure colonne est dans [min, max]
+  std::vector<uint32_t> selectionner(std::vector<double> TableMesuresContours::* colonne,
+                                     double min, double max) const
+  {
+    const std::vector<double> & v = this->*colonne;
+    std::vector<uint32_t> res;
+    for (uint32_t i = 0; i < v.size(); i++)
+      if (v[i] >= min && v[i] <= max) res.push_back(i);
+    return res;
+  }
+};
+
+// Mesure la chaîne de n codes partant de (x0,y0) et l'ajoute à la table ;
+// code(k) donne le k-ième code, pour lire aussi bien un ContourF8 qu'un
+// contour du fichier projeté en mémoire.
+template <typename Codes>
+void mesurer_chaine(int x0, int y0, uint32_t n, Codes code, TableMesuresContours & t)
+{
+  // Coordonnées relatives au départ : l'aire double reste entière et les
+  // moments gardent leur précision loin de l'origine
+  int x = 0, y = 0, sx = 0, sy = 0;
+  int64_t aire2 = 0;
+  double mx = 0, my = 0, mxx = 0, myy = 0, mxy = 0, dss = 0;
+  uint32_t nb_impairs = 0, nb_coins = 0;
+  int prec = n > 0 ? code(n-1) : -1;
+
+  SegmentDSS seg;
+  initialiser_dss(&seg);
+  for (uint32_t k = 0; k < n; k++)
+  {
+    int d = code(k);
+    nb_impairs += d & 1;
+    nb_coins += d != prec;
+    prec = d;
+    if (!etendre_dss(&seg, d))
+    {
+      dss += hypot(x - sx, y - sy);
+      sx = x; sy = y;
+      initialiser_dss(&seg);
+      etendre_dss(&seg, d);
+    }
+
+    int x1 = x + dir_x[d], y1 = y + dir_y[d];
+    int64_t c = int64_t(x) * y1 - int64_t(x1) * y;
+    aire2 += c;
+    mx  += double(c) * (x + x1);
+    my  += double(c) * (y + y1);
+    mxx += double(c) * (x*x + x*x1 + x1*x1);
+    myy += double(c) * (y*y + y*y1 + y1*y1);
+    mxy += double(c) * (2*x*y + x*y1 + x1*y + 2*x1*y1);
+    x = x1; y = y1;
+  }
+  dss += hypot(x - sx, y - sy);
+
+  // Le sens de parcours donne le signe de a ; les rapports n'en dépendent pas
+  double a = aire2 / 2.0, gx = 0, gy = 0, m20 = 0, m02 = 0, m11 = 0;
+  if (aire2 != 0)
+  {
+    gx = mx / (6 * a);
+    gy = my / (6 * a);
+    m20 = (mxx / (12 * a) - gx * gx) * fabs(a);
+    m02 = (myy / (12 * a) - gy * gy) * fabs(a);
+    m11 = (mxy / (24 * a) - gx * gy) * fabs(a);
+  }
+
+  t.x.push_back(x0);
+  t.y.push_back(y0);
+  t.nb_pas.push_back(n);
+  t.aire.push_back(fabs(a));
+  t.perim_pas.push_back(n);
+  t.perim_pondere.push_back((n - nb_impairs) + M_SQRT2 * nb_impairs);
+  t.perim_coins.push_back(0.980 * (n - nb_impairs) + 1.406 * nb_impairs
+                          - 0.091 * nb_coins);
+  t.perim_dss.push_back(dss);
+  t.cx.push_back(x0 + gx);
+  t.cy.push_back(y0 + gy);
+  t.mu20.push_back(m20);
+  t.mu02.push_back(m02);
+  t.mu11.push_back(m11);
+
+  EnveloppeConvexe e;
+  envelopper_chaine(x0, y0, n, code, e);
+  double pondere = t.perim_pondere.back();
+  t.aire_env.push_back(e.aire);
+  t.perim_env.push_back(e.perimetre);
+  t.solidite.push_back(e.aire > 0 ? fabs(a) / e.aire : 1.);
+  t.convexite.push_back(pondere > 0 ? e.perimetre / pondere : 1.);
+  t.prof_defaut.push_back(e.profondeur_max);
+  t.nb_defauts.push_back(e.nb_defauts);
+}
+
+// Le parent vient de hier s'il est donné et complet, sinon il vaut -2
+TableMesuresContours mesurer_contours(const std::vector<ContourF8> & contours,
+                                      const HierarchieContours * hier = NULL)
+{
+  if (hier && hier->parent.size() != contours.size()) hier = NULL;
+  TableMesuresContours t;
+  t.reserver(contours.size());
+  for (size_t i = 0; i < contours.size(); i++)
+  {
+    const ContourF8 & c = contours[i];
+    mesurer_chaine(c.xPointDepart, c.yPointDepart, c.chaineFreeman.size(),
+                   [&c] (uint32_t k) { return c.chaineFreeman[k]; }, t);
+    t.trou.push_back(c.trou);
+    t.parent.push_back(hier ? hier->parent[i] : -2);
+  }
+  return t;
+}
+
+// Directement sur le fichier projeté, sans décompresser les chaînes ; le
+// fichier ne garde pas l'arbre des contours
+TableMesuresContours mesurer_contours(const FichierContours & fc)
+{
+  TableMesuresContours t;
+  t.reserver(fc.nombre());
+  for (uint32_t i = 0; i < fc.nombre(); i++)
+  {
+    VueContourF8 v = fc.contour(i);
+    mesurer_chaine(v.e->x, v.e->y, v.e->nb_codes,
+                   [&v] (uint32_t k) { return v.code(k); }, t);
+    t.trou.push_back(v.e->drapeaux & DRAPEAU_TROU);
+    t.parent.push_back(-2);
+  }
+  return t;
+}
+
+// Comme obtenir_contours_c8 : les mesures viennent du fichier de cache -ctr
+// s'il correspond à l'image, sinon d'un suivi (qui modifie img_niv). Le
+// fichier n'est ouvert et l'image hachée qu'une fois dans les deux cas.
+TableMesuresContours mesurer_contours_c8(cv::Mat img_niv)
+{
+  HierarchieContours hier;
+  std::vector<ContourF8> contours;
+  if (glob_fichier_contours == NULL)
+    contours = effectuer_suivi_contours_c8(img_niv, &hier);
+  else
+  {
+    FichierContours fc;
+    fc.ouvrir(glob_fichier_contours);
+    uint64_t empreinte = calculer_empreinte_binaire(img_niv);
+    if (cache_contours_valable(fc, img_niv, empreinte))
+      return mesurer_contours(fc);
+    contours = obtenir_contours_c8(img_niv, &hier, fc, empreinte);
+  }
+  return mesurer_contours(contours, &hier);
+}
+
+bool ecrire_mesures_csv(const std::string & nom, const TableMesuresContours & t)
+{
+  std::ofstream f(nom);
+  if (!f) return false;
+  f << "x,y,nb_pas,aire,perim_pas,perim_pondere,perim_coins,perim_dss,"
+       "cx,cy,mu20,mu02,mu11,aire_env,perim_env,solidite,convexite,"
+       "prof_defaut,nb_defauts,trou,parent\n";
+  for (size_t i = 0; i < t.size(); i++)
+    f << t.x[i] << "," << t.y[i] << "," << t.nb_pas[i] << "," << t.aire[i] << ","
+      << t.perim_pas[i] << "," << t.perim_pondere[i] << ","
+      << t.perim_coins[i] << "," << t.perim_dss[i] << ","
+      << t.cx[i] << "," << t.cy[i] << ","
+      << t.mu20[i] << "," << t.mu02[i] << "," << t.mu11[i] << ","
+      << t.aire_env[i] << "," << t.perim_env[i] << ","
+      << t.solidite[i] << "," << t.convexite[i] << ","
+      << t.prof_defaut[i] << "," << t.nb_defauts[i] << ","
+      << int(t.trou[i]) << "," << t.parent[i] << "\n";
+  return (bool) f;
+}
+
+// Résumé sur cout : totaux et premières lignes de la table
+void afficher_mesures(const TableMesuresContours & t, size_t nb_lignes = 10)
+{
+  double aire = 0, perim = 0;
+  size_t nb_trous = 0;
+  for (size_t i = 0; i < t.size(); i++)
+  {
+    aire += t.trou[i] ? -t.aire[i] : t.aire[i];
+    perim += t.perim_dss[i];
+    nb_trous += t.trou[i];
+  }
+  std::cout << t.size() << " contours dont " << nb_trous << " trous, aire totale "
+            << aire << ", périmètre DSS total " << perim << "\n"
+            << "     x     y    aire   pas  pondéré  coins    dss      cx      cy"
+               " solid. poches parent\n";
+  for (size_t i = 0; i < t.size() && i < nb_lignes; i++)
+    std::cout << std::setw(6) << t.x[i] << std::setw(6) << t.y[i]
+              << std::setw(8) << t.aire[i] << std::setw(6) << t.perim_pas[i]
+              << std::setw(9) << t.perim_pondere[i]
+              << std::setw(7) << t.perim_coins[i]
+              << std::setw(7) << t.perim_dss[i]
+              << std::setw(8) << t.cx[i] << std::setw(8) << t.cy[i]
+              << std::setw(7) << t.solidite[i] << std::setw(7) << t.nb_defauts[i]
+              << std::setw(7) << t.parent[i] << (t.trou[i] ? " trou" : "") << "\n";
+  std::cout << std::flush;
+}
+//-----_MESURES_-----
+
+//------CODEC CHAINES------
+// Compression des chaînes de Freeman pour l'archivage. Le premier code est
+// gardé tel quel, les suivants deviennent des virages t = (c[k] - c[k-1])
+// mod 8, presque toujours 0, 1 ou 7 le long d'un bord. Un symbole regroupe
+// une suite de r virages nuls (r < CODEC_RUN_MAX) et le virage non nul qui
+// la termine ; un dernier symbole code CODEC_RUN_MAX virages nuls d'un coup.
+//
+// Sur un bord en escalier, un virage à gauche est le plus souvent suivi d'un
+// virage à droite et inversement : le code de Huffman de chaque symbole est
+// choisi selon un contexte, le dernier virage non nul (1, 7 ou autre). Les
+// codes sont canoniques, statiques (fréquences de toutes les chaînes
+// encodées ensemble), limités à CODEC_BITS_MAX bits et écrits bit de poids
+// faible d'abord.
+//
+// Le décodage consulte une table par contexte, indexée par les
+// CODEC_BITS_MAX bits suivants du flux : chaque entrée donne jusqu'à
+// CODEC_CODES_ENTREE codes (plusieurs symboles à la fois, en suivant les
+// changements de contexte), en virages cumulés rangés un par octet ; on les
+// ajoute au code précédent en une seule opération sur 64 bits. Seuls les
+// symboles produisant plus de codes que l'entrée n'en tient passent par une
+// boucle.
+
+const int CODEC_RUN_MAX = 16;
+const int CODEC_SYMB_RUN = 7 * CODEC_RUN_MAX;        // symbole sans virage
+const int CODEC_NB_SYMBOLES = CODEC_SYMB_RUN + 1;
+const int CODEC_NB_CONTEXTES = 3;
+const int CODEC_BITS_MAX = 12;
+const int CODEC_CODES_ENTREE = 8;
+// Marge à prévoir après les codes d'une chaîne décodée, qui peut être
+// dépassée de la fin d'un symbole ou d'une entrée
+const int CODEC_MARGE = CODEC_RUN_MAX + CODEC_CODES_ENTREE;
+
+struct EntreeDecodage
+{
+  uint64_t cumuls;        // virages cumulés depuis le code précédent, un par octet
+  uint8_t  nb_codes;      // 0 : premier symbole trop long, voir symbole
+  uint8_t  nb_bits;
+  uint8_t  symbole;       // premier symbole de la fenêtre et sa longueur
+  uint8_t  longueur;
+  uint8_t  contexte;      // contexte après la dernière consultation
+};
+
+class CodecChaines
+{
+  public:
+    uint8_t  longueur[CODEC_NB_CONTEXTES][CODEC_NB_SYMBOLES];
+    uint16_t code[CODEC_NB_CONTEXTES][CODEC_NB_SYMBOLES];   // renversés
+    EntreeDecodage table[CODEC_NB_CONTEXTES][1 << CODEC_BITS_MAX];
+
+    // Symbole -> (nombre de virages nuls, virage final ou 0)
+    static int nb_zeros(int s) { return s == CODEC_SYMB_RUN ? CODEC_RUN_MAX : s / 7; }
+    static int virage(int s)   { return s == CODEC_SYMB_RUN ? 0 : s % 7 + 1; }
+    static int nb_codes(int s) { return nb_zeros(s) + (s != CODEC_SYMB_RUN); }
+    static int contexte_apres(int ctx, int s)
+    {
+      int t = virage(s);
+      return t == 0 ? ctx : t == 1 ? 1 : t == 7 ? 2 : 0;
+    }
+
+    // Longueurs de Huffman limitées à CODEC_BITS_MAX : tant que l'arbre est
+    // trop profond, on aplatit les fréquences en les divisant par 2.
+    void construire(const std::vector<uint64_t> freq[CODEC_NB_CONTEXTES])
+    {
+      for (int ctx = 0; ctx < CODEC_NB_CONTEXTES; ctx++)
+      {
+        std::vector<uint64_t> f(freq[ctx]);
+        for (;;)
+        {
+          for (uint64_t & v : f) v = std::max<uint64_t>(v, 1);
+          if (longueurs_huffman(f, longueur[ctx]) <= CODEC_BITS_MAX) break;
+          for (uint64_t & v : f) v = (v + 1) / 2;
+        }
+      }
+      construire_tables();
+    }
+
+  private:
+    static int longueurs_huffman(const std::vector<uint64_t> & f, uint8_t * longueur)
+    {
+      typedef std::pair<uint64_t, int> Noeud;
+      std::priority_queue<Noeud, std::vector<Noeud>, std::greater<Noeud>> file;
+      std::vector<int> parent(2 * CODEC_NB_SYMBOLES, -1);
+      for (int s = 0; s < CODEC_NB_SYMBOLES; s++) file.push(Noeud(f[s], s));
+      int suivant = CODEC_NB_SYMBOLES;
+      while (file.size() > 1)
+      {
+        Noeud a = file.top(); file.pop();
+        Noeud b = file.top(); file.pop();
+        parent[a.second] = parent[b.second] = suivant;
+        file.push(Noeud(a.first + b.first, suivant++));
+      }
+      int max = 0;
+      for (int s = 0; s < CODEC_NB_SYMBOLES; s++)
+      {
+        int l = 0;
+        for (int n = s; parent[n] >= 0; n = parent[n]) l++;
+        longueur[s] = l;
+        max = std::max(max, l);
+      }
+      return max;
+    }
+
+    void construire_tables()
+    {
+      // Chaque fenêtre commence par le code d'un seul symbole : on le
+      // répète sur toutes les fenêtres qui le prolongent
+      std::vector<EntreeDecodage> premier_v(CODEC_NB_CONTEXTES << CODEC_BITS_MAX);
+      auto premier = [&premier_v] (int ctx) {
+        return premier_v.data() + (ctx << CODEC_BITS_MAX); };
+      for (int ctx = 0; ctx < CODEC_NB_CONTEXTES; ctx++)
+      {
+        // Codes canoniques : par longueur croissante puis par symbole
+        int c = 0;
+        for (int l = 1; l <= CODEC_BITS_MAX; l++, c <<= 1)
+          for (int s = 0; s < CODEC_NB_SYMBOLES; s++)
+            if (longueur[ctx][s] == l)
+            {
+              int r = 0;
+              for (int b = 0; b < l; b++) r |= ((c >> b) & 1) << (l - 1 - b);
+              code[ctx][s] = r;
+              c++;
+            }
+        for (int s = 0; s < CODEC_NB_SYMBOLES; s++)
+          for (int w = code[ctx][s]; w < (1 << CODEC_BITS_MAX);
+               w += 1 << longueur[ctx][s])
+          {
+            premier(ctx)[w].symbole = s;
+            premier(ctx)[w].longueur = longueur[ctx][s];
+          }
+      }
+
+      for (int ctx0 = 0; ctx0 < CODEC_NB_CONTEXTES; ctx0++)
+      for (int w = 0; w < (1 << CODEC_BITS_MAX); w++)
+      {
+        EntreeDecodage & e = table[ctx0][w];
+        e = premier(ctx0)[w];
+        e.cumuls = 0;
+        e.nb_codes = e.nb_bits = 0;
+        int cumul = 0, ctx = ctx0;
+        for (;;)
+        {
+          const EntreeDecodage & p = premier(ctx)[w >> e.nb_bits];
+          int s = p.symbole;
+          if (e.nb_bits + p.longueur > CODEC_BITS_MAX
+              || e.nb_codes + nb_codes(s) > CODEC_CODES_ENTREE) break;
+          for (int k = 0; k < nb_zeros(s); k++)
+            e.cumuls |= uint64_t(cumul) << (8 * e.nb_codes++);
+          if (virage(s))
+          {
+            cumul = (cumul + virage(s)) & 7;
+            e.cumuls |= uint64_t(cumul) << (8 * e.nb_codes++);
+          }
+          e.nb_bits += p.longueur;
+          ctx = contexte_apres(ctx, s);
+        }
+        e.contexte = ctx;
+      }
+    }
+};
+
+// Chaînes compressées d'un ensemble de contours, avec leurs tables de codes
+struct ArchiveChaines
+{
+  struct Chaine
+  {
+    int32_t  x, y;
+    uint32_t nb_codes;
+    uint8_t  dir_init, premier;
+  };
+  CodecChaines codec;
+  std::vector<Chaine>   chaines;
+  std::vector<uint64_t> debut;          // position en bits dans flux
+  std::vector<uint8_t>  flux;           // + 8 octets de marge pour la lecture
+
+  size_t octets() const
+    { return flux.size() + sizeof(codec.longueur)
+           + chaines.size() * (sizeof(Chaine) + sizeof(uint64_t)); }
+};
+
+// Appelle f(contexte, symbole) pour chaque symbole de la chaîne
+template <typename F>
+void symboles_chaine(const std::vector<int> & c, F f)
+{
+  int r = 0, ctx = 0;
+  for (size_t k = 1; k < c.size(); k++)
+  {
+    int t = (c[k] - c[k-1]) & 7;
+    if (t == 0)
+    {
+      if (++r == CODEC_RUN_MAX) { f(ctx, CODEC_SYMB_RUN); r = 0; }
+      continue;
+    }
+    int s = r * 7 + t - 1;
+    f(ctx, s);
+    ctx = CodecChaines::contexte_apres(ctx, s);
+    r = 0;
+  }
+  // Virages nuls restants : le décodeur s'arrête au nombre de codes
+  if (r > 0) f(ctx, CODEC_SYMB_RUN);
+}
+
+ArchiveChaines encoder_chaines(const std::vector<ContourF8> & contours)
+{
+  ArchiveChaines a;
+  std::vector<uint64_t> freq[CODEC_NB_CONTEXTES];
+  for (int ctx = 0; ctx < CODEC_NB_CONTEXTES; ctx++)
+    freq[ctx].assign(CODEC_NB_SYMBOLES, 0);
+  for (const ContourF8 & c : contours)
+    symboles_chaine(c.chaineFreeman, [&freq] (int ctx, int s) { freq[ctx][s]++; });
+  a.codec.construire(freq);
+
+  uint64_t acc = 0, nb_bits = 0;
+  int n_acc = 0;
+  a.chaines.reserve(contours.size());
+  a.debut.reserve(contours.size());
+  for (const ContourF8 & c : contours)
+  {
+    ArchiveChaines::Chaine ch;
+    ch.x = c.xPointDepart;
+    ch.y = c.yPointDepart;
+    ch.nb_codes = c.chaineFreeman.size();
+    ch.dir_init = c.dir_init;
+    ch.premier = ch.nb_codes ? c.chaineFreeman[0] : 0;
+    a.chaines.push_back(ch);
+    a.debut.push_back(nb_bits);
+    symboles_chaine(c.chaineFreeman, [&] (int ctx, int s) {
+      acc |= uint64_t(a.codec.code[ctx][s]) << n_acc;
+      n_acc += a.codec.longueur[ctx][s];
+      nb_bits += a.codec.longueur[ctx][s];
+      while (n_acc >= 8) { a.flux.push_back(acc & 255); acc >>= 8; n_acc -= 8; }
+    });
+  }
+  if (n_acc > 0) a.flux.push_back(acc & 255);
+  a.flux.resize(a.flux.size() + 8, 0);
+  return a;
+}
+
+// Décode la chaîne i dans sortie, qui doit tenir nb_codes + CODEC_MARGE
+// octets. Le flux est lu par mots de 64 bits dans l'ordre natif, supposé
+// petit-boutiste comme pour le fichier de contours.
+void decoder_chaine(const ArchiveChaines & a, uint32_t i, uint8_t * sortie)
+{
+  const ArchiveChaines::Chaine & ch = a.chaines[i];
+  if (ch.nb_codes == 0) return;
+  const uint8_t * flux = a.flux.data();
+  uint8_t * fin = sortie + ch.nb_codes;
+  uint64_t pos = a.debut[i];
+  int prec = ch.premier, ctx = 0;
+  *sortie++ = prec;
+  while (sortie < fin)
+  {
+    uint64_t mot;
+    memcpy(&mot, flux + (pos >> 3), 8);
+    const EntreeDecodage & e =
+      a.codec.table[ctx][(mot >> (pos & 7)) & ((1 << CODEC_BITS_MAX) - 1)];
+    if (e.nb_codes)
+    {
+      uint64_t v = (e.cumuls + prec * 0x0101010101010101ULL)
+                   & 0x0707070707070707ULL;
+      memcpy(sortie, &v, 8);
+      sortie += e.nb_codes;
+      prec = sortie[-1];
+      pos += e.nb_bits;
+      ctx = e.contexte;
+    }
+    else
+    {
+      int s = e.symbole;
+      memset(sortie, prec, CodecChaines::nb_zeros(s));
+      sortie += CodecChaines::nb_zeros(s);
+      if (CodecChaines::virage(s))
+        *sortie++ = prec = (prec + CodecChaines::virage(s)) & 7;
+      pos += e.longueur;
+      ctx = CodecChaines::contexte_apres(ctx, s);
+    }
+  }
+}
+
+std::vector<ContourF8> decoder_chaines(const ArchiveChaines & a)
+{
+  std::vector<ContourF8> contours(a.chaines.size());
+  std::vector<uint8_t> tampon;
+  for (uint32_t i = 0; i < a.chaines.size(); i++)
+  {
+    const ArchiveChaines::Chaine & ch = a.chaines[i];
+    tampon.resize(ch.nb_codes + CODEC_MARGE);
+    decoder_chaine(a, i, tampon.data());
+    ContourF8 & c = contours[i];
+    c.xPointDepart = ch.x;
+    c.yPointDepart = ch.y;
+    c.dir_init = ch.dir_init;
+    c.trou = c.dir_init == 0;   // seuls les trous partent avec le fond à droite
+    c.chaineFreeman.assign(tampon.begin(), tampon.begin() + ch.nb_codes);
+    c.taillchaineFreeman = ch.nb_codes;
+  }
+  return contours;
+}
+
+// Taille des codes dans le fichier de contours, 3 bits par code
+size_t octets_chaines_3bits(const std::vector<ContourF8> & contours)
+{
+  size_t n = 0;
+  for (const ContourF8 & c : contours) n += (3 * c.chaineFreeman.size() + 7) / 8;
+  return n;
+}
+//-----_CODEC CHAINES_-----
+
+//------INDEX SPATIAL------
+// Index des contours suivis sur une grille uniforme de cases de INDEX_CASE
+// pixels : chaque case liste les sommets (pixels du contour) qui y tombent.
+// Un clic retrouve ainsi le contour sous le curseur sans reparcourir l'image
+// ni les chaînes :
+//  - sur un bord, le contour est lu dans la case du clic ;
+//  - sinon, on lance un rayon horizontal vers le bord le plus proche de
+//    l'image et on cumule le nombre d'enroulement de chaque contour croisé,
+//    en ne lisant que les cases de la ligne de cases du clic ; le contour
+//    le plus intérieur (d'aire minimale) qui entoure le point est retenu ;
+//  - le plus proche contour est cherché par anneaux de cases croissants.
+// Les contours peuvent être retirés ou remplacés un à un : seules les cases
+// qu'ils touchent sont mises à jour, et les numéros restent stables.
+
+const int INDEX_CASE = 16;
+
+class IndexContours
+{
+  public:
+    void initialiser(int rows, int cols)
+    {
+      this->rows = rows;
+      this->cols = cols;
+      nx = (cols + INDEX_CASE - 1) / INDEX_CASE;
+      ny = (rows + INDEX_CASE - 1) / INDEX_CASE;
+      cases.assign(size_t(nx) * ny, std::vector<Entree>());
+      contours.clear();
+    }
+
+    void construire(const std::vector<ContourF8> & v, int rows, int cols)
+    {
+      initialiser(rows, cols);
+      contours.reserve(v.size());
+      for (const ContourF8 & c : v) inserer(c);
+    }
+
+    // Renvoie le numéro du contour ajouté
+    int inserer(const ContourF8 & c)
+    {
+      contours.push_back(ContourIndexe());
+      remplir(contours.size() - 1, c);
+      return contours.size() - 1;
+    }
+
+    void retirer(int id)
+    {
+      ContourIndexe & ci = contours[id];
+      if (!ci.actif) return;
+      std::vector<int> touchees;
+      for (const point_img & p : ci.pts) touchees.push_back(numero_case(p.x, p.y));
+      std::sort(touchees.begin(), touchees.end());
+      touchees.erase(std::unique(touchees.begin(), touchees.end()), touchees.end());
+      for (int k : touchees)
+        cases[k].erase(std::remove_if(cases[k].begin(), cases[k].end(),
+                         [id] (const Entree & e) { return e.id == id; }),
+                       cases[k].end());
+      ci = ContourIndexe();
+    }
+
+    void remplacer(int id, const ContourF8 & c)
+    {
+      retirer(id);
+      remplir(id, c);
+    }
+
+    int nombre() const { return contours.size(); }
+    bool est_actif(int id) const { return contours[id].actif; }
+    bool est_trou(int id) const { return contours[id].trou; }
+    double aire(int id) const { return contours[id].aire; }
+
+    // Contour le plus intérieur passant par (x,y) ou l'entourant, -1 si aucun
+    int contour_sous(int x, int y) const
+    {
+      if (x < 0 || y < 0 || x >= cols || y >= rows) return -1;
+      int meilleur = -1;
+      for (const Entree & e : cases[numero_case(x, y)])
+      {
+        const point_img & p = contours[e.id].pts[e.k];
+        if (p.x == x && p.y == y) meilleur = plus_interieur(meilleur, e.id);
+      }
+      if (meilleur >= 0) return meilleur;
+
+      // Rayon y = py + epsilon : une arête le croise si elle relie les
+      // lignes py et py+1, au sommet de la ligne py
+      int cx = x / INDEX_CASE, cy = y / INDEX_CASE;
+      bool droite = nx - cx <= cx + 1;
+      std::vector<std::pair<int,int>> enroulements;
+      for (int c = cx; c >= 0 && c < nx; c += droite ? 1 : -1)
+        for (const Entree & e : cases[cy * nx + c])
+        {
+          const std::vector<point_img> & pts = contours[e.id].pts;
+          const point_img & p = pts[e.k];
+          if (p.y != y || (droite ? p.x <= x : p.x >= x)) continue;
+          int n = pts.size(), w = 0;
+          if (pts[(e.k + n - 1) % n].y == y + 1) w--;
+          if (pts[(e.k + 1) % n].y == y + 1) w++;
+          if (w) enroulements.push_back(std::make_pair(e.id, w));
+        }
+      std::sort(enroulements.begin(), enroulements.end());
+      for (size_t i = 0; i < enroulements.size(); )
+      {
+        int id = enroulements[i].first, w = 0;
+        for (; i < enroulements.size() && enroulements[i].first == id; i++)
+          w += enroulements[i].second;
+        if (w) meilleur = plus_interieur(meilleur, id);
+      }
+      return meilleur;
+    }
+
+    // Contour ayant le pixel le plus proche de (x,y), -1 si l'index est vide
+    int plus_proche(int x, int y, double * dist = NULL) const
+    {
+      int cx = std::min(std::max(x / INDEX_CASE, 0), nx - 1);
+      int cy = std::min(std::max(y / INDEX_CASE, 0), ny - 1);
+      long d_min = LONG_MAX;
+      int meilleur = -1;
+      for (int r = 0; r < std::max(nx, ny); r++)
+      {
+        for (int j = cy - r; j <= cy + r; j++)
+        for (int i = cx - r; i <= cx + r; i++)
+        {
+          if (i < 0 || j < 0 || i >= nx || j >= ny) continue;
+          if (std::max(abs(i - cx), abs(j - cy)) != r) continue;
+          for (const Entree & e : cases[j * nx + i])
+          {
+            const point_img & p = contours[e.id].pts[e.k];
+            long d = long(p.x - x) * (p.x - x) + long(p.y - y) * (p.y - y);
+            if (d < d_min) { d_min = d; meilleur = e.id; }
+          }
+        }
+        // Les anneaux suivants sont à plus de r cases du point
+        long borne = long(r) * INDEX_CASE;
+        if (meilleur >= 0 && d_min <= borne * borne) break;
+      }
+      if (dist) *dist = meilleur >= 0 ? sqrt(double(d_min)) : -1;
+      return meilleur;
+    }
+
+    // Contours ayant au moins un pixel dans [x0,x1] x [y0,y1]
+    std::vector<int> dans_fenetre(int x0, int y0, int x1, int y1) const
+    {
+      std::vector<int> res;
+      x0 = std::max(x0, 0); y0 = std::max(y0, 0);
+      x1 = std::min(x1, cols - 1); y1 = std::min(y1, rows - 1);
+      for (int j = y0 / INDEX_CASE; j <= y1 / INDEX_CASE && y0 <= y1; j++)
+      for (int i = x0 / INDEX_CASE; i <= x1 / INDEX_CASE && x0 <= x1; i++)
+        for (const Entree & e : cases[j * nx + i])
+        {
+          const point_img & p = contours[e.id].pts[e.k];
+          if (p.x >= x0 && p.x <= x1 && p.y >= y0 && p.y <= y1)
+            res.push_back(e.id);
+        }
+      std::sort(res.begin(), res.end());
+      res.erase(std::unique(res.begin(), res.end()), res.end());
+      return res;
+    }
+
+    // contour_sous pour une liste de points, traités case par case pour
+    // rester dans les mêmes données ; résultats dans l'ordre des points
+    std::vector<int> contours_sous(const std::vector<cv::Point> & points) const
+    {
+      std::vector<std::pair<int,int>> ordre(points.size());
+      for (size_t i = 0; i < points.size(); i++)
+      {
+        int x = std::min(std::max(points[i].x, 0), cols - 1);
+        int y = std::min(std::max(points[i].y, 0), rows - 1);
+        ordre[i] = std::make_pair(numero_case(x, y), int(i));
+      }
+      std::sort(ordre.begin(), ordre.end());
+      std::vector<int> res(points.size());
+      for (const auto & o : ordre)
+        res[o.second] = contour_sous(points[o.second].x, points[o.second].y);
+      return res;
+    }
+
+  private:
+    struct Entree { int32_t id, k; };
+    struct ContourIndexe
+    {
+      std::vector<point_img> pts;   // sommets, le dernier rejoint le premier
+      double aire = 0;
+      bool trou = false, actif = false;
+    };
+    int rows = 0, cols = 0, nx = 0, ny = 0;
+    std::vector<std::vector<Entree>> cases;
+    std::vector<ContourIndexe> contours;
+
+    int numero_case(int x, int y) const
+      { return (y / INDEX_CASE) * nx + x / INDEX_CASE; }
+
+    int plus_interieur(int a, int b) const
+      { return a < 0 || contours[b].aire < contours[a].aire ? b : a; }
+
+    void remplir(int id, const ContourF8 & c)
+    {
+      ContourIndexe & ci = contours[id];
+      point_img p;
+      p.x = c.xPointDepart;
+      p.y = c.yPointDepart;
+      ci.pts.reserve(c.chaineFreeman.size() + 1);
+      ci.pts.push_back(p);
+      int64_t aire2 = 0;
+      for (size_t k = 0; k < c.chaineFreeman.size(); k++)
+      {
+        point_img q = p;
+        q.x += dir_x[c.chaineFreeman[k]];
+        q.y += dir_y[c.chaineFreeman[k]];
+        aire2 += int64_t(p.x) * q.y - int64_t(q.x) * p.y;
+        if (k + 1 < c.chaineFreeman.size()) ci.pts.push_back(q);
+        p = q;
+      }
+      ci.aire = fabs(aire2 / 2.0);
+      ci.trou = contour_est_trou(c);
+      ci.actif = true;
+      for (size_t k = 0; k < ci.pts.size(); k++)
+        cases[numero_case(ci.pts[k].x, ci.pts[k].y)].push_back({ id, int32_t(k) });
+    }
+};
+//-----_INDEX SPATIAL_-----
+
+//------ARBRE DES COMPOSANTES------
+// Arbre des composantes (max-tree) d'une image de gris 8 bits : chaque nœud
+// est une composante connexe de {f >= niveau}, son parent la composante de
+// niveau inférieur qui la contient. Construction de Berger et al. : tri des
+// pixels par niveau (tri par dénombrement, en O(N)), puis union-find par rang,
+// avec compression de chemins, des pixels les plus clairs aux plus sombres, et
+// canonisation pour qu'un nœud ne soit représenté que par un pixel. Le
+// min-tree est le max-tree de l'image inversée 255 - f.
+//
+// Les attributs (aire, boîte englobante, plus haut niveau du sous-arbre
+// pour le contraste) sont cumulés des fils vers les parents en O(nœuds).
+// L'arbre construit, tout seuil s se lit sans repasser sur les pixels : les
+// composantes de l'image binaire {f > s} sont les nœuds de niveau > s dont
+// le parent est de niveau <= s.
+
+struct ArbreComposantes
+{
+  int rows = 0, cols = 0;
+  bool min_tree = false;              // composantes de {f <= s} plutôt que {f > s}
+  // Par nœud, parent avant fils : le nœud 0 est la racine
+  std::vector<int32_t>  parent;       // -1 pour la racine
+  std::vector<uint8_t>  niveau;       // f, ou 255 - f pour le min-tree
+  std::vector<uint8_t>  niveau_max;   // plus haut niveau du sous-arbre
+  std::vector<uint32_t> aire;
+  std::vector<int32_t>  xmin, ymin, xmax, ymax;
+  // Par pixel, le nœud de son niveau
+  std::vector<int32_t>  noeud;
+
+  size_t nombre() const { return parent.size(); }
+
+  // Les composantes au seuil s de cv::threshold sont les nœuds de niveau
+  // au moins niveau_seuil(s) dont le parent est en dessous
+  int niveau_seuil(int s) const { return min_tree ? 255 - s : s + 1; }
+
+  // Hauteur du sous-arbre au-dessus du parent : contraste de la composante
+  int contraste(int32_t n) const
+    { return niveau_max[n] - (parent[n] < 0 ? niveau[n] : niveau[parent[n]]); }
+};
+
+struct CriteresComposantes
+{
+  uint32_t aire_min = 0;
+  int largeur_min = 0, hauteur_min = 0;   // de la boîte englobante
+  int contraste_min = 0;
+};
+
+inline int32_t racine_union_find(std::vector<int32_t> & zpar, int32_t p)
+{
+  while (zpar[p] != p)
+  {
+    zpar[p] = zpar[zpar[p]];
+    p = zpar[p];
+  }
+  return p;
+}
+
+// connexite 8 pour les objets du suivi C8, 4 pour le fond (min-tree)
+void construire_arbre_composantes(const cv::Mat & img_gry, int connexite,
+                                  bool min_tree, ArbreComposantes & a)
+{
+  CHECK_MAT_TYPE(img_gry, CV_8UC1)
+
+  a = ArbreComposantes();
+  a.rows = img_gry.rows;
+  a.cols = img_gry.cols;
+  a.min_tree = min_tree;
+  int cols = a.cols;
+  int32_t N = a.rows * a.cols;
+  if (N == 0) return;
+
+  // Tri par dénombrement, du plus haut niveau au plus bas
+  std::vector<uint8_t> f(N);
+  std::vector<int32_t> debut(257, 0);
+  for (int y = 0; y < a.rows; y++)
+  {
+    const uint8_t *ligne = img_gry.ptr<uint8_t>(y);
+    for (int x = 0; x < cols; x++)
+    {
+      uint8_t v = min_tree ? 255 - ligne[x] : ligne[x];
+      f[y * cols + x] = v;
+      debut[v]++;
+    }
+  }
+  for (int v = 255, s = 0; v >= 0; v--)
+  {
+    int h = debut[v];
+    debut[v] = s;
+    s += h;
+  }
+  std::vector<int32_t> S(N);
+  for (int32_t i = 0; i < N; i++) S[debut[f[i]]++] = i;
+
+  // Union-find : chaque pixel devient parent, dans l'arbre, des composantes
+  // de ses voisins déjà traités. L'union-find (zpar) est équilibré par rang,
+  // repr donne le pixel de l'arbre qui représente chaque classe.
+  std::vector<int32_t> par(N), zpar(N, -1), repr(N);
+  std::vector<uint8_t> rang(N, 0);
+  int pas = connexite == 4 ? 2 : 1;
+  for (int32_t k = 0; k < N; k++)
+  {
+    int32_t p = S[k], zp = p;
+    par[p] = zpar[p] = repr[p] = p;
+    int x = p % cols, y = p / cols;
+    for (int d = 0; d < 8; d += pas)
+    {
+      int xn = x + dir_x[d], yn = y + dir_y[d];
+      if (xn < 0 || yn < 0 || xn >= cols || yn >= a.rows) continue;
+      int32_t n = yn * cols + xn;
+      // voisin traité : plus haut, ou au même niveau et avant dans S
+      if (f[n] < f[p] || (f[n] == f[p] && n > p)) continue;
+      int32_t zn = racine_union_find(zpar, n);
+      if (zn == zp) continue;
+      par[repr[zn]] = p;
+      if (rang[zp] < rang[zn]) std::swap(zp, zn);
+      zpar[zn] = zp;
+      repr[zp] = p;
+      if (rang[zp] == rang[zn]) rang[zp]++;
+    }
+  }
+
+  // Canonisation puis numérotation des nœuds, des bas niveaux vers les
+  // hauts : le parent d'un pixel est toujours vu avant lui. zpar ne sert
+  // plus, il reçoit le nœud de chaque pixel.
+  std::vector<int32_t> & noeud = zpar;
+  for (int32_t k = N - 1; k >= 0; k--)
+  {
+    int32_t p = S[k], q = par[p];
+    if (f[par[q]] == f[q]) par[p] = q = par[q];
+    if (q == p || f[q] != f[p])
+    {
+      noeud[p] = a.parent.size();
+      a.parent.push_back(q == p ? -1 : noeud[q]);
+      a.niveau.push_back(f[p]);
+    }
+    else noeud[p] = noeud[q];
+  }
+
+  size_t nb = a.nombre();
+  a.niveau_max = a.niveau;
+  a.aire.assign(nb, 0);
+  a.xmin.assign(nb, INT_MAX); a.ymin.assign(nb, INT_MAX);
+  a.xmax.assign(nb, -1);      a.ymax.assign(nb, -1);
+  for (int32_t i = 0; i < N; i++)
+  {
+    int32_t n = noeud[i];
+    int x = i % cols, y = i / cols;
+    a.aire[n]++;
+    a.xmin[n] = std::min(a.xmin[n], x); a.xmax[n] = std::max(a.xmax[n], x);
+    a.ymin[n] = std::min(a.ymin[n], y); a.ymax[n] = std::max(a.ymax[n], y);
+  }
+  for (size_t n = nb - 1; n > 0; n--)
+  {
+    int32_t p = a.parent[n];
+    a.aire[p] += a.aire[n];
+    a.xmin[p] = std::min(a.xmin[p], a.xmin[n]); a.xmax[p] = std::max(a.xmax[p], a.xmax[n]);
+    a.ymin[p] = std::min(a.ymin[p], a.ymin[n]); a.ymax[p] = std::max(a.ymax[p], a.ymax[n]);
+    a.niveau_max[p] = std::max(a.niveau_max[p], a.niveau_max[n]);
+  }
+  a.noeud = std::move(zpar);
+}
+
+// Composantes au seuil s, en O(nœuds)
+std::vector<int32_t> composantes_au_seuil(const ArbreComposantes & a, int s)
+{
+  int t = a.niveau_seuil(s);
+  std::vector<int32_t> res;
+  for (size_t n = 0; n < a.nombre(); n++)
+    if (a.niveau[n] >= t && (a.parent[n] < 0 || a.niveau[a.parent[n]] < t))
+      res.push_back(n);
+  return res;
+}
+
+// Étiquettes 1..k des composantes au seuil s, 0 ailleurs (CV_32SC1) : les
+// étiquettes sont propagées de nœud en nœud, puis recopiées une fois par
+// pixel
+cv::Mat etiqueter_au_seuil(const ArbreComposantes & a, int s)
+{
+  int t = a.niveau_seuil(s);
+  std::vector<int32_t> lab(a.nombre(), 0);
+  int32_t k = 0;
+  for (size_t n = 0; n < a.nombre(); n++)
+    if (a.niveau[n] >= t)
+      lab[n] = a.parent[n] < 0 || a.niveau[a.parent[n]] < t ? ++k : lab[a.parent[n]];
+
+  cv::Mat res(a.rows, a.cols, CV_32SC1);
+  for (int y = 0; y < a.rows; y++)
+  {
+    int *ligne = res.ptr<int>(y);
+    const int32_t *nd = a.noeud.data() + (size_t) y * a.cols;
+    for (int x = 0; x < a.cols; x++) ligne[x] = lab[nd[x]];
+  }
+  return res;
+}
+
+// Filtre connexe : un nœud qui ne satisfait pas les critères est fondu dans
+// son plus proche ancêtre gardé, dont il prend le niveau (règle directe).
+// Image de gris CV_8UC1, dans les niveaux d'origine.
+cv::Mat filtrer_arbre(const ArbreComposantes & a, const CriteresComposantes & c)
+{
+  std::vector<uint8_t> v(a.nombre());
+  for (size_t n = 0; n < a.nombre(); n++)
+  {
+    bool garde = a.parent[n] < 0
+      || (a.aire[n] >= c.aire_min
+          && a.xmax[n] - a.xmin[n] + 1 >= c.largeur_min
+          && a.ymax[n] - a.ymin[n] + 1 >= c.hauteur_min
+          && a.contraste(n) >= c.contraste_min);
+    uint8_t g = a.min_tree ? 255 - a.niveau[n] : a.niveau[n];
+    v[n] = garde ? g : v[a.parent[n]];
+  }
+
+  cv::Mat res(a.rows, a.cols, CV_8UC1);
+  for (int y = 0; y < a.rows; y++)
+  {
+    uint8_t *ligne = res.ptr<uint8_t>(y);
+    const int32_t *nd = a.noeud.data() + (size_t) y * a.cols;
+    for (int x = 0; x < a.cols; x++) ligne[x] = v[nd[x]];
+  }
+  return res;
+}
+
+// Résumé sur cout : nombre de composantes au seuil s et les plus grandes
+void afficher_composantes_au_seuil(const ArbreComposantes & a, int s,
+                                   size_t nb_lignes = 5)
+{
+  std::vector<int32_t> c = composantes_au_seuil(a, s);
+  size_t m = std::min(nb_lignes, c.size());
+  std::partial_sort(c.begin(), c.begin() + m, c.end(),
+                    [&a] (int32_t u, int32_t v) { return a.aire[u] > a.aire[v]; });
+  std::cout << c.size() << (a.min_tree ? " composantes de fond" : " composantes d'objet")
+            << " au seuil " << s << " (arbre de " << a.nombre() << " nœuds)\n";
+  for (size_t i = 0; i < m; i++)
+    std::cout << "  aire " << std::setw(8) << a.aire[c[i]]
+              << "  boîte " << a.xmin[c[i]] << "," << a.ymin[c[i]]
+              << " - " << a.xmax[c[i]] << "," << a.ymax[c[i]]
+              << "  contraste " << a.contraste(c[i]) << "\n";
+  std::cout << std::flush;
+}
+//-----_ARBRE DES COMPOSANTES_-----
+
+//------COURBES D'EULER------
+// Nombre d'Euler, composantes et trous de l'image binaire à chacun des 256
+// seuils, sans seuiller 256 fois. Le nombre d'Euler vient des bit-quads de
+// Gray, en un seul passage sur l'image de gris bordée de fond : le motif
+// d'une fenêtre 2x2 ne change qu'aux niveaux de ses quatre pixels. Triés
+// par niveau décroissant w1 >= w2 >= w3 >= w4 (pixel allumé si f > s), un
+// seul pixel est allumé (Q1) pour s dans [w2, w1-1], deux pour s dans
+// [w3, w2-1] (QD s'ils sont en diagonale), trois (Q3) pour s dans
+// [w4, w3-1]. Chaque intervalle est ajouté à un tableau de différences par
+// niveau, cumulé à la fin. Objets 8-connexes, fond 4-connexe :
+// E = (Q1 - Q3 - 2 QD) / 4.
+//
+// Les composantes viennent de l'arbre max 8-connexe : un nœud de niveau L
+// dont le parent est au niveau P compte pour les seuils de [P, L-1], la
+// racine pour ceux de [0, L-1]. Les trous, composantes du fond qui ne
+// touchent pas le bord, s'en déduisent : T = C - E.
+
+struct CourbesEuler
+{
+  int64_t euler[256], composantes[256], trous[256];
+};
+
+// Ajoute la fenêtre [a b ; c d] au tableau de différences de 4 E
+inline void ajouter_bit_quad(int a, int b, int c, int d, int64_t * diff)
+{
+  if (a == b && a == c && a == d) return;
+  // niveau et position (0 a, 1 b, 2 c, 3 d), tri décroissant par réseau
+  int w[4] = { a << 2, b << 2 | 1, c << 2 | 2, d << 2 | 3 };
+  auto trier = [&w] (int i, int j) { if (w[i] < w[j]) std::swap(w[i], w[j]); };
+  trier(0, 1); trier(2, 3); trier(0, 2); trier(1, 3); trier(1, 2);
+  int w1 = w[0] >> 2, w2 = w[1] >> 2, w3 = w[2] >> 2, w4 = w[3] >> 2;
+  bool diagonale = ((w[0] ^ w[1]) & 3) == 3;
+  diff[w2] += 1;  diff[w1] -= 1;                 // Q1
+  if (diagonale) { diff[w3] -= 2; diff[w2] += 2; }   // QD
+  diff[w4] -= 1;  diff[w3] += 1;                 // Q3
+}
+
+// arbre : arbre max 8-connexe de img_gry s'il est déjà construit
+CourbesEuler calculer_courbes_euler(const cv::Mat & img_gry,
+                                    const ArbreComposantes * arbre = NULL)
+{
+  CHECK_MAT_TYPE(img_gry, CV_8UC1)
+
+  int rows = img_gry.rows, cols = img_gry.cols;
+  int64_t diff[257] = { 0 };
+  std::vector<uint8_t> haut(cols + 2, 0), bas(cols + 2, 0);   // lignes y-1 et y
+  for (int y = 0; y <= rows; y++)
+  {
+    std::swap(haut, bas);
+    if (y < rows) memcpy(bas.data() + 1, img_gry.ptr<uint8_t>(y), cols);
+    else std::fill(bas.begin(), bas.end(), 0);
+    for (int x = 0; x <= cols; x++)
+      ajouter_bit_quad(haut[x], haut[x+1], bas[x], bas[x+1], diff);
+  }
+
+  ArbreComposantes local;
+  if (arbre == NULL)
+  {
+    construire_arbre_composantes(img_gry, 8, false, local);
+    arbre = &local;
+  }
+  int64_t diff_c[257] = { 0 };
+  for (size_t n = 0; n < arbre->nombre(); n++)
+  {
+    int32_t p = arbre->parent[n];
+    diff_c[p < 0 ? 0 : arbre->niveau[p]]++;
+    diff_c[arbre->niveau[n]]--;
+  }
+
+  CourbesEuler c;
+  int64_t e4 = 0, nc = 0;
+  for (int s = 0; s < 256; s++)
+  {
+    e4 += diff[s];
+    nc += diff_c[s];
+    c.euler[s] = e4 / 4;
+    c.composantes[s] = nc;
+    c.trous[s] = nc - e4 / 4;
+  }
+  return c;
+}
+
+bool ecrire_courbes_euler_csv(const std::string & nom, const CourbesEuler & c)
+{
+  std::ofstream f(nom);
+  if (!f) return false;
+  f << "seuil,composantes,trous,euler\n";
+  for (int s = 0; s < 256; s++)
+    f << s << "," << c.composantes[s] << "," << c.trous[s] << "," << c.euler[s] << "\n";
+  return (bool) f;
+}
+
+// Résumé sur cout : les courbes de 16 en 16 niveaux, et au seuil s
+void afficher_courbes_euler(const CourbesEuler & c, int s)
+{
+  std::cout << " seuil  composantes   trous   euler\n";
+  for (int k = 0; k < 256; k += 16)
+    std::cout << std::setw(6) << k << std::setw(13) << c.composantes[k]
+              << std::setw(8) << c.trous[k] << std::setw(8) << c.euler[k] << "\n";
+  std::cout << "Au seuil " << s << " : " << c.composantes[s] << " composantes, "
+            << c.trous[s] << " trous, nombre d'Euler " << c.euler[s] << std::endl;
+}
+//-----_COURBES D'EULER_-----
+
+
+
+
+void dessiner_contours_poly(cv::Mat img)
+{
+  std::vector<ContourF8> contours = obtenir_contours_c8(img);
+	for(unsigned int i = 0;i<contours.size();i++)
+	{
+		std::cout<<"step : "<< i <<std::endl;
+		std::vector<ContourPol> vect_contour_pol = approximer_contour(contours.at(i), img);
+    colorier_morceaux(vect_contour_pol,img);
+		std::cout<<"pomdeter "<<std::endl;
+	}
+}
+
+void dessiner_approx_poly(cv::Mat img)
+{
+	std::vector<ContourF8> contours = obtenir_contours_c8(img);
+  //int cpt = 1;
+	for(unsigned int i = 0;i<contours.size();i++)
+	{
+		std::cout<<"step : "<< i <<std::endl;
+		std::vector<ContourPol> vect_contour_pol = approximer_contour(contours.at(i), img);
+    colorier_morceaux(vect_contour_pol,img);
+
+    //remplir_polyg(img,vect_contour_pol,cpt);
+    //cpt++;
+    //if(cpt == 255)cpt++;
+		std::cout<<"pomdeter "<<std::endl;
+	}
   approximer_et_remplir_contour_c8(img,contours,seuil_recalc);
 
 }
 
 void pelage(cv::Mat img)
 {
-  std::vector<ContourF8> contours = effectuer_suivi_contours_c8(img);
+  std::vector<ContourF8> contours = obtenir_contours_c8(img);
   approximer_et_remplir_contour_c8(img,contours,seuil_recalc);
   effectuer_pelage_DT(img, glob_connex);
 
 }
+
+// Compare les temps de polygonisation Douglas-Peucker et DSS sur les mêmes
+// contours ; le suivi est fait une seule fois, sur une copie de l'image.
+void comparer_polygonisations(cv::Mat img_niv)
+{
+  cv::Mat img = img_niv.clone();
+  std::vector<ContourF8> contours = effectuer_suivi_contours_c8(img);
+
+  unsigned int nb_points = 0, nb_sommets_dp = 0, nb_sommets_dss = 0;
+  int64 t0 = cv::getTickCount();
+  for(unsigned int i = 0; i < contours.size(); i++)
+  {
+    std::vector<ContourPol> v = approximer_contour_c8(contours.at(i), img);
+    for(unsigned int j = 0; j < v.size(); j++)
+      if(v.at(j).estSommetApproxPoly) nb_sommets_dp++;
+  }
+  int64 t1 = cv::getTickCount();
+  for(unsigned int i = 0; i < contours.size(); i++)
+  {
+    std::vector<ContourPol> v = approximer_contour_c8_dss(contours.at(i));
+    nb_points += v.size();
+    for(unsigned int j = 0; j < v.size(); j++)
+      if(v.at(j).estSommetApproxPoly) nb_sommets_dss++;
+  }
+  int64 t2 = cv::getTickCount();
+
+  double f = 1000.0 / cv::getTickFrequency();
+  std::cout << "Polygonisation de " << contours.size() << " contours, "
+            << nb_points << " points :\n"
+            << "  Douglas-Peucker (seuil " << seuil_recalc << ") : "
+            << (t1 - t0) * f << " ms, " << nb_sommets_dp << " sommets\n"
+            << "  DSS                        : "
+            << (t2 - t1) * f << " ms, " << nb_sommets_dss << " sommets"
+            << std::endl;
+}
 // Appelez ici vos transformations selon affi
 void effectuer_transformations (My::Affi affi, cv::Mat img_niv,int s_pol)
 {
@@ -1323,48 +3526,362 @@ void effectuer_transformations (My::Affi affi, cv::Mat img_niv,int s_pol)
       seuil_recalc = s_pol / 1000.0f;
       dessiner_contours_poly(img_niv);
 
-			break;
-    }
-    case My::A_TRANS6 :
+			break;
+    }
+    case My::A_TRANS6 :
+    {
+      if(s_pol == 0) s_pol++;
+      seuil_recalc = s_pol / 1000.0f;
+      dessiner_approx_poly(img_niv);
+
+			break;
+    }
+    case My::A_TRANS7 :
+    {
+      if(s_pol == 0) s_pol++;
+      seuil_recalc = s_pol / 1000.0f;
+      pelage(img_niv);
+
+			break;
+    }
+    case My::A_TRANS8 :
+    {
+      if(s_pol == 0) s_pol++;
+      seuil_recalc = s_pol / 1000.0f;
+      //effectuer_suivi_contours_c8(img_niv);
+      pelage(img_niv);
+      detecter_maximum_locaux(img_niv,glob_connex);
+      break;
+    }
+    case My::A_TRANS9 :
+    {
+      if(s_pol == 0) s_pol++;
+      seuil_recalc = s_pol / 1000.0f;
+      pelage(img_niv);
+      detecter_maximum_locaux(img_niv,glob_connex);
+      effectuer_pelage_RDT(img_niv,glob_connex);
+			break;
+    }
+
+
+    default :
+      std::cout<<"touche non valide"<<std::endl;
+    }
+}
+
+size_t octets_contours (const std::vector<ContourF8> &contours)
+{
+  size_t n = contours.size() * sizeof(ContourF8);
+  for (unsigned int i = 0; i < contours.size(); i++)
+    n += contours[i].chaineFreeman.capacity() * sizeof(int);
+  return n;
+}
+
+// Résultat de l'étape pour l'état courant de my, calculé à partir des étapes
+// précédentes et mémorisé dans le cache. Il est partagé avec le cache :
+// ne pas le modifier.
+ResultatEtape obtenir_etape (My &my, Etape etape)
+{
+  int tolerance = my.seuil_pol > 0 ? my.seuil_pol : 1;
+  if (glob_mode_polyg == P_DSS) tolerance = 0;   // sans objet
+  CleEtape cle = { etape, my.version_src, my.seuil, glob_connex, tolerance,
+                   glob_mode_polyg };
+  if (etape < E_PELAGE) cle.connexite = 0;
+  if (etape < E_POLY) cle.tolerance = cle.mode_polyg = 0;
+  if (etape == E_GRIS) cle.seuil = 0;
+
+  ResultatEtape res;
+  if (my.cache.chercher (cle, res)) return res;
+
+  seuil_recalc = tolerance / 1000.0f;
+  int type_m = type_marquage (my.img_src.rows);
+  switch (etape) {
+    case E_GRIS :
+      cv::cvtColor (my.img_src, res.img, cv::COLOR_BGR2GRAY);
+      break;
+    case E_BINAIRE :
+      // Reste en CV_8UC1 : les étapes suivantes convertissent
+      cv::threshold (obtenir_etape (my, E_GRIS).img, res.img, my.seuil, 255,
+                     cv::THRESH_BINARY);
+      break;
+    case E_SUIVI : {
+      obtenir_etape (my, E_BINAIRE).img.convertTo (res.img, CV_32SC1);
+      auto contours = std::make_shared<std::vector<ContourF8>>(
+                        obtenir_contours_c8 (res.img));
+      res.octets = octets_contours (*contours);
+      res.contours = contours;
+    } break;
+    case E_MARQUE_C8 :
+      obtenir_etape (my, E_BINAIRE).img.convertTo (res.img, type_m);
+      marquer_contours_c8 (res.img);
+      break;
+    case E_MARQUE_C4 :
+      obtenir_etape (my, E_BINAIRE).img.convertTo (res.img, type_m);
+      marquer_contours_c4 (res.img);
+      break;
+    case E_NUMERO :
+      obtenir_etape (my, E_BINAIRE).img.convertTo (res.img,
+                                        type_numerotation (my.img_src.rows));
+      numeroter_contours_c8 (res.img);
+      break;
+    case E_POLY : {
+      ResultatEtape suivi = obtenir_etape (my, E_SUIVI);
+      res.img = suivi.img.clone();
+      for (unsigned int i = 0; i < suivi.contours->size(); i++)
+        colorier_morceaux (approximer_contour (suivi.contours->at(i), res.img),
+                           res.img);
+    } break;
+    case E_REMPLI : {
+      ResultatEtape suivi = obtenir_etape (my, E_SUIVI);
+      res.img = cv::Mat(suivi.img.rows, suivi.img.cols, CV_32SC1);
+      approximer_et_remplir_contour_c8 (res.img, *suivi.contours, seuil_recalc);
+    } break;
+    case E_PELAGE :
+      res.img = obtenir_etape (my, E_REMPLI).img.clone();
+      effectuer_pelage_DT (res.img, glob_connex);
+      break;
+    case E_MAXIMA :
+      res.img = obtenir_etape (my, E_PELAGE).img.clone();
+      detecter_maximum_locaux (res.img, glob_connex);
+      break;
+    case E_RDT :
+      res.img = obtenir_etape (my, E_MAXIMA).img.clone();
+      effectuer_pelage_RDT (res.img, glob_connex);
+      break;
+  }
+  res.octets += res.img.total() * res.img.elemSize();
+  my.cache.ranger (cle, res);
+  return res;
+}
+
+// Nouvelle image img_niv pour la transformation courante, à partir de l'image
+// source seuillée ; les transformations sans étape en cache sont recalculées.
+cv::Mat calculer_img_niv (My &my)
+{
+  Etape etape;
+  switch (my.affi) {
+    // L'image d'origine est affichée telle quelle depuis img_src
+    case My::A_ORIG   : return cv::Mat();
+    case My::A_SEUIL  : etape = E_BINAIRE;   break;
+    case My::A_TRANS1 : etape = E_MARQUE_C8; break;
+    case My::A_TRANS2 : etape = E_MARQUE_C4; break;
+    case My::A_TRANS3 : etape = E_NUMERO;    break;
+    case My::A_TRANS4 : etape = E_SUIVI;     break;
+    case My::A_TRANS5 : etape = E_POLY;      break;
+    case My::A_TRANS6 : etape = E_REMPLI;    break;
+    case My::A_TRANS7 : etape = E_PELAGE;    break;
+    case My::A_TRANS8 : etape = E_MAXIMA;    break;
+    case My::A_TRANS9 : etape = E_RDT;       break;
+    default : {
+      cv::Mat img;
+      obtenir_etape (my, E_BINAIRE).img.convertTo (img, CV_32SC1);
+      effectuer_transformations (my.affi, img, my.seuil_pol);
+      return img;
+    }
+  }
+  // Les étapes peuvent être en type étroit, l'affichage est en CV_32SC1
+  cv::Mat img;
+  obtenir_etape (my, etape).img.convertTo (img, CV_32SC1);
+  return img;
+}
+
+
+//----------------------- C A L C U L   D E   F O N D -------------------------
+
+// Les transformations tournent dans un fil de calcul, pour que les fenêtres
+// restent réactives. La boucle d'événements dépose une demande (copie des
+// paramètres de my) ; une demande plus récente annule celle en cours. Les
+// images terminées reviennent par un triple tampon sans verrou : l'affichage
+// prend toujours la dernière terminée, sans jamais attendre.
+
+// Mesures des contours de l'image seuillée de my, affichées sur cout ; dans
+// le fil de calcul, seul à toucher au fichier -ctr
+void mesurer_et_afficher (My &my)
+{
+    cv::Mat img_bin;
+    obtenir_etape (my, E_BINAIRE).img.convertTo (img_bin, CV_32SC1);
+    int64 t0 = cv::getTickCount();
+    TableMesuresContours t = mesurer_contours_c8(img_bin);
+    double ms = (cv::getTickCount() - t0) * 1000. / cv::getTickFrequency();
+    afficher_mesures(t);
+    std::cout << "Suivi et mesures en " << ms << " ms" << std::endl;
+}
+
+// L'index des contours de my correspond-il à son image et à son seuil ?
+bool index_a_jour (const My &my)
+{
+    return my.index && my.version_index == my.version_src
+        && my.seuil_index == my.seuil;
+}
+
+// L'index des contours n'est construit que sur demande (clic droit) ; il
+// vaut alors pour version_src et seuil.
+struct Trame
+{
+    cv::Mat img_niv, img_coul;
+    std::shared_ptr<IndexContours> index;
+    int version_src = 0, seuil = 0;
+};
+
+class TripleTampon
+{
+  public :
+    // Côté producteur : remplir arriere() puis publier()
+    Trame & arriere () { return trames[arr]; }
+    void publier ()
     {
-      if(s_pol == 0) s_pol++;
-      seuil_recalc = s_pol / 1000.0f;
-      dessiner_approx_poly(img_niv);
+        arr = milieu.exchange (arr | NOUVELLE, std::memory_order_acq_rel) & INDICE;
+    }
 
-			break;
+    // Côté consommateur : true si une trame plus récente est dans avant()
+    bool recuperer ()
+    {
+        if (!(milieu.load (std::memory_order_acquire) & NOUVELLE)) return false;
+        av = milieu.exchange (av, std::memory_order_acq_rel) & INDICE;
+        return true;
     }
-    case My::A_TRANS7 :
+    Trame & avant () { return trames[av]; }
+
+  private :
+    enum { INDICE = 3, NOUVELLE = 4 };
+    Trame trames[3];
+    int arr = 0, av = 1;
+    std::atomic<int> milieu {2};
+};
+
+class CalculFond
+{
+  public :
+    void demarrer (size_t budget_cache)
     {
-      if(s_pol == 0) s_pol++;
-      seuil_recalc = s_pol / 1000.0f;
-      pelage(img_niv);
+        calc.cache.fixer_budget (budget_cache);
+        fil = std::thread (&CalculFond::boucle, this);
+    }
 
-			break;
+    void arreter ()
+    {
+        {
+            std::lock_guard<std::mutex> verrou (mutex);
+            fin = true;
+        }
+        derniere_demande++;
+        cond.notify_one();
+        if (fil.joinable()) fil.join();
     }
-    case My::A_TRANS8 :
+
+    // Dépose une demande pour l'état courant de my ; remplace celle en attente
+    // et annule celle en cours.
+    void demander (const My &my)
     {
-      if(s_pol == 0) s_pol++;
-      seuil_recalc = s_pol / 1000.0f;
-      //effectuer_suivi_contours_c8(img_niv);
-      pelage(img_niv);
-      detecter_maximum_locaux(img_niv,glob_connex);
-      break;
+        std::lock_guard<std::mutex> verrou (mutex);
+        travail.numero = ++derniere_demande;
+        travail.img_src = my.img_src;
+        travail.version_src = my.version_src;
+        travail.seuil = my.seuil;
+        travail.affi = my.affi;
+        travail.seuil_pol = my.seuil_pol;
+        travail.connex = glob_connex;
+        travail.mode_polyg = glob_mode_polyg;
+        travail.index = my.clic_index_x >= 0 && !index_a_jour (my);
+        // Une demande de mesures pas encore prise par le fil reste due
+        travail.mesures = travail.mesures || my.mesures_demandees;
+        a_faire = true;
+        cond.notify_one();
     }
-    case My::A_TRANS9 :
+
+    // Dernière trame terminée, s'il y en a une nouvelle depuis l'appel
+    // précédent ; son index des contours, s'il y en a un, remplace celui de my
+    bool recuperer (My &my)
     {
-      if(s_pol == 0) s_pol++;
-      seuil_recalc = s_pol / 1000.0f;
-      pelage(img_niv);
-      detecter_maximum_locaux(img_niv,glob_connex);
-      effectuer_pelage_RDT(img_niv,glob_connex);
-			break;
+        if (!tampon.recuperer()) return false;
+        const Trame &tr = tampon.avant();
+        my.img_niv  = tr.img_niv;
+        my.img_coul = tr.img_coul;
+        if (tr.index) {
+            my.index = tr.index;
+            my.version_index = tr.version_src;
+            my.seuil_index = tr.seuil;
+        }
+        return true;
     }
 
+  private :
+    struct Travail {
+        unsigned numero = 0;
+        cv::Mat img_src;
+        int version_src = 0, seuil = 0;
+        My::Affi affi = My::A_ORIG;
+        int seuil_pol = 0, connex = 4;
+        ModePolyg mode_polyg = P_DOUGLAS_PEUCKER;
+        bool index = false;                 // construire l'index des contours
+        bool mesures = false;               // mesurer les contours (touche 'm')
+    };
 
-    default :
-      std::cout<<"touche non valide"<<std::endl;
+    My calc;                                // état propre au fil de calcul
+    std::thread fil;
+    std::mutex mutex;
+    std::condition_variable cond;
+    Travail travail;
+    bool a_faire = false, fin = false;
+    std::atomic<unsigned> derniere_demande {0};
+    TripleTampon tampon;
+
+    void boucle ()
+    {
+        glob_derniere_demande = &derniere_demande;
+        for (;;) {
+            Travail t;
+            {
+                std::unique_lock<std::mutex> verrou (mutex);
+                cond.wait (verrou, [this] { return a_faire || fin; });
+                if (fin) return;
+                t = travail;
+                travail.mesures = false;
+                a_faire = false;
+            }
+            glob_demande_en_cours = t.numero;
+
+            calc.img_src = t.img_src;
+            calc.version_src = t.version_src;
+            calc.seuil = t.seuil;
+            calc.affi = t.affi;
+            calc.seuil_pol = t.seuil_pol;
+            glob_connex = t.connex;
+            glob_mode_polyg = t.mode_polyg;
+            try {
+                // Les images sont neuves à chaque trame : l'affichage peut
+                // encore tenir celles de la trame précédente.
+                Trame &tr = tampon.arriere();
+                tr.img_niv = calculer_img_niv (calc);
+                if (t.affi == My::A_ORIG) tr.img_coul = t.img_src.clone();
+                else {
+                    tr.img_coul = cv::Mat (tr.img_niv.rows, tr.img_niv.cols, CV_8UC3);
+                    representer_en_couleurs_vga (tr.img_niv, tr.img_coul);
+                }
+                // Ici comme tout accès au fichier -ctr : seul ce fil y touche
+                tr.index.reset();
+                if (t.index) {
+                    ResultatEtape suivi = obtenir_etape (calc, E_SUIVI);
+                    tr.index = std::make_shared<IndexContours>();
+                    tr.index->construire (*suivi.contours, suivi.img.rows, suivi.img.cols);
+                }
+                tr.version_src = t.version_src;
+                tr.seuil = t.seuil;
+                tampon.publier();
+                if (t.mesures) mesurer_et_afficher (calc);
+            } catch (const Annulation &) {
+                // une demande plus récente attend déjà ; elle reprend les
+                // mesures si elles n'ont pas été faites
+                if (t.mesures) {
+                    std::lock_guard<std::mutex> verrou (mutex);
+                    travail.mesures = true;
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Calcul : " << e.what() << std::endl;
+            }
+        }
     }
-}
+};
 
 
 //---------------------------- C A L L B A C K S ------------------------------
@@ -1400,6 +3917,53 @@ void onSeuilSlide2 (int pos, void *data)
 }
 
 // Callback pour la souris
+// Contour sous le clic droit (x,y), par l'index des contours de l'image
+// seuillée, qui doit être à jour
+void repondre_clic_index (const My *my, int x, int y)
+{
+    int id = my->index->contour_sous (x, y);
+    double d;
+    int proche = my->index->plus_proche (x, y, &d);
+    std::cout << "Clic " << x << "," << y << " : ";
+    if (id < 0) std::cout << "hors de tout contour";
+    else std::cout << "contour " << id
+                   << (my->index->est_trou (id) ? " (trou)" : " (objet)")
+                   << ", aire " << my->index->aire (id);
+    if (proche >= 0)
+        std::cout << ", plus proche contour " << proche << " à " << d << " px";
+    std::cout << std::endl;
+}
+
+// L'index n'est reconstruit que si l'image ou le seuil ont changé, par le fil
+// de calcul (suivi, fichier -ctr) : le clic attend la trame qui le ramène.
+void interroger_index (My *my, int x, int y)
+{
+    if (index_a_jour (*my)) {
+        repondre_clic_index (my, x, y);
+        return;
+    }
+    my->clic_index_x = x;
+    my->clic_index_y = y;
+    my->set_recalc (My::R_TRANSFOS);
+}
+
+// Max-tree (objets, C8) et min-tree (fond, C4) de img_src en gris, refaits
+// seulement quand img_src change : tous les seuils s'en déduisent
+void obtenir_arbres (My *my)
+{
+    if (my->arbre_max && my->version_arbres == my->version_src) return;
+    cv::Mat img_gry;
+    cv::cvtColor (my->img_src, img_gry, cv::COLOR_BGR2GRAY);
+    int64 t0 = cv::getTickCount();
+    my->arbre_max = std::make_shared<ArbreComposantes>();
+    my->arbre_min = std::make_shared<ArbreComposantes>();
+    construire_arbre_composantes (img_gry, 8, false, *my->arbre_max);
+    construire_arbre_composantes (img_gry, 4, true,  *my->arbre_min);
+    double ms = (cv::getTickCount() - t0) * 1000. / cv::getTickFrequency();
+    std::cout << "Arbres des composantes construits en " << ms << " ms" << std::endl;
+    my->version_arbres = my->version_src;
+}
+
 void onMouseEvent (int event, int x, int y, int flags, void *data)
 {
     My *my = (My*) data;
@@ -1423,6 +3987,9 @@ void onMouseEvent (int event, int x, int y, int flags, void *data)
         case cv::EVENT_LBUTTONUP :
             my->clic_n = 0;
             break;
+        case cv::EVENT_RBUTTONDOWN :
+            interroger_index (my, x, y);
+            break;
     }
 }
 
@@ -1439,6 +4006,13 @@ void afficher_aide() {
         "   1    affiche la transformation 1\n"
         "   2    affiche la transformation 2\n"
         "   3    affiche la transformation 3\n"
+        "   p    bascule polygonisation Douglas-Peucker / DSS\n"
+        "   b    compare les temps des deux polygonisations\n"
+        "   m    mesure les contours (aire, périmètres, moments)\n"
+        "   t    composantes au seuil courant, d'après les arbres max et min\n"
+        "   f    ouverture d'aire de src (zones claires de moins de 50 pixels)\n"
+        "   e    composantes, trous et nombre d'Euler pour les 256 seuils\n"
+        " clic droit  contour sous le curseur et contour le plus proche\n"
         "  esc   quitte\n"
     << std::endl;
 }
@@ -1472,7 +4046,10 @@ int onKeyPressEvent (int key, void *data)
           } break;
         case 'i' :
             std::cout << "Couleurs inversées" << std::endl;
+            // nouvelle image : le fil de calcul lit peut-être encore l'ancienne
+            my->img_src = my->img_src.clone();
             inverser_couleurs(my->img_src);
+            my->version_src++;
             my->set_recalc(My::R_SEUIL);
             break;
         case 'o' :
@@ -1493,6 +4070,68 @@ int onKeyPressEvent (int key, void *data)
             my->affi = My::A_TRANS7;
             my->set_recalc(My::R_SEUIL);
             break;
+        case 'p' :
+            if(glob_mode_polyg == P_DSS) glob_mode_polyg = P_DOUGLAS_PEUCKER;
+            else glob_mode_polyg = P_DSS;
+            std::cout << "Polygonisation : "
+                      << (glob_mode_polyg == P_DSS ? "DSS" : "Douglas-Peucker")
+                      << std::endl;
+            my->set_recalc(My::R_SEUIL);
+            break;
+        case 'b' :
+            std::cout << "Comparaison des polygonisations" << std::endl;
+            if(my->seuil_pol == 0) seuil_recalc = 0.001;
+            else seuil_recalc = my->seuil_pol / 1000.0f;
+            {
+                cv::Mat img_gry;
+                cv::cvtColor (my->img_src, img_gry, cv::COLOR_BGR2GRAY);
+                cv::threshold (img_gry, img_gry, my->seuil, 255, cv::THRESH_BINARY);
+                cv::Mat img_bin;
+                img_gry.convertTo (img_bin, CV_32SC1,1., 0.);
+                comparer_polygonisations(img_bin);
+            }
+            break;
+        case 'm' :
+            // Suivi et fichier -ctr : par le fil de calcul, avec la trame
+            std::cout << "Mesures des contours" << std::endl;
+            my->mesures_demandees = true;
+            my->set_recalc(My::R_TRANSFOS);
+            break;
+
+        case 't' :
+            std::cout << "Composantes au seuil " << my->seuil << std::endl;
+            obtenir_arbres (my);
+            afficher_composantes_au_seuil (*my->arbre_max, my->seuil);
+            afficher_composantes_au_seuil (*my->arbre_min, my->seuil);
+            break;
+        case 'e' :
+            std::cout << "Courbes d'Euler" << std::endl;
+            obtenir_arbres (my);
+            {
+                cv::Mat img_gry;
+                cv::cvtColor (my->img_src, img_gry, cv::COLOR_BGR2GRAY);
+                int64 t0 = cv::getTickCount();
+                CourbesEuler c = calculer_courbes_euler (img_gry, my->arbre_max.get());
+                double ms = (cv::getTickCount() - t0) * 1000. / cv::getTickFrequency();
+                afficher_courbes_euler (c, my->seuil);
+                std::cout << "256 seuils en " << ms << " ms" << std::endl;
+            }
+            break;
+        case 'f' :
+            std::cout << "Ouverture d'aire" << std::endl;
+            obtenir_arbres (my);
+            {
+                CriteresComposantes c;
+                c.aire_min = 50;
+                cv::Mat img_gry = filtrer_arbre (*my->arbre_max, c);
+                // nouvelle image : le fil de calcul lit peut-être encore l'ancienne
+                cv::Mat img_src;
+                cv::cvtColor (img_gry, img_src, cv::COLOR_GRAY2BGR);
+                my->img_src = img_src;
+                my->version_src++;
+                my->set_recalc(My::R_SEUIL);
+            }
+            break;
 
         // Rajoutez ici des touches pour les transformations
         case '1' :
@@ -1549,17 +4188,818 @@ int onKeyPressEvent (int key, void *data)
 }
 
 
+//------------------------------- B A T C H -----------------------------------
+
+// Mode sans fenêtre : applique une transformation à une liste d'images, en
+// parallèle sur un groupe de threads, et enregistre les résultats en couleurs.
+
+struct ParamsBatch
+{
+    char touche = '1';                // touche de la transformation
+    My::Affi affi = My::A_TRANS1;
+    int seuil = 127;
+    int seuil_pol = 600;
+    int nb_threads = 0;               // 0 : nombre de coeurs
+    const char *dossier_sortie = NULL;
+    std::vector<std::string> images;
+};
+
+// Même correspondance touche -> transformation que onKeyPressEvent
+bool affi_depuis_touche (char touche, My::Affi *affi)
+{
+    switch (touche) {
+        case 'o' : *affi = My::A_ORIG;   return true;
+        case 's' : *affi = My::A_SEUIL;  return true;
+        case '1' : *affi = My::A_TRANS1; return true;
+        case '2' : *affi = My::A_TRANS2; return true;
+        case '3' : *affi = My::A_TRANS3; return true;
+        case '4' : *affi = My::A_TRANS4; return true;
+        case '5' : *affi = My::A_TRANS5; return true;
+        case '6' : *affi = My::A_TRANS6; return true;
+        case '7' : *affi = My::A_TRANS7; return true;
+        case '8' : *affi = My::A_TRANS8; return true;
+        case '9' : *affi = My::A_TRANS9; return true;
+    }
+    return false;
+}
+
+// Ajoute à la liste un fichier image, le contenu d'un dossier, ou les lignes
+// d'un fichier liste .txt
+void lister_images (const char *nom, std::vector<std::string> &liste)
+{
+    DIR *dir = opendir (nom);
+    if (dir) {
+        std::vector<std::string> noms;
+        struct dirent *ent;
+        while ((ent = readdir (dir)) != NULL)
+            if (ent->d_name[0] != '.')
+                noms.push_back (std::string(nom) + "/" + ent->d_name);
+        closedir (dir);
+        std::sort (noms.begin(), noms.end());
+        liste.insert (liste.end(), noms.begin(), noms.end());
+        return;
+    }
+    size_t n = strlen (nom);
+    if (n > 4 && !strcmp (nom + n - 4, ".txt")) {
+        std::ifstream f (nom);
+        std::string ligne;
+        while (std::getline (f, ligne))
+            if (!ligne.empty()) liste.push_back (ligne);
+        return;
+    }
+    liste.push_back (nom);
+}
+
+std::string nom_sortie_batch (const ParamsBatch &pb, const std::string &nom_in,
+    const char *extension = ".png")
+{
+    size_t d = nom_in.find_last_of ('/');
+    std::string base = d == std::string::npos ? nom_in : nom_in.substr (d+1);
+    size_t p = base.find_last_of ('.');
+    if (p != std::string::npos) base = base.substr (0, p);
+    return std::string(pb.dossier_sortie) + "/" + base + "_" + pb.touche + extension;
+}
+
+bool traiter_image_batch (const ParamsBatch &pb, const std::string &nom_in)
+{
+    cv::Mat img_src = cv::imread (nom_in, cv::IMREAD_COLOR);
+    if (img_src.empty()) return false;
+
+    cv::Mat img_coul;
+    if (pb.affi == My::A_ORIG) img_coul = img_src;
+    else {
+        cv::Mat img_gry, img_niv;
+        cv::cvtColor (img_src, img_gry, cv::COLOR_BGR2GRAY);
+        cv::threshold (img_gry, img_gry, pb.seuil, 255, cv::THRESH_BINARY);
+        img_gry.convertTo (img_niv, CV_32SC1,1., 0.);
+        if (pb.affi == My::A_TRANS4) {
+            // Même suivi que effectuer_transformations, plus les mesures
+            HierarchieContours hier;
+            std::vector<ContourF8> contours = effectuer_suivi_contours_c8 (img_niv, &hier);
+            if (!ecrire_mesures_csv (nom_sortie_batch (pb, nom_in, ".csv"),
+                                     mesurer_contours (contours, &hier)))
+                return false;
+        } else
+            effectuer_transformations (pb.affi, img_niv, pb.seuil_pol);
+        img_coul = cv::Mat(img_src.rows, img_src.cols, CV_8UC3);
+        representer_en_couleurs_vga (img_niv, img_coul);
+    }
+    return cv::imwrite (nom_sortie_batch (pb, nom_in), img_coul);
+}
+
+int effectuer_batch (const ParamsBatch &pb)
+{
+    int nb_threads = pb.nb_threads;
+    if (nb_threads <= 0) nb_threads = std::thread::hardware_concurrency();
+    if (nb_threads <= 0) nb_threads = 1;
+    glob_nb_threads_couleurs = 1;
+
+    // Les transformations sont très bavardes sur std::cout : on le rend muet
+    // (badbit) pendant le batch, les messages passent par std::cerr.
+    std::streambuf *cout_buf = std::cout.rdbuf (NULL);
+
+    std::atomic<unsigned> suivante (0);
+    std::atomic<int> nb_erreurs (0);
+    std::mutex mutex_log;
+    int64 t0 = cv::getTickCount();
+
+    auto travailleur = [&] () {
+        for (;;) {
+            unsigned k = suivante++;
+            if (k >= pb.images.size()) break;
+            const std::string &nom_in = pb.images[k];
+            bool ok;
+            try {
+                ok = traiter_image_batch (pb, nom_in);
+            } catch (const std::exception &e) {
+                std::lock_guard<std::mutex> verrou (mutex_log);
+                std::cerr << nom_in << " : " << e.what() << std::endl;
+                ok = false;
+            }
+            std::lock_guard<std::mutex> verrou (mutex_log);
+            if (!ok) {
+                nb_erreurs++;
+                std::cerr << "Erreur sur " << nom_in << std::endl;
+            } else std::cerr << nom_in << " -> " << nom_sortie_batch (pb, nom_in)
+                             << std::endl;
+        }
+    };
+
+    std::vector<std::thread> groupe;
+    for (int i = 0; i < nb_threads; i++)
+        groupe.emplace_back (travailleur);
+    for (auto &t : groupe) t.join();
+
+    std::cout.rdbuf (cout_buf);
+    double ms = (cv::getTickCount() - t0) * 1000. / cv::getTickFrequency();
+    std::cerr << pb.images.size() << " images en " << ms << " ms sur "
+              << nb_threads << " threads, " << nb_erreurs << " erreurs"
+              << std::endl;
+    return nb_erreurs > 0 ? 1 : 0;
+}
+
+//---------------------------- S E Q U E N C E S ------------------------------
+
+// Mode vidéo : applique une transformation à chaque trame d'une vidéo ou
+// d'une suite d'images (motif printf, ex. trame_%04d.png), en chaîne de 4
+// étages sur des threads distincts : décodage -> seuillage -> transformation
+// -> encodage. Les trames circulent par des files bloquantes ; un lot fixe de
+// SEQ_NB_TRAMES trames est recyclé, si bien que les buffers ne sont alloués
+// qu'à la première trame. Le masque binaire est découpé en tuiles de
+// SEQ_TUILE pixels de côté dont on calcule une empreinte : si toutes les
+// empreintes sont identiques à celles de la trame précédente, le résultat
+// précédent est recopié sans relancer la transformation (les contours sont
+// globaux, un changement dans une seule tuile oblige à tout recalculer).
+
+const int SEQ_TUILE = 64;
+const int SEQ_NB_TRAMES = 6;
+
+struct ParamsSequence
+{
+    char touche = '1';
+    My::Affi affi = My::A_TRANS1;
+    int seuil = 127;
+    int seuil_pol = 600;
+    const char *entree = NULL;        // fichier vidéo ou motif printf
+    const char *sortie = NULL;        // idem ; motif si contient '%'
+    double fps = 25;                  // repris de la vidéo d'entrée
+};
+
+struct TrameSequence
+{
+    int numero = 0;
+    cv::Mat img_src, img_gry, img_bin, img_niv, img_coul;
+    std::vector<uint64_t> empreintes;
+};
+
+// File bloquante ; NULL marque la fin du flux
+class FileTrames
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<TrameSequence *> file;
+  public:
+    void deposer (TrameSequence *t)
+    {
+        { std::lock_guard<std::mutex> verrou (mutex); file.push_back (t); }
+        cond.notify_one();
+    }
+    TrameSequence *retirer ()
+    {
+        std::unique_lock<std::mutex> verrou (mutex);
+        cond.wait (verrou, [this] { return !file.empty(); });
+        TrameSequence *t = file.front();
+        file.pop_front();
+        return t;
+    }
+};
+
+// Empreinte FNV-1a par tuile, sur des mots de 8 octets
+void calculer_empreintes_tuiles (cv::Mat img_bin, std::vector<uint64_t> &emp)
+{
+    CHECK_MAT_TYPE(img_bin, CV_8UC1)
+    int nt_x = (img_bin.cols + SEQ_TUILE-1) / SEQ_TUILE,
+        nt_y = (img_bin.rows + SEQ_TUILE-1) / SEQ_TUILE;
+    emp.assign (size_t(nt_x) * nt_y, 14695981039346656037ULL);
+
+    for (int y = 0; y < img_bin.rows; y++) {
+        const unsigned char *ligne = img_bin.ptr<unsigned char>(y);
+        uint64_t *e = &emp[size_t(y / SEQ_TUILE) * nt_x];
+        for (int tx = 0; tx < nt_x; tx++) {
+            int x0 = tx * SEQ_TUILE, x1 = std::min (x0 + SEQ_TUILE, img_bin.cols);
+            uint64_t h = e[tx];
+            int x = x0;
+            for (; x + 8 <= x1; x += 8) {
+                uint64_t mot;
+                memcpy (&mot, ligne + x, 8);
+                h = (h ^ mot) * 1099511628211ULL;
+            }
+            for (; x < x1; x++)
+                h = (h ^ ligne[x]) * 1099511628211ULL;
+            e[tx] = h;
+        }
+    }
+}
+
+bool ecrire_trame_sequence (const ParamsSequence &ps, cv::VideoWriter &video,
+    const TrameSequence &t)
+{
+    if (!strchr (ps.sortie, '%')) {
+        if (!video.isOpened() &&
+            !video.open (ps.sortie, cv::VideoWriter::fourcc('M','J','P','G'),
+                         ps.fps, t.img_coul.size(), true))
+            return false;
+        video.write (t.img_coul);
+        return true;
+    }
+    char nom[1024];
+    snprintf (nom, sizeof(nom), ps.sortie, t.numero);
+    return cv::imwrite (nom, t.img_coul);
+}
+
+int effectuer_sequence (ParamsSequence &ps)
+{
+    cv::VideoCapture cap (ps.entree);
+    if (!cap.isOpened()) {
+        std::cerr << "Erreur d'ouverture de " << ps.entree << std::endl;
+        return 1;
+    }
+    double fps = cap.get (cv::CAP_PROP_FPS);
+    if (fps > 0) ps.fps = fps;
+    glob_nb_threads_couleurs = 1;
+    std::streambuf *cout_buf = std::cout.rdbuf (NULL);
+
+    TrameSequence trames[SEQ_NB_TRAMES];
+    FileTrames libres, a_seuiller, a_transformer, a_encoder;
+    for (int i = 0; i < SEQ_NB_TRAMES; i++) libres.deposer (&trames[i]);
+
+    int nb_reutilisees = 0;
+    std::atomic<bool> echec (false);
+    int64 t0 = cv::getTickCount();
+
+    // Décodage : read() réécrit dans le buffer de la trame s'il a déjà la
+    // bonne taille
+    std::thread decodeur ([&] () {
+        for (int numero = 0; ; numero++) {
+            TrameSequence *t = libres.retirer();
+            if (echec || !cap.read (t->img_src) || t->img_src.empty()) {
+                a_seuiller.deposer (NULL);
+                return;
+            }
+            t->numero = numero;
+            a_seuiller.deposer (t);
+        }
+    });
+
+    std::thread seuilleur ([&] () {
+        for (;;) {
+            TrameSequence *t = a_seuiller.retirer();
+            if (t == NULL) { a_transformer.deposer (NULL); return; }
+            if (t->img_src.channels() == 3)
+                cv::cvtColor (t->img_src, t->img_gry, cv::COLOR_BGR2GRAY);
+            else t->img_src.copyTo (t->img_gry);
+            cv::threshold (t->img_gry, t->img_bin, ps.seuil, 255,
+                cv::THRESH_BINARY);
+            calculer_empreintes_tuiles (t->img_bin, t->empreintes);
+            a_transformer.deposer (t);
+        }
+    });
+
+    // Transformation : garde le masque et le résultat de la trame précédente
+    std::thread transformeur ([&] () {
+        std::vector<uint64_t> empreintes_prec;
+        cv::Mat img_coul_prec;
+        for (;;) {
+            TrameSequence *t = a_transformer.retirer();
+            if (t == NULL) { a_encoder.deposer (NULL); return; }
+            try {
+                if (!img_coul_prec.empty() && t->empreintes == empreintes_prec
+                    && img_coul_prec.size() == t->img_src.size()) {
+                    img_coul_prec.copyTo (t->img_coul);
+                    nb_reutilisees++;
+                } else {
+                    if (ps.affi == My::A_ORIG)
+                        t->img_src.copyTo (t->img_coul);
+                    else {
+                        t->img_bin.convertTo (t->img_niv, CV_32SC1, 1., 0.);
+                        effectuer_transformations (ps.affi, t->img_niv,
+                            ps.seuil_pol);
+                        t->img_coul.create (t->img_src.rows, t->img_src.cols,
+                            CV_8UC3);
+                        representer_en_couleurs_vga (t->img_niv, t->img_coul);
+                    }
+                    t->img_coul.copyTo (img_coul_prec);
+                    empreintes_prec = t->empreintes;
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Trame " << t->numero << " : " << e.what()
+                          << std::endl;
+                echec = true;
+            }
+            a_encoder.deposer (t);
+        }
+    });
+
+    // Encodage dans le thread principal
+    cv::VideoWriter video;
+    int nb_trames = 0;
+    for (;;) {
+        TrameSequence *t = a_encoder.retirer();
+        if (t == NULL) break;
+        if (!echec && !ecrire_trame_sequence (ps, video, *t)) {
+            std::cerr << "Erreur d'écriture de " << ps.sortie << std::endl;
+            echec = true;
+        }
+        nb_trames++;
+        libres.deposer (t);
+    }
+    decodeur.join(); seuilleur.join(); transformeur.join();
+
+    std::cout.rdbuf (cout_buf);
+    double ms = (cv::getTickCount() - t0) * 1000. / cv::getTickFrequency();
+    std::cerr << nb_trames << " trames en " << ms << " ms ("
+              << (ms > 0 ? nb_trames * 1000. / ms : 0.) << " trames/s), "
+              << nb_reutilisees << " reprises sans recalcul" << std::endl;
+    return echec ? 1 : 0;
+}
+
+
+//--------------------------- B E N C H M A R K -------------------------------
+
+// Banc de mesures sans fenêtre, compilé à part avec -DBENCHMARK (cible
+// "bench" du Makefile) : chaque transformation est chronométrée sur les
+// images binarisées du corpus, puis sur des agrandissements synthétiques de
+// la première image de 1 à 64 Mpix. Résultats en CSV et en JSON, dans le
+// même format que le banc du TP6 pour pouvoir comparer les versions.
+
+struct ParamsBench
+{
+    int seuil = 127;
+    int seuil_pol = 600;
+    int nb_chauffe = 1;               // exécutions non mesurées
+    int nb_repet = 5;                 // exécutions mesurées
+    int mpix_max = 64;                // 0 : pas d'images synthétiques
+    std::string filtre;               // sous-chaîne du nom des cas, "" : tous
+    std::string etiquette = __DATE__ " " __TIME__;
+    std::string prefixe = "bench_tp4";
+    std::vector<std::string> images;
+};
+
+struct CasBench
+{
+    std::string nom;
+    std::function<void(cv::Mat &)> preparer; // hors chrono, peut changer le type
+    std::function<void(cv::Mat)> mesurer;
+};
+
+struct ResultatBench
+{
+    std::string image, cas;
+    int rows, cols;
+    double ms_min, ms_med;
+    long pic_ko;
+};
+
+// Pic de mémoire résidente depuis la dernière remise à zéro (VmHWM) ; à
+// défaut, pic depuis le lancement du processus.
+void remettre_pic_memoire ()
+{
+    std::ofstream f ("/proc/self/clear_refs");
+    if (f) f << "5";
+}
+
+long lire_pic_memoire_ko ()
+{
+    std::ifstream f ("/proc/self/status");
+    std::string ligne;
+    while (std::getline (f, ligne))
+        if (!ligne.compare (0, 6, "VmHWM:"))
+            return atol (ligne.c_str() + 6);
+    struct rusage ru;
+    getrusage (RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+cv::Mat binariser_bench (const cv::Mat &img_src, int seuil)
+{
+    cv::Mat img_gry, img_niv;
+    cv::cvtColor (img_src, img_gry, cv::COLOR_BGR2GRAY);
+    cv::threshold (img_gry, img_gry, seuil, 255, cv::THRESH_BINARY);
+    img_gry.convertTo (img_niv, CV_32SC1,1., 0.);
+    return img_niv;
+}
+
+std::vector<CasBench> lister_cas_bench (const ParamsBench &pb,
+    std::vector<ContourF8> &contours)
+{
+    auto suivre = [&contours] (cv::Mat img) {
+        contours = effectuer_suivi_contours_c8 (img.clone());
+    };
+    auto peler = [&pb] (cv::Mat img) {
+        seuil_recalc = std::max (pb.seuil_pol, 1) / 1000.0f;
+        pelage (img);
+    };
+    auto approximer = [&contours] (ModePolyg mode) {
+        return [&contours, mode] (cv::Mat img) {
+            glob_mode_polyg = mode;
+            for (unsigned int i = 0; i < contours.size(); i++)
+                approximer_contour (contours[i], img);
+        };
+    };
+    auto rien = [] (cv::Mat) {};
+
+    std::vector<CasBench> cas = {
+        { "marquage_c4",     rien, marquer_contours_c4 },
+        { "marquage_c8",     rien, marquer_contours_c8 },
+        { "numerotation_c8", rien, numeroter_contours_c8 },
+        { "suivi_freeman",   rien,
+          [] (cv::Mat img) { effectuer_suivi_contours_c8 (img); } },
+        { "polyg_dp",        suivre, approximer (P_DOUGLAS_PEUCKER) },
+        { "polyg_dss",       suivre, approximer (P_DSS) },
+        { "mesures",         suivre, [&contours] (cv::Mat) {
+              mesurer_contours (contours); } },
+        { "enveloppes",      suivre, [&contours] (cv::Mat) {
+              EnveloppeConvexe e;
+              for (const ContourF8 & c : contours)
+                  envelopper_chaine (c.xPointDepart, c.yPointDepart, c.chaineFreeman.size(),
+                                     [&c] (uint32_t k) { return c.chaineFreeman[k]; }, e); } },
+        { "remplissage",     suivre, [&contours] (cv::Mat img) {
+              glob_mode_polyg = P_DSS;
+              approximer_et_remplir_contour_c8 (img, contours, seuil_recalc); } },
+    };
+    auto etroit = [] (cv::Mat &img) {
+        img.convertTo (img, type_marquage (img.rows)); };
+    cas.push_back ({ "marquage_c4_etroit", etroit, marquer_contours_c4 });
+    cas.push_back ({ "marquage_c8_etroit", etroit, marquer_contours_c8 });
+    cas.push_back ({ "numerotation_c8_etroite", [] (cv::Mat &img) {
+        img.convertTo (img, type_numerotation (img.rows)); },
+        numeroter_contours_c8 });
+    for (int connexite : { 4, 8 }) {
+        std::string c = connexite == 4 ? "_c4" : "_c8";
+        cas.push_back ({ "pelage_dt" + c, rien, [connexite] (cv::Mat img) {
+            effectuer_pelage_DT (img, connexite); } });
+        cas.push_back ({ "pelage_rdt" + c, [connexite] (cv::Mat img) {
+            effectuer_pelage_DT (img, connexite); },
+            [connexite] (cv::Mat img) { effectuer_pelage_RDT (img, connexite); } });
+    }
+    cas.push_back ({ "pelage_complet", rien, peler });
+    auto index = std::make_shared<IndexContours>();
+    cas.push_back ({ "index_construction", suivre, [&contours, index] (cv::Mat img) {
+        index->construire (contours, img.rows, img.cols); } });
+    cas.push_back ({ "index_clics", [&contours, index, suivre] (cv::Mat &img) {
+        suivre (img);
+        index->construire (contours, img.rows, img.cols); },
+        [index] (cv::Mat img) {
+        // 10000 clics répartis sur l'image, en une requête groupée
+        std::vector<cv::Point> pts;
+        for (int k = 0; k < 10000; k++)
+            pts.push_back (cv::Point ((k * 7919) % img.cols, (k * 104729) % img.rows));
+        index->contours_sous (pts); } });
+    auto archive = std::make_shared<ArchiveChaines>();
+    cas.push_back ({ "codec_encodage", suivre, [&contours, archive] (cv::Mat) {
+        *archive = encoder_chaines (contours); } });
+    cas.push_back ({ "codec_decodage", [&contours, archive, suivre] (cv::Mat &img) {
+        suivre (img);
+        *archive = encoder_chaines (contours); },
+        [archive] (cv::Mat) { decoder_chaines (*archive); } });
+    return cas;
+}
+
+ResultatBench mesurer_cas_bench (const ParamsBench &pb, const CasBench &c,
+    const std::string &nom_image, const cv::Mat &img_bin)
+{
+    remettre_pic_memoire();
+    std::vector<double> durees;
+    for (int k = 0; k < pb.nb_chauffe + pb.nb_repet; k++) {
+        cv::Mat img = img_bin.clone();
+        c.preparer (img);
+        int64 t0 = cv::getTickCount();
+        c.mesurer (img);
+        int64 t1 = cv::getTickCount();
+        if (k >= pb.nb_chauffe)
+            durees.push_back ((t1 - t0) * 1000. / cv::getTickFrequency());
+    }
+    std::sort (durees.begin(), durees.end());
+
+    ResultatBench r;
+    r.image = nom_image;
+    r.cas = c.nom;
+    r.rows = img_bin.rows;
+    r.cols = img_bin.cols;
+    r.ms_min = durees.front();
+    r.ms_med = durees[durees.size() / 2];
+    r.pic_ko = lire_pic_memoire_ko();
+    return r;
+}
+
+// Agrandissements au plus proche voisin de l'image binaire : les formes sont
+// conservées, seule leur échelle change.
+std::vector<std::pair<std::string, cv::Mat>> images_synthetiques_bench (
+    const std::string &nom, const cv::Mat &img_bin, int mpix_max)
+{
+    std::vector<std::pair<std::string, cv::Mat>> liste;
+    for (int mpix = 1; mpix <= mpix_max; mpix *= 2) {
+        double f = sqrt (mpix * 1e6 / img_bin.total());
+        cv::Mat img;
+        cv::resize (img_bin, img, cv::Size (int(img_bin.cols * f + .5),
+            int(img_bin.rows * f + .5)), 0, 0, cv::INTER_NEAREST);
+        liste.push_back ({ nom + "@" + std::to_string(mpix) + "Mpix", img });
+    }
+    return liste;
+}
+
+void ecrire_resultats_bench (const ParamsBench &pb,
+    const std::vector<ResultatBench> &res)
+{
+    std::ofstream csv (pb.prefixe + ".csv");
+    csv << "etiquette,image,cas,rows,cols,repet,ms_min,ms_med,mpix_s,ns_pixel,"
+           "pic_rss_ko\n";
+    std::ofstream json (pb.prefixe + ".json");
+    json << "{\n  \"etiquette\": \"" << pb.etiquette << "\",\n"
+         << "  \"chauffe\": " << pb.nb_chauffe << ",\n"
+         << "  \"repet\": " << pb.nb_repet << ",\n  \"mesures\": [";
+
+    for (unsigned int i = 0; i < res.size(); i++) {
+        const ResultatBench &r = res[i];
+        double pix = double(r.rows) * r.cols;
+        double mpix_s = r.ms_med > 0 ? pix / (r.ms_med * 1e3) : 0;
+        double ns_pixel = r.ms_med * 1e6 / pix;
+        csv << pb.etiquette << "," << r.image << "," << r.cas << ","
+            << r.rows << "," << r.cols << "," << pb.nb_repet << ","
+            << r.ms_min << "," << r.ms_med << "," << mpix_s << ","
+            << ns_pixel << "," << r.pic_ko << "\n";
+        json << (i ? ",\n" : "\n") << "    { \"image\": \"" << r.image
+             << "\", \"cas\": \"" << r.cas << "\", \"rows\": " << r.rows
+             << ", \"cols\": " << r.cols << ", \"ms_min\": " << r.ms_min
+             << ", \"ms_med\": " << r.ms_med << ", \"mpix_s\": " << mpix_s
+             << ", \"ns_pixel\": " << ns_pixel << ", \"pic_rss_ko\": "
+             << r.pic_ko << " }";
+    }
+    json << "\n  ]\n}\n";
+    std::cerr << res.size() << " mesures dans " << pb.prefixe << ".csv et "
+              << pb.prefixe << ".json" << std::endl;
+}
+
+// Taux de compression et débit de décodage du codec de chaînes sur tous les
+// contours des images du corpus, encodés ensemble comme dans une archive
+void bilan_codec_bench (const ParamsBench &pb,
+    const std::vector<std::pair<std::string, cv::Mat>> &entrees)
+{
+  std::vector<ContourF8> tous;
+  for (auto &e : entrees) {
+    std::vector<ContourF8> c = effectuer_suivi_contours_c8 (e.second.clone());
+    tous.insert (tous.end(), c.begin(), c.end());
+  }
+  size_t nb_codes = 0, octets_3bits = octets_chaines_3bits (tous);
+  for (const ContourF8 &c : tous) nb_codes += c.chaineFreeman.size();
+  if (nb_codes == 0) return;
+
+  int64 t0 = cv::getTickCount();
+  ArchiveChaines a = encoder_chaines (tous);
+  int64 t1 = cv::getTickCount();
+  std::vector<uint8_t> sortie (nb_codes + CODEC_MARGE);
+  std::vector<double> durees;
+  for (int k = 0; k < pb.nb_chauffe + pb.nb_repet; k++) {
+    int64 d0 = cv::getTickCount();
+    uint8_t *o = sortie.data();
+    for (uint32_t i = 0; i < a.chaines.size(); i++) {
+      decoder_chaine (a, i, o);
+      o += a.chaines[i].nb_codes;
+    }
+    int64 d1 = cv::getTickCount();
+    if (k >= pb.nb_chauffe)
+      durees.push_back ((d1 - d0) * 1000. / cv::getTickFrequency());
+  }
+  std::sort (durees.begin(), durees.end());
+
+  double ms_enc = (t1 - t0) * 1000. / cv::getTickFrequency();
+  double ms_dec = durees[durees.size() / 2];
+  size_t octets_flux = a.flux.size() - 8;
+  std::cerr << "Codec : " << tous.size() << " chaînes, " << nb_codes
+            << " codes, 3 bits " << octets_3bits << " o, flux " << octets_flux
+            << " o (x" << double(octets_3bits) / std::max<size_t>(octets_flux, 1)
+            << ", " << 8. * octets_flux / nb_codes << " bits/code), archive "
+            << a.octets() << " o\n        encodage " << ms_enc
+            << " ms, décodage " << ms_dec << " ms soit "
+            << nb_codes / (ms_dec * 1e6) << " Gcodes/s" << std::endl;
+}
+
+bool images_identiques (const cv::Mat &a, const cv::Mat &b)
+{
+  if (a.size() != b.size() || a.type() != b.type()) return false;
+  size_t octets = a.cols * a.elemSize();
+  for (int y = 0; y < a.rows; y++)
+    if (memcmp (a.ptr<uchar>(y), b.ptr<uchar>(y), octets) != 0) return false;
+  return true;
+}
+
+// Le cache -ctr ne doit pas changer l'affichage : les étapes E_SUIVI et
+// E_POLY sont calculées une fois en écrivant le fichier (suivi), une fois en
+// le relisant, et doivent donner les mêmes images.
+bool verifier_cache_contours_bench (const ParamsBench &pb,
+    const std::vector<std::pair<std::string, cv::Mat>> &entrees)
+{
+  std::string nom = pb.prefixe + "_verif.ctr";
+  bool ok = true;
+  for (auto &e : entrees) {
+    cv::Mat img_gry, img_src;
+    e.second.convertTo (img_gry, CV_8UC1);
+    cv::cvtColor (img_gry, img_src, cv::COLOR_GRAY2BGR);
+    cv::Mat res[2][2];
+    unlink (nom.c_str());
+    glob_fichier_contours = nom.c_str();
+    for (int k = 0; k < 2; k++) {     // 0 : suivi et écriture, 1 : relecture
+      My my;
+      my.img_src = img_src;
+      my.seuil = pb.seuil;
+      my.seuil_pol = pb.seuil_pol;
+      res[k][0] = obtenir_etape (my, E_SUIVI).img;
+      res[k][1] = obtenir_etape (my, E_POLY).img;
+    }
+    glob_fichier_contours = NULL;
+    unlink (nom.c_str());
+    for (int j = 0; j < 2; j++)
+      if (!images_identiques (res[0][j], res[1][j])) {
+        std::cerr << "Cache -ctr : " << e.first << (j ? " E_POLY" : " E_SUIVI")
+                  << " diffère après relecture du fichier" << std::endl;
+        ok = false;
+      }
+  }
+  if (ok) std::cerr << "Cache -ctr : " << entrees.size()
+                    << " images, E_SUIVI et E_POLY identiques après relecture"
+                    << std::endl;
+  return ok;
+}
+
+// Arbres des composantes sur les images en gris : construction, puis les
+// composantes des 256 seuils lues dans l'arbre, et les courbes d'Euler
+// face aux 256 seuillages suivis de numeroter_contours_c8 qu'elles
+// remplacent
+void bilan_arbre_bench (const ParamsBench &pb)
+{
+  for (const std::string &nom : pb.images) {
+    cv::Mat img_src = cv::imread (nom, cv::IMREAD_COLOR);
+    if (img_src.empty()) continue;
+    cv::Mat img_gry;
+    cv::cvtColor (img_src, img_gry, cv::COLOR_BGR2GRAY);
+
+    ArbreComposantes a;
+    int64 t0 = cv::getTickCount();
+    construire_arbre_composantes (img_gry, 8, false, a);
+    int64 t1 = cv::getTickCount();
+    size_t total = 0;
+    for (int s = 0; s < 256; s++) total += composantes_au_seuil (a, s).size();
+    int64 t2 = cv::getTickCount();
+
+    CourbesEuler c = calculer_courbes_euler (img_gry, &a);
+    int64 t3 = cv::getTickCount();
+    for (int s = 0; s < 256; s++) {
+      cv::Mat img_bin, img_niv;
+      cv::threshold (img_gry, img_bin, s, 255, cv::THRESH_BINARY);
+      img_bin.convertTo (img_niv, CV_32SC1, 1., 0.);
+      numeroter_contours_c8 (img_niv);
+    }
+    int64 t4 = cv::getTickCount();
+
+    double f = 1000. / cv::getTickFrequency();
+    std::cerr << "Arbre : " << nom << " " << img_gry.cols << "x" << img_gry.rows
+              << ", " << a.nombre() << " nœuds, construction " << (t1 - t0) * f
+              << " ms, 256 seuils " << (t2 - t1) * f << " ms ("
+              << total << " composantes)\n        courbes d'Euler "
+              << (t3 - t2) * f << " ms (seuil " << pb.seuil << " : "
+              << c.composantes[pb.seuil] << " composantes, " << c.trous[pb.seuil]
+              << " trous), 256 numérotations " << (t4 - t3) * f << " ms" << std::endl;
+  }
+}
+
+int effectuer_bench (const ParamsBench &pb)
+{
+    std::vector<std::pair<std::string, cv::Mat>> entrees;
+    for (const std::string &nom : pb.images) {
+        cv::Mat img_src = cv::imread (nom, cv::IMREAD_COLOR);
+        if (img_src.empty()) {
+            std::cerr << "Ignoré : " << nom << std::endl;
+            continue;
+        }
+        entrees.push_back ({ nom, binariser_bench (img_src, pb.seuil) });
+    }
+    if (entrees.empty()) {
+        std::cerr << "Aucune image lisible" << std::endl;
+        return 1;
+    }
+    size_t nb_corpus = entrees.size();
+    auto synth = images_synthetiques_bench (entrees[0].first,
+        entrees[0].second, pb.mpix_max);
+    entrees.insert (entrees.end(), synth.begin(), synth.end());
+
+    glob_nb_threads_couleurs = 1;
+    glob_fichier_contours = NULL;
+    std::vector<ContourF8> contours;
+    std::vector<CasBench> cas = lister_cas_bench (pb, contours);
+    std::vector<ResultatBench> res;
+
+    // Transformations bavardes : std::cout muet pendant les mesures
+    std::streambuf *cout_buf = std::cout.rdbuf (NULL);
+    for (auto &e : entrees)
+    for (const CasBench &c : cas) {
+        if (c.nom.find (pb.filtre) == std::string::npos) continue;
+        res.push_back (mesurer_cas_bench (pb, c, e.first, e.second));
+        std::cerr << e.first << " " << c.nom << " : " << res.back().ms_med
+                  << " ms" << std::endl;
+    }
+    if (std::string ("codec").find (pb.filtre) != std::string::npos)
+      bilan_codec_bench (pb, std::vector<std::pair<std::string, cv::Mat>> (
+          entrees.begin(), entrees.begin() + nb_corpus));
+    if (std::string ("arbre").find (pb.filtre) != std::string::npos)
+      bilan_arbre_bench (pb);
+    bool cache_ok = true;
+    if (std::string ("cache_contours").find (pb.filtre) != std::string::npos)
+      cache_ok = verifier_cache_contours_bench (pb,
+          std::vector<std::pair<std::string, cv::Mat>> (
+              entrees.begin(), entrees.begin() + nb_corpus));
+    std::cout.rdbuf (cout_buf);
+
+    ecrire_resultats_bench (pb, res);
+    return cache_ok ? 0 : 1;
+}
+
+int main_bench (int argc, char**argv)
+{
+    ParamsBench pb;
+    char *nom_prog = argv[0];
+    auto usage = [nom_prog] () {
+        std::cerr << "Usage: " << nom_prog << " [-thr seuil] [-pol seuil_pol]"
+                  << " [-w chauffe] [-r repet] [-mpix max] [-cas filtre]"
+                  << " [-tag etiquette] [-o prefixe] [in1|dossier|liste.txt ...]"
+                  << "\n  par défaut ../IMAGES" << std::endl;
+        return 1;
+    };
+
+    while (argc-1 > 0 && argv[1][0] == '-') {
+        if (argc-1 < 2) return usage();
+        std::string opt = argv[1];
+        if      (opt == "-thr")  pb.seuil      = atoi(argv[2]);
+        else if (opt == "-pol")  pb.seuil_pol  = atoi(argv[2]);
+        else if (opt == "-w")    pb.nb_chauffe = atoi(argv[2]);
+        else if (opt == "-r")    pb.nb_repet   = std::max (atoi(argv[2]), 1);
+        else if (opt == "-mpix") pb.mpix_max   = atoi(argv[2]);
+        else if (opt == "-cas")  pb.filtre     = argv[2];
+        else if (opt == "-tag")  pb.etiquette  = argv[2];
+        else if (opt == "-o")    pb.prefixe    = argv[2];
+        else return usage();
+        argc -= 2; argv += 2;
+    }
+    for (int k = 1; k < argc; k++)
+        lister_images (argv[k], pb.images);
+    if (pb.images.empty())
+        lister_images ("../IMAGES", pb.images);
+    return effectuer_bench (pb);
+}
+
+
 //---------------------------------- M A I N ----------------------------------
 
 void afficher_usage (char *nom_prog) {
     std::cout << "Usage: " << nom_prog
-              << "[-mag width height] [-thr seuil] in1 [out2]"
+              << "[-mag width height] [-thr seuil] [-ctr contours.gdc]"
+              << " [-cache Mo] in1 [out2]\n"
+              << "       " << nom_prog
+              << " -batch touche dossier_out [-j threads] [-thr seuil]"
+              << " [-pol seuil_pol] in1|dossier|liste.txt ..."
+              << "\n       " << nom_prog
+              << " -video touche entree sortie [-thr seuil] [-pol seuil_pol]"
+              << "\n         (entree, sortie : vidéo ou motif printf trame_%04d.png)"
               << std::endl;
 }
 
 int main (int argc, char**argv)
 {
+#ifdef BENCHMARK
+    return main_bench (argc, argv);
+#endif
     My my;
+    ParamsBatch pb;
+    ParamsSequence ps;
     char *nom_in1, *nom_out2, *nom_prog = argv[0];
     int zoom_w = 600, zoom_h = 500;
 
@@ -1573,8 +5013,56 @@ int main (int argc, char**argv)
             if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
             my.seuil = atoi(argv[2]);
             argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-ctr")) {
+            if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+            glob_fichier_contours = argv[2];
+            argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-cache")) {
+            if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+            my.cache.fixer_budget (size_t(atoi(argv[2])) << 20);
+            argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-pol")) {
+            if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+            my.seuil_pol = atoi(argv[2]);
+            argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-j")) {
+            if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+            pb.nb_threads = atoi(argv[2]);
+            argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-batch")) {
+            if (argc-1 < 3 || !affi_depuis_touche(argv[2][0], &pb.affi))
+                { afficher_usage(nom_prog); return 1; }
+            pb.touche = argv[2][0];
+            pb.dossier_sortie = argv[3];
+            argc -= 3; argv += 3;
+        } else if (!strcmp(argv[1], "-video")) {
+            if (argc-1 < 4 || !affi_depuis_touche(argv[2][0], &ps.affi))
+                { afficher_usage(nom_prog); return 1; }
+            ps.touche = argv[2][0];
+            ps.entree = argv[3];
+            ps.sortie = argv[4];
+            argc -= 4; argv += 4;
         } else break;
     }
+
+    if (ps.entree) {
+        if (argc-1 > 0) { afficher_usage(nom_prog); return 1; }
+        ps.seuil = my.seuil;
+        ps.seuil_pol = my.seuil_pol;
+        glob_fichier_contours = NULL;
+        return effectuer_sequence (ps);
+    }
+
+    if (pb.dossier_sortie) {
+        if (argc-1 < 1) { afficher_usage(nom_prog); return 1; }
+        for (int k = 1; k < argc; k++)
+            lister_images (argv[k], pb.images);
+        pb.seuil = my.seuil;
+        pb.seuil_pol = my.seuil_pol;
+        glob_fichier_contours = NULL;  // cache non partageable entre threads
+        return effectuer_batch (pb);
+    }
+
     if (argc-1 < 1 or argc-1 > 2) { afficher_usage(nom_prog); return 1; }
     nom_in1  = argv[1];
     nom_out2 = (argc-1 == 2) ? argv[2] : NULL;
@@ -1590,7 +5078,7 @@ int main (int argc, char**argv)
     my.img_res1 = cv::Mat(my.img_src.rows, my.img_src.cols, CV_8UC3);
     my.img_res2 = cv::Mat(zoom_h, zoom_w, CV_8UC3);
     my.img_niv  = cv::Mat(my.img_src.rows, my.img_src.cols, CV_32SC1);
-    my.img_coul = cv::Mat(my.img_src.rows, my.img_src.cols, CV_8UC3);
+    my.img_coul = my.img_src.clone();
     my.loupe.reborner(my.img_res1, my.img_res2);
 
     // Création fenêtre
@@ -1606,25 +5094,28 @@ int main (int argc, char**argv)
     cv::namedWindow ("Loupe", cv::WINDOW_AUTOSIZE);
     afficher_aide();
 
+    CalculFond calcul;
+    calcul.demarrer (my.cache.limite());
+
     // Boucle d'événements
     for (;;) {
 
-        if (my.need_recalc(My::R_SEUIL))
+        if (my.need_recalc(My::R_TRANSFOS))
         {
-            // std::cout << "Calcul seuil" << std::endl;
-            cv::Mat img_gry;
-            cv::cvtColor (my.img_src, img_gry, cv::COLOR_BGR2GRAY);
-            cv::threshold (img_gry, img_gry, my.seuil, 255, cv::THRESH_BINARY);
-            img_gry.convertTo (my.img_niv, CV_32SC1,1., 0.);
+            // Demande au fil de calcul ; l'affichage garde l'image précédente
+            // jusqu'à ce que la nouvelle soit prête
+            calcul.demander (my);
+            my.mesures_demandees = false;
         }
 
-        if (my.need_recalc(My::R_TRANSFOS))
+        if (calcul.recuperer (my))
         {
-            // std::cout << "Calcul transfos" << std::endl;
-            if (my.affi != My::A_ORIG) {
-                effectuer_transformations (my.affi, my.img_niv,my.seuil_pol);
-                representer_en_couleurs_vga (my.img_niv, my.img_coul);
-            } else my.img_coul = my.img_src.clone();
+            my.loupe.invalider();
+            my.set_recalc(My::R_LOUPE);
+            if (my.clic_index_x >= 0 && index_a_jour (my)) {
+                repondre_clic_index (&my, my.clic_index_x, my.clic_index_y);
+                my.clic_index_x = my.clic_index_y = -1;
+            }
         }
 
         if (my.need_recalc(My::R_LOUPE)) {
@@ -1645,6 +5136,7 @@ int main (int argc, char**argv)
         // appelées par waitKey lors de l'attente.
         if (onKeyPressEvent (key, &my) < 0) break;
     }
+    calcul.arreter();
 
     // Enregistrement résultat
     if (nom_out2) {
@@ -19,6 +19,7 @@
 #include <iostream>
 #include <iomanip>
 #include <cstring>
+#include <climits>
 #include <opencv2/opencv.hpp>
 
 
@@ -191,40 +192,40 @@ class Ponderation
     int x,y;
     int w;
 };
+
+// Demi-masque du catalogue. Les pondérations sont celles du balayage arrière :
+// (y > 0) ou (y == 0 et x > 0). On manipule les demi-masques par des
+// poignées const DemiMasque * vers le catalogue, sans allocation.
+const int MAX_PONDERATIONS = 24;                 // demi-masque 7x7
+
 class DemiMasque
 {
   public :
-    DemiMasque(NumeroMasque m);
-    std::vector<Ponderation> list_pond;
-    unsigned int size;
     NumeroMasque num_masque;
-    float distance;
-    std::string name;
+    unsigned int size;
+    Ponderation list_pond[MAX_PONDERATIONS];
+    const char *name;
+
+    const Ponderation *begin () const { return list_pond; }
+    const Ponderation *end ()   const { return list_pond + size; }
+};
+
+// Catalogue connu à la compilation, dans l'ordre de NumeroMasque. Pour un
+// masque utilisateur : rajouter sa constante avant M_LAST et sa ligne ici.
+constexpr DemiMasque catalogue_masques[] = {
+  { M_D4,     2, { {1,0,1}, {0,1,1} }, "M_D4" },
+  { M_D8,     4, { {1,0,1}, {-1,1,1}, {0,1,1}, {1,1,1} }, "M_D8" },
+  { M_2_3,    4, { {1,0,2}, {-1,1,3}, {0,1,2}, {1,1,3} }, "M_2_3" },
+  { M_3_4,    4, { {1,0,3}, {-1,1,4}, {0,1,3}, {1,1,4} }, "M_3_4" },
+  { M_5_7_11, 8, { {1,0,5}, {-2,1,11}, {-1,1,7}, {0,1,5}, {1,1,7},
+                   {2,1,11}, {-1,2,11}, {1,2,11} }, "M_5_7_11" },
 };
+static_assert (sizeof(catalogue_masques) / sizeof(catalogue_masques[0]) == M_LAST,
+               "une ligne du catalogue par NumeroMasque");
 
-DemiMasque::DemiMasque(NumeroMasque m)
+inline const DemiMasque * demi_masque (NumeroMasque m)
 {
-  switch (m) {
-    case M_D4:
-      name = "N_D4";
-      break;
-    case M_D8:
-      name = "M_D8";
-      break;
-    case M_2_3:
-      name = "M_2_3";
-      break;
-    case M_3_4:
-      name = "M_3_4";
-      break;
-    case M_5_7_11:
-      name = "M_5_7_11";
-      break;
-    case M_LAST:
-      name = "M_LAST";
-      break;
-    default: name = "ERROR_NAME";
-  }
+  return &catalogue_masques[m];
 }
 //----------------------------------- M Y -------------------------------------
 
@@ -236,8 +237,8 @@ class My {
     int clic_x = 0;
     int clic_y = 0;
     int clic_n = 0;
-    NumeroMasque m_cour;
-    DemiMasque * dm_cour;
+    NumeroMasque m_cour = M_D4;
+    const DemiMasque * dm_cour = demi_masque (M_D4);
 
     enum Recalc { R_RIEN, R_LOUPE, R_TRANSFOS, R_SEUIL };
     Recalc recalc = R_SEUIL;
@@ -339,43 +340,42 @@ int min5(int value1,int value2,int value3,int value4,int value5)
   return min2(min3(value1,value2,value3),min3(value3,value4,value5));
 }
 
-void calculer_Rosenfeld_DT(cv::Mat img, DemiMasque * dm)
+// DT de Rosenfeld avec les pondérations du demi-masque : passage avant avec
+// le symétrique du demi-masque, passage arrière avec le demi-masque tel quel.
+// L'extérieur de l'image est du fond, comme dans la DT du TP6.
+void calculer_Rosenfeld_DT(cv::Mat img, const DemiMasque * dm)
 {
-  for (int y = 1; y < img.rows-1; y++)
-  for (int x = 1; x < img.cols-1; x++)
+  CHECK_MAT_TYPE(img, CV_32SC1)
+
+  for (int y = 0; y < img.rows; y++)
+  for (int x = 0; x < img.cols; x++)
   {
-    if(dm->num_masque == M_D4)
-    {
-      if(img.at<int>(y,x) != 0)
-      {
-        img.at<int>(y,x) = min2(img.at<int>(y-1,x)+1,img.at<int>(y,x-1)+1);
-      }
-    }
-    if(dm->num_masque == M_D8)
+    if (img.at<int>(y,x) == 0) continue;
+    int d = INT_MAX;
+    for (const Ponderation &p : *dm)
     {
-      if(img.at<int>(y,x) != 0)
-      {
-        img.at<int>(y,x) = min4(img.at<int>(y-1,x)+1,img.at<int>(y,x-1)+1,img.at<int>(y-1,x-1),img.at<int>(y+1,x-1)+1);
-      }
+      int xv = x - p.x, yv = y - p.y;
+      if (xv < 0 || xv >= img.cols || yv < 0)
+        d = min2(d, p.w);
+      else
+        d = min2(d, img.at<int>(yv,xv) + p.w);
     }
+    img.at<int>(y,x) = d;
   }
-  for (int y = img.rows-2; y > 0; y--)
-  for (int x = img.cols-2; x > 0; x--)
+  for (int y = img.rows-1; y >= 0; y--)
+  for (int x = img.cols-1; x >= 0; x--)
   {
-    if(dm->num_masque == M_D4)
+    if (img.at<int>(y,x) == 0) continue;
+    int d = img.at<int>(y,x);
+    for (const Ponderation &p : *dm)
     {
-      if(img.at<int>(y,x) != 0)
-      {
-        img.at<int>(y,x) = min3(img.at<int>(y,x),img.at<int>(y+1,x)+1,img.at<int>(y,x+1)+1);
-      }
-    }
-    if(dm->num_masque == M_D8)
-    {
-      if(img.at<int>(y,x) != 0)
-      {
-        img.at<int>(y,x) = min5(img.at<int>(y,x),img.at<int>(y+1,x)+1,img.at<int>(y,x+1)+1,img.at<int>(y+1,x+1),img.at<int>(y-1,x+1)+1);
-      }
+      int xv = x + p.x, yv = y + p.y;
+      if (xv < 0 || xv >= img.cols || yv >= img.rows)
+        d = min2(d, p.w);
+      else
+        d = min2(d, img.at<int>(yv,xv) + p.w);
     }
+    img.at<int>(y,x) = d;
   }
 }
 int max2(int value1,int value2)
@@ -403,38 +403,45 @@ int max5(int value1,int value2,int value3,int value4,int value5)
 
   return max2(max3(value1,value2,value3),max3(value3,value4,value5));
 }
-void calculer_Rosenfeld_RDT(cv::Mat img, int connexite)
+// RDT avec le même demi-masque que la DT, pondérations quelconques jusqu'au
+// 7x7 : R(p) = max sur c de img(c) - d(c,p). Passage avant avec le symétrique
+// du demi-masque, passage arrière avec le demi-masque ; rien ne vient de
+// l'extérieur de l'image.
+void calculer_Rosenfeld_RDT(cv::Mat img, const DemiMasque * dm)
 {
-  int a = 5;
-  int b = 7;
-  for (int y = 1; y < img.rows-1; y++)
-  for (int x = 1; x < img.cols-1; x++)
+  for (int y = 0; y < img.rows; y++)
+  for (int x = 0; x < img.cols; x++)
   {
-    if(img.at<int>(y,x)!=0)
+    int r = img.at<int>(y,x);
+    for (const Ponderation &p : *dm)
     {
-      img.at<int>(y,x) =
-      max4(img.at<int>(y,x-1)-a,img.at<int>(y-1,x)-a,img.at<int>(y-1,x-1)-b,img.at<int>(y-1,x+1)-b);
+      int xv = x - p.x, yv = y - p.y;
+      if (xv >= 0 && xv < img.cols && yv >= 0)
+        r = max2(r, img.at<int>(yv,xv) - p.w);
     }
+    img.at<int>(y,x) = r;
   }
-  for (int y = img.rows-2; y > 0; y--)
-  for (int x = img.cols-2; x > 0; x--)
+  for (int y = img.rows-1; y >= 0; y--)
+  for (int x = img.cols-1; x >= 0; x--)
   {
-    if(img.at<int>(y,x)!=0)
+    int r = img.at<int>(y,x);
+    for (const Ponderation &p : *dm)
     {
-      img.at<int>(y,x) =
-      max5(img.at<int>(y,x),img.at<int>(y,x+1)-a,img.at<int>(y+1,x)-a,
-      img.at<int>(y+1,x+1)-b,img.at<int>(y+1,x-1)-b);
+      int xv = x + p.x, yv = y + p.y;
+      if (xv >= 0 && xv < img.cols && yv < img.rows)
+        r = max2(r, img.at<int>(yv,xv) - p.w);
     }
+    img.at<int>(y,x) = r;
   }
 }
-std::vector<int> detecter_maximum_locaux(cv::Mat img,DemiMasque * dm)
+std::vector<int> detecter_maximum_locaux(cv::Mat img,const DemiMasque * dm)
 {
   cv::Mat copy = img.clone();
   /*abs(((x2-x1)*(yc-y1) - (y2-y1)*(xc-x1)))
   / sqrt((x2 - x1)*(x2 - x1) + (y2 - y1)*(y2 - y1));*/
 }
 // Appelez ici vos transformations selon affi
-void effectuer_transformations (My::Affi affi, cv::Mat img_niv, DemiMasque * dm)
+void effectuer_transformations (My::Affi affi, cv::Mat img_niv, const DemiMasque * dm)
 {
     switch (affi) {
         case My::A_TRANS1 :
@@ -447,7 +454,7 @@ void effectuer_transformations (My::Affi affi, cv::Mat img_niv, DemiMasque * dm)
         case My::A_TRANS3 :
         calculer_Rosenfeld_DT(img_niv,dm);
         //max locaux
-        calculer_Rosenfeld_RDT(img_niv,4);
+        calculer_Rosenfeld_RDT(img_niv,dm);
             //transformer_bandes_diagonales (img_niv);
             break;
         default : ;
@@ -592,31 +599,8 @@ int onKeyPressEvent (int key, void *data)
             my->set_recalc(My::R_SEUIL);
             break;
         case 'd':
-            switch (my->m_cour)
-            {
-              case M_D4:
-              my->m_cour = M_D8;
-              break;
-              case M_D8:
-              my->m_cour = M_2_3;
-              break;
-              case M_2_3:
-              my->m_cour = M_3_4;
-              break;
-              case M_3_4:
-              my->m_cour = M_5_7_11;
-              break;
-              case M_5_7_11:
-              my->m_cour = M_LAST;
-              break;
-              case M_LAST:
-              my->m_cour = M_D4;
-              break;
-              default:
-              my->m_cour = M_D4;
-            }
-
-            my->dm_cour = new DemiMasque(my->m_cour);
+            my->m_cour = NumeroMasque ((my->m_cour + 1) % M_LAST);
+            my->dm_cour = demi_masque (my->m_cour);
 
             std::cout<<"MASQUE : "<<my->dm_cour->name<<std::endl;
             my->set_recalc(My::R_SEUIL);
@@ -716,8 +700,6 @@ int main (int argc, char**argv)
             cv::imshow ("Loupe"   , my.img_res2);
         }
         my.reset_recalc();
-        my.dm_cour = new DemiMasque(M_D4);
-        //my.m_cour = M_D4;
 
         // Attente du prochain événement sur toutes les fenêtres, avec un
         // timeout de 15ms pour détecter les changements de flags
@@ -19,6 +19,28 @@
 #include <iostream>
 #include <iomanip>
 #include <cstring>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <tuple>
+#include <array>
+#include <utility>
+#include <queue>
+#include <functional>
+#include <exception>
+#include <climits>
+#include <cstdint>
+#include <limits>
+#include <dirent.h>
+#include <sys/resource.h>
 #include <opencv2/opencv.hpp>
 
 
@@ -29,6 +51,25 @@
             "' pour la matrice '" # mat "'");
 
 
+//---------------------------- A N N U L A T I O N ----------------------------
+
+// Annulation coopérative des calculs du fil de fond : les boucles longues
+// appellent verifier_annulation() à chaque ligne, qui lève Annulation dès
+// qu'une demande plus récente est arrivée. Sans effet dans les autres fils.
+
+struct Annulation {};
+
+thread_local const std::atomic<unsigned> *glob_derniere_demande = NULL;
+thread_local unsigned glob_demande_en_cours = 0;
+
+inline void verifier_annulation ()
+{
+    if (glob_derniere_demande && glob_derniere_demande->load
+            (std::memory_order_relaxed) != glob_demande_en_cours)
+        throw Annulation();
+}
+
+
 //--------------------------------- L O U P E ---------------------------------
 
 class Loupe {
@@ -71,38 +112,67 @@ class Loupe {
         reborner (res1, res2);
     }
 
+    // À appeler quand l'image représentée (img_coul) a été recalculée :
+    // le prochain rendu sera complet.
+    void invalider ()
+    {
+        rect_valide = false;
+        portion_valide = false;
+    }
+
     void dessiner_rect (cv::Mat &src, cv::Mat &dest)
     {
-        dest = src.clone();
+        CHECK_MAT_TYPE(src, CV_8UC3)
+
+        // On ne recopie src entièrement que si elle a changé ; sinon on efface
+        // seulement l'ancien rectangle en restaurant ses bords depuis src.
+        if (!rect_valide || dest.data == src.data || dest.rows != src.rows
+            || dest.cols != src.cols || dest.type() != src.type()) {
+            if (dest.data == src.data) dest = cv::Mat();
+            src.copyTo (dest);
+            rect_valide = true;
+        } else if (rect_dessine) {
+            restaurer_cadre (src, dest, rect_x0, rect_y0, rect_x1, rect_y1);
+        }
+
+        rect_dessine = false;
         if (zoom == 0) return;
         cv::Point p0 = cv::Point(zoom_x0, zoom_y0),
                   p1 = cv::Point(zoom_x1, zoom_y1);
         cv::rectangle(dest, p0, p1, cv::Scalar (255, 255, 255), 3, 4);
         cv::rectangle(dest, p0, p1, cv::Scalar (  0,   0, 255), 1, 4);
+        rect_dessine = true;
+        rect_x0 = zoom_x0; rect_y0 = zoom_y0;
+        rect_x1 = zoom_x1; rect_y1 = zoom_y1;
     }
 
     void dessiner_portion (cv::Mat &src, cv::Mat &dest)
     {
         CHECK_MAT_TYPE(src, CV_8UC3)
+        CHECK_MAT_TYPE(dest, CV_8UC3)
 
         int bon_zoom = zoom >= 1 ? zoom : 1;
-
-        for (int y = 0; y < dest.rows; y++)
-        for (int x = 0; x < dest.cols; x++)
-        {
-            int x0 = zoom_x0 + x / bon_zoom;
-            int y0 = zoom_y0 + y / bon_zoom;
-
-            if (x0 < 0 || x0 >= src.cols || y0 < 0 || y0 >= src.rows) {
-                dest.at<cv::Vec3b>(y,x)[0] = 64;
-                dest.at<cv::Vec3b>(y,x)[1] = 64;
-                dest.at<cv::Vec3b>(y,x)[2] = 64;
-                continue;
-            }
-            dest.at<cv::Vec3b>(y,x)[0] = src.at<cv::Vec3b>(y0,x0)[0];
-            dest.at<cv::Vec3b>(y,x)[1] = src.at<cv::Vec3b>(y0,x0)[1];
-            dest.at<cv::Vec3b>(y,x)[2] = src.at<cv::Vec3b>(y0,x0)[2];
+        int sx = (zoom_x0 - port_x0) * bon_zoom,
+            sy = (zoom_y0 - port_y0) * bon_zoom;
+
+        if (!portion_valide || dest.data != port_data || bon_zoom != port_zoom
+            || abs(sx) >= dest.cols || abs(sy) >= dest.rows) {
+            rendre_zone (src, dest, 0, dest.cols, 0, dest.rows);
+        } else if (sx != 0 || sy != 0) {
+            // Déplacement : on décale ce qui est déjà rendu, puis on ne rend
+            // que les bandes nouvellement découvertes.
+            decaler (dest, sx, sy);
+            int ya = sy > 0 ? 0 : -sy, yb = sy > 0 ? dest.rows - sy : dest.rows;
+            if (sy > 0) rendre_zone (src, dest, 0, dest.cols, yb, dest.rows);
+            if (sy < 0) rendre_zone (src, dest, 0, dest.cols, 0, ya);
+            if (sx > 0) rendre_zone (src, dest, dest.cols - sx, dest.cols, ya, yb);
+            if (sx < 0) rendre_zone (src, dest, 0, -sx, ya, yb);
         }
+
+        portion_valide = true;
+        port_data = dest.data;
+        port_zoom = bon_zoom;
+        port_x0 = zoom_x0; port_y0 = zoom_y0;
     }
 
     void afficher_tableau_valeurs (cv::Mat &src, int ex, int ey, int rx, int ry)
@@ -140,17 +210,113 @@ class Loupe {
         }
         std::cout << std::endl;
     }
+
+  private :
+    bool rect_valide = false, rect_dessine = false;
+    int rect_x0 = 0, rect_y0 = 0, rect_x1 = 0, rect_y1 = 0;
+    bool portion_valide = false;
+    const unsigned char *port_data = NULL;
+    int port_zoom = 0, port_x0 = 0, port_y0 = 0;
+
+    // Recopie de src dans dest les bandes couvertes par le cadre dessiné par
+    // dessiner_rect (épaisseur 3 autour de chaque côté).
+    static void restaurer_cadre (cv::Mat &src, cv::Mat &dest,
+                                 int x0, int y0, int x1, int y1)
+    {
+        restaurer_zone (src, dest, x0-2, x1+3, y0-2, y0+3);
+        restaurer_zone (src, dest, x0-2, x1+3, y1-2, y1+3);
+        restaurer_zone (src, dest, x0-2, x0+3, y0-2, y1+3);
+        restaurer_zone (src, dest, x1-2, x1+3, y0-2, y1+3);
+    }
+
+    static void restaurer_zone (cv::Mat &src, cv::Mat &dest,
+                                int xa, int xb, int ya, int yb)
+    {
+        xa = std::max(xa, 0); xb = std::min(xb, src.cols);
+        ya = std::max(ya, 0); yb = std::min(yb, src.rows);
+        if (xa >= xb) return;
+        for (int y = ya; y < yb; y++)
+            memcpy (dest.ptr<unsigned char>(y) + 3*xa,
+                    src.ptr<unsigned char>(y) + 3*xa, 3*(xb-xa));
+    }
+
+    // Décale le contenu de dest : le pixel (x,y) reçoit l'ancien (x+sx,y+sy).
+    static void decaler (cv::Mat &dest, int sx, int sy)
+    {
+        int xa = std::max(0, -sx), xb = std::min(dest.cols, dest.cols - sx);
+        int n = 3*(xb-xa);
+        if (sy > 0 || (sy == 0 && sx > 0)) {
+            for (int y = std::max(0, -sy); y < std::min(dest.rows, dest.rows - sy); y++)
+                memmove (dest.ptr<unsigned char>(y) + 3*xa,
+                         dest.ptr<unsigned char>(y+sy) + 3*(xa+sx), n);
+        } else {
+            for (int y = std::min(dest.rows, dest.rows - sy) - 1; y >= std::max(0, -sy); y--)
+                memmove (dest.ptr<unsigned char>(y) + 3*xa,
+                         dest.ptr<unsigned char>(y+sy) + 3*(xa+sx), n);
+        }
+    }
+
+    // Rend les colonnes [xa,xb[ et les lignes [ya,yb[ de dest : chaque pixel
+    // source est dupliqué bon_zoom fois dans la ligne, puis la première ligne
+    // de chaque groupe est recopiée sur les bon_zoom-1 suivantes.
+    void rendre_zone (cv::Mat &src, cv::Mat &dest, int xa, int xb, int ya, int yb)
+    {
+        int bon_zoom = zoom >= 1 ? zoom : 1;
+        int n = 3*(xb-xa);
+        if (n <= 0) return;
+
+        for (int y = ya; y < yb; ) {
+            int y0 = zoom_y0 + y / bon_zoom;
+            int y_fin = std::min(yb, (y / bon_zoom + 1) * bon_zoom);
+            unsigned char *d = dest.ptr<unsigned char>(y) + 3*xa;
+
+            if (y0 < 0 || y0 >= src.rows) memset (d, 64, n);
+            else {
+                const unsigned char *s = src.ptr<unsigned char>(y0);
+                for (int x = xa; x < xb; ) {
+                    int x0 = zoom_x0 + x / bon_zoom;
+                    int x_fin = std::min(xb, (x / bon_zoom + 1) * bon_zoom);
+                    int k = x_fin - x;
+                    if (x0 < 0 || x0 >= src.cols) memset (d, 64, 3*k);
+                    else {
+                        unsigned char b = s[3*x0], g = s[3*x0+1], r = s[3*x0+2];
+                        for (int i = 0; i < k; i++) {
+                            d[3*i] = b; d[3*i+1] = g; d[3*i+2] = r;
+                        }
+                    }
+                    d += 3*k;
+                    x = x_fin;
+                }
+            }
+            const unsigned char *ligne = dest.ptr<unsigned char>(y) + 3*xa;
+            for (int yy = y+1; yy < y_fin; yy++)
+                memcpy (dest.ptr<unsigned char>(yy) + 3*xa, ligne, n);
+            y = y_fin;
+        }
+    }
 };
 
 
 //----------------------- C O U L E U R S   V G A -----------------------------
 
-void representer_en_couleurs_vga (cv::Mat img_niv, cv::Mat img_coul)
+// Nombre de threads pour la mise en couleurs (0 : nombre de coeurs). Le batch
+// le met à 1, ses images étant déjà traitées en parallèle.
+int glob_nb_threads_couleurs = 0;
+
+// Palette VGA en B, G, R indexée par le niveau décalé de LUT_VGA_DECALAGE,
+// pour éviter modulo et abs sur les niveaux courants (labels, distances).
+const int LUT_VGA_TAILLE = 4096, LUT_VGA_DECALAGE = 1024;
+
+int numero_couleur_vga (int g)
 {
-    CHECK_MAT_TYPE(img_niv, CV_32SC1)
-    CHECK_MAT_TYPE(img_coul, CV_8UC3)
+    if (g == 255) return 15;                       // seul 255 est blanc
+    if (g != 0) return 1 + abs(g-1) % 14;          // seul 0 est noir
+    return 0;
+}
 
-    unsigned char couls[16][3] = {  // R, G, B
+const unsigned char (*palette_vga ())[3]
+{
+    static const unsigned char couls[16][3] = {  // R, G, B
         {   0,   0,   0 },   //  0  black           ->  0 uniquement
         {  20,  20, 190 },   //  1  blue            ->  1, 15, 29, ...
         {  30, 200,  30 },   //  2  green           ->  2, 16, 30, ...
@@ -168,20 +334,60 @@ void representer_en_couleurs_vga (cv::Mat img_niv, cv::Mat img_coul)
         { 252, 252,  84 },   // 14  yellow          -> 14, 28, 42, ...
         { 252, 252, 252 },   // 15  white           -> 255 uniquement
     };
+    // Attention img_coul est en B, G, R -> inverser les canaux
+    static unsigned char lut[LUT_VGA_TAILLE + 16][3];
+    static bool init = [] () {
+        for (int i = 0; i < LUT_VGA_TAILLE + 16; i++) {
+            int c = i < LUT_VGA_TAILLE ? numero_couleur_vga (i - LUT_VGA_DECALAGE)
+                                       : i - LUT_VGA_TAILLE;
+            lut[i][0] = couls[c][2];
+            lut[i][1] = couls[c][1];
+            lut[i][2] = couls[c][0];
+        }
+        return true;
+    } ();
+    (void) init;
+    return lut;
+}
 
-    for (int y = 0; y < img_niv.rows; y++)
-    for (int x = 0; x < img_niv.cols; x++)
+void representer_lignes_vga (cv::Mat &img_niv, cv::Mat &img_coul, int y0, int y1)
+{
+    const unsigned char (*lut)[3] = palette_vga();
+
+    for (int y = y0; y < y1; y++)
     {
-        int g = img_niv.at<int>(y,x), c = 0;
-        if (g == 255) c = 15;                      // seul 255 est blanc
-        else if (g != 0) c = 1 + abs(g-1) % 14;    // seul 0 est noir
-        // Attention img_coul est en B, G, R -> inverser les canaux
-        img_coul.at<cv::Vec3b>(y,x)[0] = couls[c][2];
-        img_coul.at<cv::Vec3b>(y,x)[1] = couls[c][1];
-        img_coul.at<cv::Vec3b>(y,x)[2] = couls[c][0];
+        const int *s = img_niv.ptr<int>(y);
+        unsigned char *d = img_coul.ptr<unsigned char>(y);
+        for (int x = 0; x < img_niv.cols; x++, d += 3)
+        {
+            unsigned i = unsigned(s[x] + LUT_VGA_DECALAGE);
+            const unsigned char *c = i < unsigned(LUT_VGA_TAILLE) ? lut[i]
+                : lut[LUT_VGA_TAILLE + numero_couleur_vga (s[x])];
+            d[0] = c[0]; d[1] = c[1]; d[2] = c[2];
+        }
     }
 }
 
+void representer_en_couleurs_vga (cv::Mat img_niv, cv::Mat img_coul)
+{
+    CHECK_MAT_TYPE(img_niv, CV_32SC1)
+    CHECK_MAT_TYPE(img_coul, CV_8UC3)
+
+    // En parallèle par bandes de lignes sur les grandes images
+    int nb_threads = glob_nb_threads_couleurs;
+    if (nb_threads <= 0) nb_threads = std::thread::hardware_concurrency();
+    if (nb_threads <= 0 || img_niv.total() < (1 << 18)) nb_threads = 1;
+    nb_threads = std::min(nb_threads, img_niv.rows);
+
+    std::vector<std::thread> groupe;
+    for (int i = 1; i < nb_threads; i++)
+        groupe.emplace_back (representer_lignes_vga, std::ref(img_niv),
+                             std::ref(img_coul), img_niv.rows * i / nb_threads,
+                             img_niv.rows * (i+1) / nb_threads);
+    representer_lignes_vga (img_niv, img_coul, 0, img_niv.rows / nb_threads);
+    for (auto &t : groupe) t.join();
+}
+
 //---------------------------------MASQUE--------------------------------------
 enum NumeroMasque {M_D4, M_D8, M_2_3, M_3_4, M_5_7_11, M_LAST};
 
@@ -191,43 +397,175 @@ class Ponderation
     int x,y;
     int w;
 };
+
+// Demi-masque du catalogue. Les pondérations sont celles du balayage arrière :
+// (y > 0) ou (y == 0 et x > 0). On manipule les demi-masques par des
+// poignées const DemiMasque * vers le catalogue, sans allocation.
+const int MAX_PONDERATIONS = 24;                 // demi-masque 7x7
+
 class DemiMasque
 {
   public :
-    DemiMasque(NumeroMasque m);
-    std::vector<Ponderation> list_pond;
-    unsigned int size;
     NumeroMasque num_masque;
-    float distance;
-    std::string name;
+    unsigned int size;
+    Ponderation list_pond[MAX_PONDERATIONS];
+    const char *name;
+
+    const Ponderation *begin () const { return list_pond; }
+    const Ponderation *end ()   const { return list_pond + size; }
 };
 
-DemiMasque::DemiMasque(NumeroMasque m)
-{
-  switch (m) {
-    case M_D4:
-      name = "N_D4";
-      break;
-    case M_D8:
-      name = "M_D8";
-      break;
-    case M_2_3:
-      name = "M_2_3";
-      break;
-    case M_3_4:
-      name = "M_3_4";
-      break;
-    case M_5_7_11:
-      name = "M_5_7_11";
-      break;
-    case M_LAST:
-      name = "M_LAST";
-      break;
-    default: name = "ERROR_NAME";
-  }
+// Catalogue connu à la compilation, dans l'ordre de NumeroMasque. Pour un
+// masque utilisateur : rajouter sa constante avant M_LAST et sa ligne ici.
+constexpr DemiMasque catalogue_masques[] = {
+  { M_D4,     2, { {1,0,1}, {0,1,1} }, "M_D4" },
+  { M_D8,     4, { {1,0,1}, {-1,1,1}, {0,1,1}, {1,1,1} }, "M_D8" },
+  { M_2_3,    4, { {1,0,2}, {-1,1,3}, {0,1,2}, {1,1,3} }, "M_2_3" },
+  { M_3_4,    4, { {1,0,3}, {-1,1,4}, {0,1,3}, {1,1,4} }, "M_3_4" },
+  { M_5_7_11, 8, { {1,0,5}, {-2,1,11}, {-1,1,7}, {0,1,5}, {1,1,7},
+                   {2,1,11}, {-1,2,11}, {1,2,11} }, "M_5_7_11" },
+};
+static_assert (sizeof(catalogue_masques) / sizeof(catalogue_masques[0]) == M_LAST,
+               "une ligne du catalogue par NumeroMasque");
+
+inline const DemiMasque * demi_masque (NumeroMasque m)
+{
+  return &catalogue_masques[m];
 }
+//------------------------------- C A C H E -----------------------------------
+
+// Cache des résultats d'étapes (gris, binaire, DT, axe médian...), indexé par
+// l'étape, la version de l'image source, le seuil et le masque. Les entrées
+// les moins récemment utilisées sont libérées au-delà du budget mémoire.
+
+enum Etape { E_GRIS, E_BINAIRE, E_DT, E_MAXIMA, E_RDT, E_SEDT, E_COURBES,
+             E_EFT, E_DIST_OBJET };
+
+struct CleEtape
+{
+  int etape, version, seuil, masque;
+
+  bool operator< (const CleEtape &c) const
+  {
+    return std::tie(etape, version, seuil, masque)
+         < std::tie(c.etape, c.version, c.seuil, c.masque);
+  }
+};
+
+class CacheEtapes
+{
+  public :
+    // img partage ses données avec le cache : la cloner avant de la modifier
+    bool chercher (const CleEtape &cle, cv::Mat &img)
+    {
+      auto it = index.find(cle);
+      if (it == index.end()) return false;
+      lru.splice(lru.begin(), lru, it->second);
+      img = it->second->second;
+      return true;
+    }
+
+    // Retire l'entrée du cache pour la modifier en place
+    bool extraire (const CleEtape &cle, cv::Mat &img)
+    {
+      auto it = index.find(cle);
+      if (it == index.end()) return false;
+      img = it->second->second;
+      taille -= octets(img);
+      lru.erase(it->second);
+      index.erase(it);
+      return true;
+    }
+
+    void ranger (const CleEtape &cle, cv::Mat img)
+    {
+      size_t t = octets(img);
+      if (t > budget || index.count(cle)) return;
+      lru.emplace_front(cle, img);
+      index[cle] = lru.begin();
+      taille += t;
+      reduire();
+    }
+
+    void fixer_budget (size_t octets) { budget = octets; reduire(); }
+    size_t limite () const { return budget; }
+    void vider () { lru.clear(); index.clear(); taille = 0; }
+    size_t occupation () const { return taille; }
+
+  private :
+    size_t budget = size_t(256) << 20;           // en octets
+    typedef std::list<std::pair<CleEtape, cv::Mat>> Liste;
+    Liste lru;                                   // la plus récente en tête
+    std::map<CleEtape, Liste::iterator> index;
+    size_t taille = 0;
+
+    static size_t octets (const cv::Mat &img) { return img.total() * img.elemSize(); }
+
+    void reduire ()
+    {
+      while (taille > budget) {
+        taille -= octets(lru.back().second);
+        index.erase(lru.back().first);
+        lru.pop_back();
+      }
+    }
+};
+
+//---------------------------- I N D E X   G R I S ----------------------------
+
+// Positions des pixels triées par niveau de gris (tri par dénombrement),
+// construit une fois au chargement : les pixels de niveau g sont
+// pos[debut[g]] .. pos[debut[g+1]-1], en indice linéaire y*cols+x.
+class IndexNiveaux
+{
+  public :
+    int version = -1;             // version_src de l'image indexée
+    std::vector<int> debut, pos;
+
+    void construire (cv::Mat img_gry, int vers)
+    {
+      CHECK_MAT_TYPE(img_gry, CV_8UC1)
+      debut.assign (257, 0);
+      for (int y = 0; y < img_gry.rows; y++)
+      for (int x = 0; x < img_gry.cols; x++)
+        debut[img_gry.at<uchar>(y,x) + 1]++;
+      for (int g = 0; g < 256; g++) debut[g+1] += debut[g];
+
+      std::vector<int> suiv (debut.begin(), debut.end()-1);
+      pos.resize (img_gry.total());
+      for (int y = 0; y < img_gry.rows; y++)
+      for (int x = 0; x < img_gry.cols; x++)
+        pos[suiv[img_gry.at<uchar>(y,x)]++] = y*img_gry.cols + x;
+      version = vers;
+    }
+
+    // Pixels qui changent de côté quand le seuil passe de s1 à s2, c'est-à-dire
+    // de niveau dans ]min(s1,s2), max(s1,s2)] (seuillage strict g > seuil).
+    const int *bascules (int s1, int s2, int &nb) const
+    {
+      int lo = std::min(s1, s2), hi = std::max(s1, s2);
+      nb = debut[hi+1] - debut[lo+1];
+      return pos.data() + debut[lo+1];
+    }
+};
+
 //----------------------------------- M Y -------------------------------------
 
+// Paramètres de la morphologie par disques (touches e E u U D, slider Rayon)
+struct ParamsMorpho
+{
+    int rayon = 20;               // en pixels
+    bool euclidienne = false;     // sinon distance du masque courant
+};
+
+// Paramètres de l'élagage de l'axe médian (touche m, sliders Lambda, Theta)
+struct ParamsElagage
+{
+    int lambda = 0;               // en pixels, 0 : sans seuil
+    int theta = 0;                // en degrés, 0 : sans seuil
+    long budget = 1 << 16;        // opérations par boule pour le test exact
+};
+
 class My {
   public:
     cv::Mat img_src, img_res1, img_res2, img_niv, img_coul;
@@ -236,8 +574,15 @@ class My {
     int clic_x = 0;
     int clic_y = 0;
     int clic_n = 0;
-    NumeroMasque m_cour;
-    DemiMasque * dm_cour;
+    NumeroMasque m_cour = M_D4;
+    const DemiMasque * dm_cour = demi_masque (M_D4);
+    ParamsMorpho morpho;
+    ParamsElagage elagage;
+    int version_src = 0;          // incrémentée à chaque modification de img_src
+    CacheEtapes cache;
+    IndexNiveaux index_gris;      // pour le re-seuillage incrémental
+    int seuil_bin_prec = -1;      // seuil du dernier E_BINAIRE calculé
+    int seuil_dt_prec = -1;       // seuil de la dernière E_DT calculée
 
     enum Recalc { R_RIEN, R_LOUPE, R_TRANSFOS, R_SEUIL };
     Recalc recalc = R_SEUIL;
@@ -247,7 +592,10 @@ class My {
     int  need_recalc  (Recalc level) { return level <= recalc; }
 
     // Rajoutez ici des codes A_TRANSx pour le calcul et l'affichage
-    enum Affi { A_ORIG, A_SEUIL, A_TRANS1, A_TRANS2, A_TRANS3,A_TRANS5,A_TRANS6 };
+    enum Affi { A_ORIG, A_SEUIL, A_TRANS1, A_TRANS2, A_TRANS3,A_TRANS5,A_TRANS6,
+                A_TRANS7, A_TRANS8,
+                A_EROSION, A_DILATATION, A_OUVERTURE, A_FERMETURE,
+                A_GRANULO, A_ELAGAGE };
     Affi affi = A_ORIG;
 };
 
@@ -268,6 +616,73 @@ void inverser_couleurs (cv::Mat img)
 }
 
 
+// Threads des transformations parallélisées (EFT, RDT par tuiles) ; 0 :
+// nombre de coeurs. Le batch le met à 1, ses images étant déjà traitées en
+// parallèle.
+int glob_nb_threads_calcul = 0;
+
+int nb_threads_calcul (size_t taille)
+{
+    int nb_threads = glob_nb_threads_calcul;
+    if (nb_threads <= 0) nb_threads = std::thread::hardware_concurrency();
+    if (nb_threads <= 0 || taille < (1 << 18)) nb_threads = 1;
+    return nb_threads;
+}
+
+// Appelle f sur des bandes [i0, i1[ de [0, n[, une par thread. Une
+// exception (Annulation dans la bande du fil appelant, ou autre dans
+// n'importe quelle bande) n'est relancée qu'après avoir joint tous les
+// threads : un std::thread détruit encore joignable appelle std::terminate.
+void repartir_bandes (int n, size_t taille, std::function<void(int,int)> f)
+{
+    int nb_threads = std::min(nb_threads_calcul (taille), n);
+
+    std::vector<std::exception_ptr> erreurs (nb_threads);
+    auto bande = [&] (int i) {
+        try { f (n * i / nb_threads, n * (i+1) / nb_threads); }
+        catch (...) { erreurs[i] = std::current_exception(); }
+    };
+    std::vector<std::thread> groupe;
+    for (int i = 1; i < nb_threads; i++)
+        groupe.emplace_back (bande, i);
+    bande (0);
+    for (auto &t : groupe) t.join();
+    for (auto &e : erreurs)
+        if (e) std::rethrow_exception (e);
+}
+
+// Type d'élément le plus étroit, parmi CV_8UC1, CV_16UC1 et CV_32SC1, qui
+// contient toutes les valeurs de 0 à valeur_max. Les noyaux sont limités par
+// la bande passante : 1 ou 2 octets par pixel au lieu de 4.
+int type_etroit (long valeur_max)
+{
+    if (valeur_max <= UCHAR_MAX) return CV_8UC1;
+    if (valeur_max <= USHRT_MAX) return CV_16UC1;
+    return CV_32SC1;
+}
+
+// Appelle le lambda générique f avec une valeur du type d'élément de mat,
+// pour instancier le noyau sur ce type. mat est soit en type_noyau, le type
+// étroit choisi pour le noyau et l'image, soit en CV_32SC1 comme avant.
+template <typename F>
+void appeler_selon_type (const char *fonction, const cv::Mat &mat,
+                         int type_noyau, F f)
+{
+    if (mat.type() != type_noyau && mat.type() != CV_32SC1)
+        throw std::runtime_error(std::string(fonction) +
+            ": format non géré '" + std::to_string(mat.type()) + "'");
+    switch (mat.type()) {
+        case CV_8UC1  : f (uint8_t());  break;
+        case CV_16UC1 : f (uint16_t()); break;
+        case CV_16SC1 : f (int16_t());  break;
+        case CV_32SC1 : f (int32_t());  break;
+        default :
+            throw std::runtime_error(std::string(fonction) +
+                ": format non géré '" + std::to_string(mat.type()) + "'");
+    }
+}
+
+
 // Placez ici vos fonctions de transformations à la place de ces exemples
 
 void transformer_bandes_horizontales (cv::Mat img_niv)
@@ -339,45 +754,217 @@ int min5(int value1,int value2,int value3,int value4,int value5)
   return min2(min3(value1,value2,value3),min3(value3,value4,value5));
 }
 
-void calculer_Rosenfeld_DT(cv::Mat img, DemiMasque * dm)
+// DT de Rosenfeld avec le demi-masque M : passage avant avec le symétrique du
+// demi-masque, passage arrière avec le demi-masque tel quel. L'extérieur de
+// l'image est considéré comme du fond, comme pour le pelage du TP4.
+// Instanciée pour chaque masque du catalogue : les pondérations sont des
+// constantes et la boucle sur le masque est déroulée par le compilateur ; et
+// pour chaque type d'élément T, choisi par type_Rosenfeld_DT.
+// Avec BORD_FOND à false, seuls les pixels nuls de l'image sont du fond ;
+// la valeur maximale de T y est l'infini (image sans fond).
+template <NumeroMasque M, typename T, bool BORD_FOND = true>
+void calculer_Rosenfeld_DT_masque (cv::Mat img)
 {
-  for (int y = 1; y < img.rows-1; y++)
-  for (int x = 1; x < img.cols-1; x++)
+  constexpr int n = catalogue_masques[M].size;
+  const Ponderation *pond = catalogue_masques[M].list_pond;
+  const int infini = BORD_FOND ? INT_MAX : std::numeric_limits<T>::max();
+
+  for (int y = 0; y < img.rows; y++)
   {
-    if(dm->num_masque == M_D4)
+    verifier_annulation();
+    for (int x = 0; x < img.cols; x++)
     {
-      if(img.at<int>(y,x) != 0)
+      if (img.at<T>(y,x) == 0) continue;
+      int d = infini;
+      for (int k = 0; k < n; k++)
       {
-        img.at<int>(y,x) = min2(img.at<int>(y-1,x)+1,img.at<int>(y,x-1)+1);
+        const Ponderation &p = pond[k];
+        int xv = x - p.x, yv = y - p.y;
+        if (xv < 0 || xv >= img.cols || yv < 0) {
+          if (BORD_FOND) d = min2(d, p.w);
+        }
+        else if (BORD_FOND || img.at<T>(yv,xv) != infini)
+          d = min2(d, img.at<T>(yv,xv) + p.w);
       }
+      img.at<T>(y,x) = d;
     }
-    if(dm->num_masque == M_D8)
+  }
+  for (int y = img.rows-1; y >= 0; y--)
+  {
+    verifier_annulation();
+    for (int x = img.cols-1; x >= 0; x--)
     {
-      if(img.at<int>(y,x) != 0)
+      if (img.at<T>(y,x) == 0) continue;
+      int d = img.at<T>(y,x);
+      for (int k = 0; k < n; k++)
       {
-        img.at<int>(y,x) = min4(img.at<int>(y-1,x)+1,img.at<int>(y,x-1)+1,img.at<int>(y-1,x-1),img.at<int>(y+1,x-1)+1);
+        const Ponderation &p = pond[k];
+        int xv = x + p.x, yv = y + p.y;
+        if (xv < 0 || xv >= img.cols || yv >= img.rows) {
+          if (BORD_FOND) d = min2(d, p.w);
+        }
+        else if (BORD_FOND || img.at<T>(yv,xv) != infini)
+          d = min2(d, img.at<T>(yv,xv) + p.w);
       }
+      img.at<T>(y,x) = d;
     }
   }
-  for (int y = img.rows-2; y > 0; y--)
-  for (int x = img.cols-2; x > 0; x--)
+}
+
+// Majorant des valeurs de la DT sur une image rows x cols, y compris après le
+// seul passage avant : le chemin droit vers le bord gauche ou haut, puisque
+// l'extérieur est du fond. LONG_MAX si le masque n'a pas de pas axial.
+long borne_Rosenfeld_DT (int rows, int cols, const DemiMasque * dm)
+{
+  long borne = LONG_MAX;
+  for (const Ponderation &p : *dm)
   {
-    if(dm->num_masque == M_D4)
-    {
-      if(img.at<int>(y,x) != 0)
-      {
-        img.at<int>(y,x) = min3(img.at<int>(y,x),img.at<int>(y+1,x)+1,img.at<int>(y,x+1)+1);
+    if (p.x == 1 && p.y == 0) borne = std::min (borne, long(p.w) * cols);
+    if (p.x == 0 && p.y == 1) borne = std::min (borne, long(p.w) * rows);
+  }
+  return borne;
+}
+
+// Type le plus étroit pour la DT ; la valeur maximale du type est réservée à
+// l'infini de reparer_Rosenfeld_DT. Un masque utilisateur sans pondération
+// (1,0) ni (0,1) ne borne pas la DT (LONG_MAX) : CV_32SC1.
+int type_Rosenfeld_DT (int rows, int cols, const DemiMasque * dm)
+{
+  long borne = borne_Rosenfeld_DT (rows, cols, dm);
+  if (borne == LONG_MAX) return CV_32SC1;
+  return type_etroit (borne + 1);
+}
+
+// Tables des noyaux, une instance par NumeroMasque du catalogue et par type
+typedef void (*NoyauDT) (cv::Mat img);
+
+template <typename T, bool BORD_FOND, size_t... M>
+std::array<NoyauDT, sizeof...(M)> construire_noyaux_DT (std::index_sequence<M...>)
+{
+  return {{ &calculer_Rosenfeld_DT_masque<NumeroMasque(M), T, BORD_FOND>... }};
+}
+
+template <typename T>
+const std::array<NoyauDT, M_LAST> noyaux_Rosenfeld_DT =
+    construire_noyaux_DT<T, true> (std::make_index_sequence<M_LAST>());
+
+// Sans bord de fond, en CV_32SC1 seulement : les distances dépassent alors
+// borne_Rosenfeld_DT
+const std::array<NoyauDT, M_LAST> noyaux_Rosenfeld_DT_interieur =
+    construire_noyaux_DT<int, false> (std::make_index_sequence<M_LAST>());
+
+// img en CV_8UC1, CV_16UC1 ou CV_32SC1, assez large pour la DT
+void calculer_Rosenfeld_DT(cv::Mat img, const DemiMasque * dm)
+{
+  int type_noyau = type_Rosenfeld_DT (img.rows, img.cols, dm);
+  appeler_selon_type (__func__, img, type_noyau, [&] (auto t) {
+    noyaux_Rosenfeld_DT<decltype(t)>[dm->num_masque] (img);
+  });
+}
+
+// DT dont le fond est limité aux pixels nuls de l'image, l'extérieur n'en
+// étant pas ; INT_MAX partout si l'image n'a pas de pixel nul
+void calculer_Rosenfeld_DT_interieur (cv::Mat img, const DemiMasque * dm)
+{
+  CHECK_MAT_TYPE(img, CV_32SC1)
+  noyaux_Rosenfeld_DT_interieur[dm->num_masque] (img);
+}
+
+//------------------------ S E U I L L A G E   I N C R E M E N T A L ----------
+
+// Met à jour img_bin en place pour le passage du seuil de s1 à s2.
+void reseuiller_binaire (cv::Mat img_bin, const IndexNiveaux &index, int s1, int s2)
+{
+  CHECK_MAT_TYPE(img_bin, CV_8UC1)
+  int nb;
+  unsigned char val = s2 > s1 ? 0 : 255;
+  const int *pix = index.bascules (s1, s2, nb);
+  unsigned char *data = img_bin.ptr<unsigned char>(0);
+  for (int i = 0; i < nb; i++) data[pix[i]] = val;
+}
+
+// Répare localement la DT de Rosenfeld img_dt (continue) après que les nb
+// pixels pix sont devenus du fond (devenus_fond) ou de la forme. Le résultat
+// est identique à calculer_Rosenfeld_DT sur la nouvelle image binaire.
+//   - fond ajouté : les distances ne font que baisser, on propage depuis les
+//     nouveaux pixels de fond (Dijkstra sur le masque complet) ;
+//   - fond retiré : on invalide d'abord les pixels dont la valeur dérivait
+//     d'un pixel invalidé (vague montante), puis on les recalcule depuis le
+//     bord de la zone invalidée (vague descendante).
+template <typename T>
+void reparer_Rosenfeld_DT_type (cv::Mat img_dt, const int *pix, int nb,
+                                bool devenus_fond, const DemiMasque * dm)
+{
+  const int INF = std::numeric_limits<T>::max();
+  int w = img_dt.cols, h = img_dt.rows;
+  T *d = img_dt.ptr<T>(0);
+
+  // Masque complet : demi-masque et son symétrique
+  std::vector<Ponderation> masque;
+  for (const Ponderation &p : *dm) {
+    masque.push_back (p);
+    masque.push_back ({-p.x, -p.y, p.w});
+  }
+
+  typedef std::pair<int,int> Elem;              // (distance, indice)
+  std::priority_queue<Elem, std::vector<Elem>, std::greater<Elem>> file;
+
+  if (devenus_fond) {
+    for (int i = 0; i < nb; i++) { d[pix[i]] = 0; file.push ({0, pix[i]}); }
+  } else {
+    // Vague montante : pile de (indice, ancienne valeur)
+    std::vector<Elem> pile, invalides;
+    for (int i = 0; i < nb; i++) { pile.push_back ({pix[i], d[pix[i]]}); d[pix[i]] = INF; }
+    while (!pile.empty()) {
+      Elem e = pile.back(); pile.pop_back();
+      invalides.push_back (e);
+      int x = e.first % w, y = e.first / w;
+      for (const Ponderation &p : masque) {
+        int xv = x + p.x, yv = y + p.y;
+        if (xv < 0 || xv >= w || yv < 0 || yv >= h) continue;
+        T &dv = d[yv*w + xv];
+        if (dv != 0 && dv != INF && dv == e.second + p.w) {
+          pile.push_back ({yv*w + xv, dv});
+          dv = INF;
+        }
       }
     }
-    if(dm->num_masque == M_D8)
-    {
-      if(img.at<int>(y,x) != 0)
-      {
-        img.at<int>(y,x) = min5(img.at<int>(y,x),img.at<int>(y+1,x)+1,img.at<int>(y,x+1)+1,img.at<int>(y+1,x+1),img.at<int>(y-1,x+1)+1);
+    // Vague descendante : valeurs provisoires depuis les voisins valides
+    for (const Elem &e : invalides) {
+      int x = e.first % w, y = e.first / w, m = INF;
+      for (const Ponderation &p : masque) {
+        int xv = x + p.x, yv = y + p.y;
+        if (xv < 0 || xv >= w || yv < 0 || yv >= h) m = min2(m, p.w);
+        else if (d[yv*w + xv] != INF) m = min2(m, d[yv*w + xv] + p.w);
       }
+      if (m < INF) { d[e.first] = m; file.push ({m, e.first}); }
+    }
+  }
+
+  while (!file.empty()) {
+    Elem e = file.top(); file.pop();
+    if (e.first > d[e.second]) continue;
+    int x = e.second % w, y = e.second / w;
+    for (const Ponderation &p : masque) {
+      int xv = x + p.x, yv = y + p.y;
+      if (xv < 0 || xv >= w || yv < 0 || yv >= h) continue;
+      T &dv = d[yv*w + xv];
+      if (dv > e.first + p.w) { dv = e.first + p.w; file.push ({dv, yv*w + xv}); }
     }
   }
 }
+
+// img_dt du type choisi par type_Rosenfeld_DT
+void reparer_Rosenfeld_DT (cv::Mat img_dt, const int *pix, int nb,
+                           bool devenus_fond, const DemiMasque * dm)
+{
+  if (nb == 0) return;
+  int type_noyau = type_Rosenfeld_DT (img_dt.rows, img_dt.cols, dm);
+  appeler_selon_type (__func__, img_dt, type_noyau, [&] (auto t) {
+    reparer_Rosenfeld_DT_type<decltype(t)> (img_dt, pix, nb, devenus_fond, dm);
+  });
+}
+
 int max2(int value1,int value2)
 {
   if(value1<value2)
@@ -403,50 +990,169 @@ int max5(int value1,int value2,int value3,int value4,int value5)
 
   return max2(max3(value1,value2,value3),max3(value3,value4,value5));
 }
-void calculer_Rosenfeld_RDT(cv::Mat img, int connexite)
+// Candidat centre de disque maximal : aucun voisin du masque complet ne
+// couvre le disque de p, soit DT(p+v) < DT(p) + w(v) pour tout v (l'extérieur
+// vaut 0). Un pixel écarté a son disque dans celui d'un voisin plus grand,
+// le résultat est donc le même qu'avec tous les pixels comme centres ; pour
+// les masques de chanfrein quelques centres non maximaux restent, ce qui ne
+// coûte qu'un peu de propagation.
+bool est_centre_maximal (cv::Mat dt, int y, int x, const DemiMasque * dm)
+{
+    int d = dt.at<int>(y,x);
+    for (const Ponderation &p : *dm)
+    for (int sens = -1; sens <= 1; sens += 2) {
+        int yv = y + sens * p.y, xv = x + sens * p.x;
+        int dv = yv < 0 || yv >= dt.rows || xv < 0 || xv >= dt.cols
+               ? 0 : dt.at<int>(yv,xv);
+        if (dv >= d + p.w) return false;
+    }
+    return true;
+}
+
+// Axe médian : la DT n'est gardée qu'aux candidats centres de disques
+// maximaux, 0 ailleurs ; dt en CV_32SC1, modifiée en place
+void extraire_axe_median (cv::Mat dt, const DemiMasque * dm)
 {
-  int a = 5;
-  int b = 7;
-  for (int y = 1; y < img.rows-1; y++)
-  for (int x = 1; x < img.cols-1; x++)
+  CHECK_MAT_TYPE(dt, CV_32SC1)
+  cv::Mat src = dt.clone();
+  for (int y = 0; y < dt.rows; y++)
   {
-    if(img.at<int>(y,x)!=0)
+    verifier_annulation();
+    for (int x = 0; x < dt.cols; x++)
+      if (src.at<int>(y,x) > 0 && !est_centre_maximal (src, y, x, dm))
+        dt.at<int>(y,x) = 0;
+  }
+}
+
+// RDT (DT inverse) avec le même demi-masque M que calculer_Rosenfeld_DT :
+// R(p) = max sur c de img(c) - d(c,p), par un passage avant avec le
+// symétrique du demi-masque et un passage arrière avec le demi-masque. Rien
+// ne vient de l'extérieur de l'image ; les valeurs restent >= 0. Appliquée
+// à l'axe médian, R > 0 redonne exactement l'objet. Une instance par masque
+// du catalogue, comme pour la DT.
+template <NumeroMasque M>
+void calculer_Rosenfeld_RDT_masque (cv::Mat img)
+{
+  constexpr int n = catalogue_masques[M].size;
+  const Ponderation *pond = catalogue_masques[M].list_pond;
+
+  for (int y = 0; y < img.rows; y++)
+  {
+    verifier_annulation();
+    for (int x = 0; x < img.cols; x++)
     {
-      img.at<int>(y,x) =
-      max4(img.at<int>(y,x-1)-a,img.at<int>(y-1,x)-a,img.at<int>(y-1,x-1)-b,img.at<int>(y-1,x+1)-b);
+      int r = img.at<int>(y,x);
+      for (int k = 0; k < n; k++)
+      {
+        const Ponderation &p = pond[k];
+        int xv = x - p.x, yv = y - p.y;
+        if (xv >= 0 && xv < img.cols && yv >= 0)
+          r = max2(r, img.at<int>(yv,xv) - p.w);
+      }
+      img.at<int>(y,x) = r;
     }
   }
-  for (int y = img.rows-2; y > 0; y--)
-  for (int x = img.cols-2; x > 0; x--)
+  for (int y = img.rows-1; y >= 0; y--)
   {
-    if(img.at<int>(y,x)!=0)
+    verifier_annulation();
+    for (int x = img.cols-1; x >= 0; x--)
     {
-      img.at<int>(y,x) =
-      max5(img.at<int>(y,x),img.at<int>(y,x+1)-a,img.at<int>(y+1,x)-a,
-      img.at<int>(y+1,x+1)-b,img.at<int>(y+1,x-1)-b);
+      int r = img.at<int>(y,x);
+      for (int k = 0; k < n; k++)
+      {
+        const Ponderation &p = pond[k];
+        int xv = x + p.x, yv = y + p.y;
+        if (xv >= 0 && xv < img.cols && yv < img.rows)
+          r = max2(r, img.at<int>(yv,xv) - p.w);
+      }
+      img.at<int>(y,x) = r;
     }
   }
 }
-void detecter_maximum_locaux(cv::Mat img,DemiMasque * dm)
+
+template <size_t... M>
+std::array<NoyauDT, sizeof...(M)> construire_noyaux_RDT (std::index_sequence<M...>)
+{
+  return {{ &calculer_Rosenfeld_RDT_masque<NumeroMasque(M)>... }};
+}
+
+const std::array<NoyauDT, M_LAST> noyaux_Rosenfeld_RDT =
+    construire_noyaux_RDT (std::make_index_sequence<M_LAST>());
+
+// Mode par tuiles de lignes : chaque tuile fait les deux passes sur sa bande
+// de lignes, augmentée de marges de la hauteur du masque recopiées avant
+// l'itération, puis réécrit ses lignes propres. Les valeurs ne font que
+// croître vers la RDT ; on recommence tant qu'une tuile a changé, le temps
+// que la propagation traverse les bandes (une itération de plus par tuile
+// traversée, deux en général).
+void calculer_Rosenfeld_RDT_tuiles (cv::Mat img, const DemiMasque * dm, int nb_tuiles)
+{
+  CHECK_MAT_TYPE(img, CV_32SC1)
+  NoyauDT noyau = noyaux_Rosenfeld_RDT[dm->num_masque];
+  nb_tuiles = std::max (1, std::min (nb_tuiles, img.rows));
+  if (nb_tuiles == 1) { noyau (img); return; }
+
+  int marge = 0;
+  for (const Ponderation &p : *dm) marge = std::max (marge, p.y);
+
+  std::vector<cv::Mat> bandes (nb_tuiles);
+  std::vector<char> change (nb_tuiles);
+  auto debut = [&] (int i) { return img.rows * i / nb_tuiles; };
+  bool encore = true;
+  while (encore) {
+    std::vector<std::thread> groupe;
+    // Copie de toutes les bandes avant qu'une tuile n'écrive dans img
+    for (int i = 0; i < nb_tuiles; i++)
+      img.rowRange (std::max (0, debut(i) - marge),
+                    std::min (img.rows, debut(i+1) + marge)).copyTo (bandes[i]);
+    for (int i = 0; i < nb_tuiles; i++)
+      groupe.emplace_back ([&, i] () {
+        noyau (bandes[i]);
+        int y0 = debut(i), haut = y0 - std::max (0, y0 - marge);
+        change[i] = 0;
+        for (int y = y0; y < debut(i+1); y++) {
+          const int *b = bandes[i].ptr<int>(y - y0 + haut);
+          int *d = img.ptr<int>(y);
+          if (memcmp (b, d, img.cols * sizeof(int))) {
+            memcpy (d, b, img.cols * sizeof(int));
+            change[i] = 1;
+          }
+        }
+      });
+    for (auto &th : groupe) th.join();
+    encore = std::find (change.begin(), change.end(), 1) != change.end();
+  }
+}
+
+// img en CV_32SC1 : séquentielle sur les petites images, par tuiles sinon
+void calculer_Rosenfeld_RDT (cv::Mat img, const DemiMasque * dm)
+{
+  calculer_Rosenfeld_RDT_tuiles (img, dm, nb_threads_calcul (img.total()));
+}
+template <typename T>
+void detecter_maximum_locaux_type(cv::Mat img)
 {
   cv::Mat copy = img.clone();
   for (int y = 0; y < img.rows; y++)
   for (int x = 0; x < img.cols; x++)
   {
-    img.at<int>(y,x) = 0;
+    img.at<T>(y,x) = 0;
   }
   for (int y = 1; y < copy.rows-1; y++)
-  for (int x = 1; x < copy.cols-1; x++)
   {
-    if(copy.at<int>(y,x) !=0 )
+    verifier_annulation();
+    for (int x = 1; x < copy.cols-1; x++)
     {
-      std::cout<<x<<" "<<y<<std::endl;
-      if((copy.at<int>(y,x) > copy.at<int>(y-1,x) &&
-      copy.at<int>(y,x) > copy.at<int>(y+1,x)) ||
-      (copy.at<int>(y,x) > copy.at<int>(y,x-1)&&
-      copy.at<int>(y,x) > copy.at<int>(y,x+1)))
+      if(copy.at<T>(y,x) !=0 )
       {
-        img.at<int>(y,x) = 255;
+        std::cout<<x<<" "<<y<<std::endl;
+        if((copy.at<T>(y,x) > copy.at<T>(y-1,x) &&
+        copy.at<T>(y,x) > copy.at<T>(y+1,x)) ||
+        (copy.at<T>(y,x) > copy.at<T>(y,x-1)&&
+        copy.at<T>(y,x) > copy.at<T>(y,x+1)))
+        {
+          img.at<T>(y,x) = 255;
+        }
       }
     }
   }
@@ -455,66 +1161,79 @@ void detecter_maximum_locaux(cv::Mat img,DemiMasque * dm)
   //img = copy;
 }
 
+void detecter_maximum_locaux(cv::Mat img,const DemiMasque * dm)
+{
+  appeler_selon_type (__func__, img, img.type(), [&] (auto t) {
+    detecter_maximum_locaux_type<decltype(t)> (img);
+  });
+}
+
 void calculer_sedt_saito_toriwaki(cv::Mat img)
 {
   for (int y = img.rows-1; y > 0; y--)
-  for (int x = img.cols-1; x > 0; x--)
   {
-    if(img.at<int>(y,x)!=0)
+    verifier_annulation();
+    for (int x = img.cols-1; x > 0; x--)
     {
-      int value1 =0;
-      int value2 =0;
-      //int flag=x;
-      for(int k = x; k<img.cols;k++)
+      if(img.at<int>(y,x)!=0)
       {
-        value1++;
-        if(img.at<int>(y,k)==0)
+        int value1 =0;
+        int value2 =0;
+        //int flag=x;
+        for(int k = x; k<img.cols;k++)
         {
-          break;
+          value1++;
+          if(img.at<int>(y,k)==0)
+          {
+            break;
+          }
         }
-      }
-      for(int k = x; k>-1;k--)
-      {
-        value2++;
-        if(img.at<int>(y,k)==0)
+        for(int k = x; k>-1;k--)
         {
-          break;
+          value2++;
+          if(img.at<int>(y,k)==0)
+          {
+            break;
+          }
         }
-      }
-      int value_min = min2(value1,value2);
-      img.at<int>(y,x)= value_min;
+        int value_min = min2(value1,value2);
+        img.at<int>(y,x)= value_min;
 
+      }
     }
   }
   cv::Mat copy = img.clone();
   for (int y = img.rows-1; y > 0; y--)
-  for (int x = img.cols-1; x > 0; x--)
   {
-    if(img.at<int>(y,x)!=0)
+    verifier_annulation();
+    for (int x = img.cols-1; x > 0; x--)
     {
-      int value1 =0;
-      int value2 =0;
-      //int flag=x;
-      for(int k = y; k<img.rows;k++)
+      if(img.at<int>(y,x)!=0)
       {
-        value1++;
-        if(img.at<int>(k,x)==0)
+        int value1 =0;
+        int value2 =0;
+        //int flag=x;
+        for(int k = y; k<img.rows;k++)
         {
-          break;
+          value1++;
+          if(img.at<int>(k,x)==0)
+          {
+            break;
+          }
         }
-      }
-      for(int k = y; k>-1;k--)
-      {
-        value2++;
-        if(img.at<int>(k,x)==0)
+        for(int k = y; k>-1;k--)
         {
-          break;
+          value2++;
+          if(img.at<int>(k,x)==0)
+          {
+            break;
+          }
+        }
+        int value_min = min2(value1,value2);
+        if(value_min < img.at<int>(y,x))
+        {
+          img.at<int>(y,x)= value_min;
         }
-      }
-      int value_min = min2(value1,value2);
-      if(value_min < img.at<int>(y,x))
-      {
-        img.at<int>(y,x)= value_min;
       }
     }
   }
@@ -531,34 +1250,980 @@ void calculer_sedt_courbes_niveau(cv::Mat img)
     }
   }
 }
-// Appelez ici vos transformations selon affi
-void effectuer_transformations (My::Affi affi, cv::Mat img_niv, DemiMasque * dm)
+//------------------- P L U S   P R O C H E   D U   F O N D -------------------
+
+// Transformée des plus proches (EFT) : pour chaque pixel, l'indice y*cols+x du
+// pixel de fond (valeur 0) le plus proche au sens euclidien exact, -1 si
+// l'image n'a pas de fond. Deux passes séparables en temps linéaire
+// (Meijster et al.) :
+//  - par colonne, la ligne du fond le plus proche dans la colonne ;
+//  - par ligne, l'enveloppe inférieure des paraboles (x-u)² + (y-g(u))².
+// La première passe balaie les lignes entières pour rester contiguë en
+// mémoire, chaque thread sur sa bande de colonnes ; la seconde est
+// indépendante d'une ligne à l'autre, chaque thread sur sa bande de lignes.
+
+const int EFT_SANS_FOND = -1;
+
+// Passe 1 sur les colonnes [x0, x1[ : g(y,x) ligne du fond le plus proche
+// dans la colonne x, EFT_SANS_FOND si la colonne n'en a pas
+template <typename T>
+void eft_passe_colonnes (cv::Mat img_bin, cv::Mat g, int x0, int x1)
 {
-    switch (affi) {
-        case My::A_TRANS1 :
+    for (int y = 0; y < img_bin.rows; y++) {
+        const T *b = img_bin.ptr<T>(y);
+        const int *gp = y > 0 ? g.ptr<int>(y-1) : NULL;
+        int *gy = g.ptr<int>(y);
+        for (int x = x0; x < x1; x++)
+            gy[x] = b[x] == 0 ? y : gp ? gp[x] : EFT_SANS_FOND;
+    }
+    for (int y = img_bin.rows-2; y >= 0; y--) {
+        const int *gs = g.ptr<int>(y+1);
+        int *gy = g.ptr<int>(y);
+        for (int x = x0; x < x1; x++)
+            if (gs[x] != EFT_SANS_FOND &&
+                (gy[x] == EFT_SANS_FOND || gs[x] - y < y - gy[x]))
+                gy[x] = gs[x];
+    }
+}
 
-            calculer_Rosenfeld_DT(img_niv,dm);
-            break;
-        case My::A_TRANS2 :
-            calculer_Rosenfeld_DT(img_niv,dm);
-            detecter_maximum_locaux (img_niv,dm);
-            break;
-        case My::A_TRANS3 :
-        calculer_Rosenfeld_DT(img_niv,dm);
-        //max locaux
-        calculer_Rosenfeld_RDT(img_niv,4);
-            //transformer_bandes_diagonales (img_niv);
-            break;
+// Passe 2 sur la ligne y : s[] colonnes des paraboles de l'enveloppe,
+// t[] abscisse à partir de laquelle chacune est minimale
+void eft_passe_ligne (const int *gy, int y, int cols, int *ft,
+    std::vector<int> &s, std::vector<int> &t)
+{
+    auto h = [&] (int u) { int64_t d = y - gy[u]; return d * d; };
+    auto f = [&] (int x, int u) { int64_t d = x - u; return d * d + h(u); };
+
+    int q = -1;
+    for (int u = 0; u < cols; u++) {
+        if (gy[u] == EFT_SANS_FOND) continue;
+        while (q >= 0 && f (t[q], s[q]) > f (t[q], u)) q--;
+        if (q < 0) { q = 0; s[0] = u; t[0] = 0; continue; }
+        // Première abscisse où u est strictement meilleur que s[q]
+        int64_t num = int64_t(u)*u - int64_t(s[q])*s[q] + h(u) - h(s[q]),
+                den = 2 * int64_t(u - s[q]);
+        int64_t w = (num >= 0 ? num / den : -((-num + den-1) / den)) + 1;
+        if (w < cols) { q++; s[q] = u; t[q] = int(std::max<int64_t> (w, 0)); }
+    }
+    if (q < 0) { std::fill (ft, ft + cols, EFT_SANS_FOND); return; }
+    for (int x = cols-1; x >= 0; x--) {
+        ft[x] = gy[s[q]] * cols + s[q];
+        if (x == t[q]) q--;
+    }
+}
+
+// img_bin : fond à 0, tout type entier ; ft est (ré)alloué en CV_32SC1
+void calculer_eft (cv::Mat img_bin, cv::Mat &ft)
+{
+    int rows = img_bin.rows, cols = img_bin.cols;
+    if (img_bin.total() > size_t(INT_MAX))
+        throw std::runtime_error ("calculer_eft : image trop grande");
+    cv::Mat g (rows, cols, CV_32SC1);
+    ft.create (rows, cols, CV_32SC1);
+
+    appeler_selon_type (__func__, img_bin, img_bin.type(), [&] (auto v) {
+        repartir_bandes (cols, img_bin.total(), [&] (int x0, int x1) {
+            eft_passe_colonnes<decltype(v)> (img_bin, g, x0, x1);
+        });
+    });
+    repartir_bandes (rows, img_bin.total(), [&] (int y0, int y1) {
+        std::vector<int> s (cols), t (cols);
+        for (int y = y0; y < y1; y++) {
+            verifier_annulation();
+            eft_passe_ligne (g.ptr<int>(y), y, cols, ft.ptr<int>(y), s, t);
+        }
+    });
+}
+
+// Sépare l'indice en deux plans de coordonnées, au type le plus étroit ;
+// EFT_SANS_FOND y donne -1 en CV_32SC1 et la valeur maximale sinon.
+// Écrits par le mode -batch avec les touches 7 et 8.
+void separer_coordonnees_eft (cv::Mat ft, cv::Mat &fy, cv::Mat &fx)
+{
+    CHECK_MAT_TYPE(ft, CV_32SC1)
+    fy.create (ft.rows, ft.cols, type_etroit (ft.rows));
+    fx.create (ft.rows, ft.cols, type_etroit (ft.cols));
+    appeler_selon_type (__func__, fy, fy.type(), [&] (auto vy) {
+      appeler_selon_type (__func__, fx, fx.type(), [&] (auto vx) {
+        using TY = decltype(vy); using TX = decltype(vx);
+        for (int y = 0; y < ft.rows; y++) {
+            const int *f = ft.ptr<int>(y);
+            TY *py = fy.ptr<TY>(y);
+            TX *px = fx.ptr<TX>(y);
+            for (int x = 0; x < ft.cols; x++) {
+                py[x] = f[x] < 0 ? TY(-1) : TY(f[x] / ft.cols);
+                px[x] = f[x] < 0 ? TX(-1) : TX(f[x] % ft.cols);
+            }
+        }
+      });
+    });
+}
+
+// Carré de la distance euclidienne exacte au fond, déduit de l'EFT
+void calculer_sedt_eft (cv::Mat ft, cv::Mat img)
+{
+    CHECK_MAT_TYPE(ft, CV_32SC1)
+    CHECK_MAT_TYPE(img, CV_32SC1)
+    for (int y = 0; y < ft.rows; y++) {
+        const int *f = ft.ptr<int>(y);
+        int *d = img.ptr<int>(y);
+        for (int x = 0; x < ft.cols; x++) {
+            if (f[x] < 0) { d[x] = INT_MAX; continue; }
+            int dy = f[x] / ft.cols - y, dx = f[x] % ft.cols - x;
+            d[x] = dy*dy + dx*dx;
+        }
+    }
+}
+
+// Diagramme de Voronoï discret des pixels de fond, restreint aux objets :
+// chaque pixel d'objet prend l'indice de son plus proche pixel de fond
+void calculer_voronoi_eft (cv::Mat ft, cv::Mat img)
+{
+    CHECK_MAT_TYPE(ft, CV_32SC1)
+    CHECK_MAT_TYPE(img, CV_32SC1)
+    for (int y = 0; y < ft.rows; y++) {
+        const int *f = ft.ptr<int>(y);
+        int *d = img.ptr<int>(y);
+        for (int x = 0; x < ft.cols; x++)
+            d[x] = d[x] == 0 ? 0 : f[x] < 0 ? 255 : 1 + f[x] % 254;
+    }
+}
+
+//------------------------ M O R P H O L O G I E ------------------------------
+
+// Érosion, dilatation, ouverture et fermeture par le disque discret
+// B_r = { q : d(0,q) <= r * w(1,0) } de la distance du masque courant, ou
+// { q : |q|² <= r² } en euclidien. L'érosion seuille la distance au fond,
+// la dilatation la distance à l'objet : le coût est celui d'une DT, quel que
+// soit le rayon. L'extérieur de l'image est du fond pour les deux, comme
+// pour calculer_Rosenfeld_DT. Les résultats sont binaires en CV_8UC1.
+
+// Plafonne la SEDT au carré de la distance à l'extérieur de l'image
+void borner_sedt_au_bord (cv::Mat dist)
+{
+    CHECK_MAT_TYPE(dist, CV_32SC1)
+    for (int y = 0; y < dist.rows; y++) {
+        int *d = dist.ptr<int>(y);
+        int by = std::min (y + 1, dist.rows - y);
+        for (int x = 0; x < dist.cols; x++) {
+            int b = std::min (by, std::min (x + 1, dist.cols - x));
+            if (long(b) * b < d[x]) d[x] = b * b;
+        }
+    }
+}
+
+// w(1,0), la longueur d'un pas de pixel pour le masque
+int poids_axial (const DemiMasque * dm)
+{
+    for (const Ponderation &p : *dm)
+        if (p.x == 1 && p.y == 0) return p.w;
+    return 1;
+}
+
+long seuil_disque (const DemiMasque * dm, const ParamsMorpho &pm)
+{
+    if (pm.euclidienne) return long(pm.rayon) * pm.rayon;
+    return long(pm.rayon) * poids_axial (dm);
+}
+
+// Distance au fond de img_bin (objet non nul) : la DT de Rosenfeld au type
+// étroit, ou la SEDT exacte en CV_32SC1 bornée par la distance au bord
+cv::Mat distance_fond_morpho (cv::Mat img_bin, const DemiMasque * dm,
+    const ParamsMorpho &pm)
+{
+    cv::Mat dist;
+    if (!pm.euclidienne) {
+        img_bin.convertTo (dist, type_Rosenfeld_DT (img_bin.rows, img_bin.cols, dm));
+        calculer_Rosenfeld_DT (dist, dm);
+        return dist;
+    }
+    cv::Mat ft;
+    calculer_eft (img_bin, ft);
+    dist.create (img_bin.rows, img_bin.cols, CV_32SC1);
+    calculer_sedt_eft (ft, dist);
+    borner_sedt_au_bord (dist);
+    return dist;
+}
+
+// Distance à l'objet de img_bin, en CV_32SC1 ; INT_MAX sans objet
+cv::Mat distance_objet_morpho (cv::Mat img_bin, const DemiMasque * dm,
+    const ParamsMorpho &pm)
+{
+    cv::Mat compl_bin (img_bin.rows, img_bin.cols, CV_32SC1), dist;
+    appeler_selon_type (__func__, img_bin, img_bin.type(), [&] (auto v) {
+        using T = decltype(v);
+        for (int y = 0; y < img_bin.rows; y++) {
+            const T *b = img_bin.ptr<T>(y);
+            int *c = compl_bin.ptr<int>(y);
+            for (int x = 0; x < img_bin.cols; x++) c[x] = b[x] == 0 ? 1 : 0;
+        }
+    });
+    if (!pm.euclidienne) {
+        calculer_Rosenfeld_DT_interieur (compl_bin, dm);
+        return compl_bin;
+    }
+    cv::Mat ft;
+    calculer_eft (compl_bin, ft);
+    calculer_sedt_eft (ft, compl_bin);
+    return compl_bin;
+}
+
+// res = 255 là où dist > s (au_dessus) ou dist <= s (sinon), 0 ailleurs
+void seuiller_distance (cv::Mat dist, long s, bool au_dessus, cv::Mat &res)
+{
+    res.create (dist.rows, dist.cols, CV_8UC1);
+    appeler_selon_type (__func__, dist, dist.type(), [&] (auto v) {
+        using T = decltype(v);
+        for (int y = 0; y < dist.rows; y++) {
+            const T *d = dist.ptr<T>(y);
+            unsigned char *r = res.ptr<unsigned char>(y);
+            for (int x = 0; x < dist.cols; x++)
+                r[x] = (long(d[x]) > s) == au_dessus ? 255 : 0;
+        }
+    });
+}
+
+// Distance attendue par effectuer_morphologie : à l'objet pour la dilatation
+// et la fermeture, au fond sinon
+bool morphologie_sur_objet (My::Affi affi)
+{
+    return affi == My::A_DILATATION || affi == My::A_FERMETURE;
+}
+
+cv::Mat effectuer_morphologie (My::Affi affi, cv::Mat dist,
+    const DemiMasque * dm, const ParamsMorpho &pm)
+{
+    long s = seuil_disque (dm, pm);
+    cv::Mat res;
+    switch (affi) {
+        case My::A_EROSION :
+            seuiller_distance (dist, s, true, res);
+            break;
+        case My::A_DILATATION :
+            seuiller_distance (dist, s, false, res);
+            break;
+        case My::A_OUVERTURE :
+            seuiller_distance (dist, s, true, res);
+            seuiller_distance (distance_objet_morpho (res, dm, pm), s, false, res);
+            break;
+        case My::A_FERMETURE :
+            seuiller_distance (dist, s, false, res);
+            seuiller_distance (distance_fond_morpho (res, dm, pm), s, true, res);
+            break;
+        default : ;
+    }
+    return res;
+}
+
+//------------------------ G R A N U L O M E T R I E --------------------------
+
+// Spectre des ouvertures par les disques B_r de la morphologie, pour tous
+// les rayons en une passe. L'ouverture de rayon r est approchée par la
+// réunion des disques maximaux B(c, DT(c)-1) de rayon au moins r * w(1,0) :
+// chaque pixel reçoit le plus grand DT(c) des disques maximaux qui le
+// couvrent. Pour cela une RDT ordonnée traite les centres par DT
+// décroissante ; chaque classe propage son résidu DT(c) - d(c,p) par une
+// file à seaux, et seulement là où il améliore le résidu déjà posé par les
+// classes supérieures. Le travail ne dépend pas du nombre de rayons.
+
+// dt : DT de Rosenfeld (tout type, copiée : carte peut être la même image) ;
+// carte en CV_32SC1 reçoit 1 + le plus grand rayon r dont l'ouverture
+// contient le pixel, 0 sur le fond
+void calculer_carte_granulo (cv::Mat img_dt, const DemiMasque * dm, cv::Mat carte)
+{
+    CHECK_MAT_TYPE(carte, CV_32SC1)
+    cv::Mat dt;
+    img_dt.convertTo (dt, CV_32SC1);
+    int rows = dt.rows, cols = dt.cols, w10 = poids_axial (dm);
+
+    // Centres rangés par DT, par un tri par dénombrement
+    int dt_max = 0;
+    for (int y = 0; y < rows; y++)
+    for (int x = 0; x < cols; x++)
+        dt_max = std::max (dt_max, dt.at<int>(y,x));
+    std::vector<std::vector<int>> centres (dt_max + 1);
+    for (int y = 0; y < rows; y++) {
+        verifier_annulation();
+        for (int x = 0; x < cols; x++)
+            if (dt.at<int>(y,x) > 0 && est_centre_maximal (dt, y, x, dm))
+                centres[dt.at<int>(y,x)].push_back (y * cols + x);
+    }
+
+    // Masque complet, en décalages d'indice
+    std::vector<Ponderation> voisins;
+    for (const Ponderation &p : *dm) {
+        voisins.push_back (p);
+        voisins.push_back ({ -p.x, -p.y, p.w });
+    }
+
+    std::vector<int> residu (size_t(rows) * cols, 0), g (size_t(rows) * cols, 0);
+    std::vector<std::vector<int>> seaux (dt_max + 1);
+    for (int k = dt_max; k > 0; k--) {
+        verifier_annulation();
+        for (int i : centres[k])
+            if (residu[i] < k) { residu[i] = k; seaux[k].push_back (i); }
+        for (int l = k; l > 0; l--) {
+            for (size_t n = 0; n < seaux[l].size(); n++) {
+                int i = seaux[l][n];
+                if (residu[i] != l) continue;          // entrée périmée
+                if (g[i] == 0) g[i] = k;
+                int y = i / cols, x = i % cols;
+                for (const Ponderation &v : voisins) {
+                    int yv = y + v.y, xv = x + v.x, nl = l - v.w;
+                    if (nl <= 0 || yv < 0 || yv >= rows || xv < 0 || xv >= cols)
+                        continue;
+                    int j = yv * cols + xv;
+                    if (residu[j] < nl) { residu[j] = nl; seaux[nl].push_back (j); }
+                }
+            }
+            seaux[l].clear();
+        }
+    }
+
+    for (int y = 0; y < rows; y++) {
+        int *c = carte.ptr<int>(y);
+        for (int x = 0; x < cols; x++) {
+            int gp = g[size_t(y) * cols + x];
+            c[x] = gp == 0 ? 0 : (gp - 1) / w10 + 1;
+        }
+    }
+}
+
+// aire[r] : nombre de pixels de l'ouverture de rayon r, depuis la carte
+std::vector<long> spectre_granulo (cv::Mat carte)
+{
+    CHECK_MAT_TYPE(carte, CV_32SC1)
+    std::vector<long> aire;
+    for (int y = 0; y < carte.rows; y++) {
+        const int *c = carte.ptr<int>(y);
+        for (int x = 0; x < carte.cols; x++) {
+            if (c[x] == 0) continue;
+            if (size_t(c[x]) > aire.size()) aire.resize (c[x], 0);
+            aire[c[x] - 1]++;
+        }
+    }
+    for (int r = int(aire.size()) - 2; r >= 0; r--) aire[r] += aire[r+1];
+    return aire;
+}
+
+// CSV rayon,aire,spectre ; spectre[r] = aire[r] - aire[r+1], l'aire perdue
+// entre les ouvertures de rayons r et r+1
+bool ecrire_granulo_csv (const std::string &nom, const std::vector<long> &aire)
+{
+    std::ofstream f (nom);
+    if (!f) return false;
+    f << "rayon,aire,spectre\n";
+    for (size_t r = 0; r < aire.size(); r++)
+        f << r << "," << aire[r] << ","
+          << aire[r] - (r+1 < aire.size() ? aire[r+1] : 0) << "\n";
+    return bool(f);
+}
+
+//------------------- E L A G A G E   D E   L ' A X E -------------------------
+
+// Simplification de l'axe médian vu comme une liste de boules (centre,
+// rayon = DT, disque { p : d(c,p) < r }) :
+//  - seuil de signification à la λ/θ, d'après les pixels de fond les plus
+//    proches (EFT) du centre et de ses voisins (1,0), (0,1), (1,1) : λ est le
+//    demi-diamètre de ces points, θ le plus grand angle sous lequel le centre
+//    en voit deux. Une boule sous l'un des seuils est retirée, ce qui peut
+//    créer une erreur de reconstruction ;
+//  - retrait exact des boules couvertes par la réunion des autres, des plus
+//    petites aux plus grandes : la reconstruction ne change pas. Les voisines
+//    d'une boule sont trouvées par hachage spatial des centres, une grille par
+//    classe de rayon ; si leur collecte et le test dépassent budget
+//    opérations, la boule est gardée sans conclure.
+
+struct BouleMediane
+{
+    int y, x, r;
+};
+
+struct BilanElagage
+{
+    size_t nb_brutes = 0, nb_signif = 0, nb_gardees = 0;
+    long erreur = 0, aire = 0;    // pixels de X Δ reconstruction, de X
+
+    double compression () const { return nb_gardees ? double(nb_brutes) / nb_gardees : 0; }
+    double erreur_pct () const { return aire ? 100. * erreur / aire : 0; }
+};
+
+bool boule_significative (cv::Mat ft, const BouleMediane &b, const ParamsElagage &pe)
+{
+    if (pe.lambda <= 0 && pe.theta <= 0) return true;
+    int pts[4][2], n = 0;
+    for (int v = 0; v < 4; v++) {
+        int y = b.y + v / 2, x = b.x + v % 2;
+        if (y >= ft.rows || x >= ft.cols) continue;
+        int f = ft.at<int>(y,x);
+        if (f < 0) continue;
+        pts[n][0] = f / ft.cols; pts[n][1] = f % ft.cols; n++;
+    }
+    double diam2 = 0, cos_min = 1;
+    for (int i = 0; i < n; i++)
+    for (int j = i+1; j < n; j++) {
+        double dy = pts[i][0] - pts[j][0], dx = pts[i][1] - pts[j][1];
+        diam2 = std::max (diam2, dy*dy + dx*dx);
+        double ay = pts[i][0] - b.y, ax = pts[i][1] - b.x,
+               by = pts[j][0] - b.y, bx = pts[j][1] - b.x;
+        double na = sqrt (ay*ay + ax*ax), nb = sqrt (by*by + bx*bx);
+        if (na > 0 && nb > 0)
+            cos_min = std::min (cos_min, (ay*by + ax*bx) / (na * nb));
+    }
+    if (pe.lambda > 0 && sqrt (diam2) / 2 < pe.lambda) return false;
+    if (pe.theta > 0 && acos (std::max (-1., cos_min)) * 180 / M_PI < pe.theta)
+        return false;
+    return true;
+}
+
+// Distance du masque de (0,0) à (dy,dx), |dy| et |dx| <= k, lue dans un
+// quart de plan : les masques du catalogue sont symétriques
+class TableDistance
+{
+  public :
+    TableDistance (const DemiMasque * dm, int k) : d (k+1, k+1, CV_32SC1)
+    {
+        d.setTo (cv::Scalar (1));
+        d.at<int>(0,0) = 0;
+        calculer_Rosenfeld_DT_interieur (d, dm);
+    }
+    int operator() (int dy, int dx) const { return d.at<int>(abs(dy), abs(dx)); }
+
+  private :
+    cv::Mat d;
+};
+
+void retirer_boules_redondantes (std::vector<BouleMediane> &boules,
+    const DemiMasque * dm, long budget)
+{
+    if (boules.empty()) return;
+    int w10 = poids_axial (dm), k_max = 0;
+    auto demi_cote = [w10] (const BouleMediane &b) { return (b.r - 1) / w10; };
+    for (const BouleMediane &b : boules) k_max = std::max (k_max, demi_cote (b));
+    TableDistance dist (dm, k_max);
+
+    // Hachage des centres par classe de rayon : la classe c reçoit les
+    // demi-côtés de [2^c - 1, 2^(c+1) - 1), dans des cases du côté de sa plus
+    // grande boule. Une grande boule ne fait plus grossir les cases des
+    // petites.
+    struct ClasseBoules
+    {
+        int k_max = 0, cote = 1;
+        std::unordered_map<int64_t, std::vector<int>> cases;
+    };
+    auto classe = [] (int k) { int c = 0; while (k + 1 >= (2 << c)) c++; return c; };
+    auto cle = [] (int cy, int cx) { return (int64_t(cy) << 32) | uint32_t(cx); };
+    std::vector<ClasseBoules> classes (classe (k_max) + 1);
+    for (const BouleMediane &b : boules) {
+        ClasseBoules &cl = classes[classe (demi_cote (b))];
+        cl.k_max = std::max (cl.k_max, demi_cote (b));
+    }
+    for (ClasseBoules &cl : classes) cl.cote = cl.k_max + 1;
+    for (size_t i = 0; i < boules.size(); i++) {
+        ClasseBoules &cl = classes[classe (demi_cote (boules[i]))];
+        cl.cases[cle (boules[i].y / cl.cote, boules[i].x / cl.cote)].push_back (i);
+    }
+
+    std::vector<int> ordre (boules.size());
+    for (size_t i = 0; i < ordre.size(); i++) ordre[i] = i;
+    std::sort (ordre.begin(), ordre.end(), [&] (int a, int b)
+        { return boules[a].r < boules[b].r; });
+    std::vector<char> active (boules.size(), 1);
+    std::vector<int> voisines;
+
+    for (int i : ordre) {
+        verifier_annulation();
+        const BouleMediane &b = boules[i];
+        int kb = demi_cote (b);
+        long test = long(2*kb+1) * (2*kb+1), ops = 0;
+        voisines.clear();
+        // La collecte compte dans le budget : cases visitées et centres vus
+        for (const ClasseBoules &cl : classes) {
+            if (cl.cases.empty()) continue;
+            int portee = kb + cl.k_max;
+            for (int cy = (b.y - portee) / cl.cote; cy <= (b.y + portee) / cl.cote && ops <= budget; cy++)
+            for (int cx = (b.x - portee) / cl.cote; cx <= (b.x + portee) / cl.cote && ops <= budget; cx++) {
+                ops++;
+                auto it = cl.cases.find (cle (cy, cx));
+                if (it == cl.cases.end()) continue;
+                ops += it->second.size();
+                for (int j : it->second) {
+                    const BouleMediane &n = boules[j];
+                    if (j != i && active[j] &&
+                        std::max (abs(n.y - b.y), abs(n.x - b.x)) <= kb + demi_cote (n))
+                        voisines.push_back (j);
+                }
+            }
+        }
+        if (voisines.empty() || ops > budget ||
+            long(voisines.size()) * test > budget - ops) continue;
+
+        bool couverte = true;
+        for (int dy = -kb; dy <= kb && couverte; dy++)
+        for (int dx = -kb; dx <= kb && couverte; dx++) {
+            if (dist (dy, dx) >= b.r) continue;
+            int py = b.y + dy, px = b.x + dx;
+            couverte = false;
+            for (int j : voisines) {
+                const BouleMediane &n = boules[j];
+                int ey = py - n.y, ex = px - n.x;
+                if (std::max (abs(ey), abs(ex)) <= demi_cote (n)
+                    && dist (ey, ex) < n.r) { couverte = true; break; }
+            }
+        }
+        if (couverte) active[i] = 0;
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < boules.size(); i++)
+        if (active[i]) boules[k++] = boules[i];
+    boules.resize (k);
+}
+
+// dt : DT de Rosenfeld (tout type), ft : EFT de la même image binaire
+std::vector<BouleMediane> elaguer_axe_median (cv::Mat img_dt, cv::Mat ft,
+    const DemiMasque * dm, const ParamsElagage &pe, BilanElagage &bilan)
+{
+    cv::Mat axe;
+    img_dt.convertTo (axe, CV_32SC1);
+    extraire_axe_median (axe, dm);
+
+    std::vector<BouleMediane> boules;
+    for (int y = 0; y < axe.rows; y++)
+    for (int x = 0; x < axe.cols; x++) {
+        int r = axe.at<int>(y,x);
+        if (r == 0) continue;
+        bilan.nb_brutes++;
+        BouleMediane b = { y, x, r };
+        if (boule_significative (ft, b, pe)) boules.push_back (b);
+    }
+    bilan.nb_signif = boules.size();
+    retirer_boules_redondantes (boules, dm, pe.budget);
+    bilan.nb_gardees = boules.size();
+    return boules;
+}
+
+// Reconstruction par RDT des boules gardées, comparée à l'objet (dt > 0) ;
+// img_niv en CV_32SC1 : 8 objet reconstruit, 4 objet manqué, 14 ajouté à
+// tort, 255 centres gardés, 0 fond
+void representer_elagage (cv::Mat img_dt, const std::vector<BouleMediane> &boules,
+    const DemiMasque * dm, cv::Mat img_niv, BilanElagage &bilan)
+{
+    CHECK_MAT_TYPE(img_niv, CV_32SC1)
+    cv::Mat rec (img_niv.rows, img_niv.cols, CV_32SC1), dt;
+    rec.setTo (cv::Scalar (0));
+    for (const BouleMediane &b : boules) rec.at<int>(b.y, b.x) = b.r;
+    calculer_Rosenfeld_RDT (rec, dm);
+    img_dt.convertTo (dt, CV_32SC1);
+
+    bilan.erreur = bilan.aire = 0;
+    for (int y = 0; y < dt.rows; y++)
+    for (int x = 0; x < dt.cols; x++) {
+        bool objet = dt.at<int>(y,x) > 0, couvert = rec.at<int>(y,x) > 0;
+        bilan.aire += objet;
+        bilan.erreur += objet != couvert;
+        img_niv.at<int>(y,x) = objet ? (couvert ? 8 : 4) : (couvert ? 14 : 0);
+    }
+    for (const BouleMediane &b : boules) img_niv.at<int>(b.y, b.x) = 255;
+}
+
+// Élagage complet sur img_niv binaire (CV_32SC1), remplacée par la
+// représentation de representer_elagage
+BilanElagage effectuer_elagage (cv::Mat img_niv, const DemiMasque * dm,
+    const ParamsElagage &pe)
+{
+    cv::Mat ft, dt = img_niv.clone();
+    calculer_eft (img_niv, ft);
+    calculer_Rosenfeld_DT (dt, dm);
+    BilanElagage bilan;
+    std::vector<BouleMediane> boules = elaguer_axe_median (dt, ft, dm, pe, bilan);
+    representer_elagage (dt, boules, dm, img_niv, bilan);
+    return bilan;
+}
+
+bool ecrire_elagage_csv (const std::string &nom, const BilanElagage &b)
+{
+    std::ofstream f (nom);
+    if (!f) return false;
+    f << "boules_brutes,boules_signif,boules_gardees,compression,erreur_pct\n"
+      << b.nb_brutes << "," << b.nb_signif << "," << b.nb_gardees << ","
+      << b.compression() << "," << b.erreur_pct() << "\n";
+    return bool(f);
+}
+
+std::ostream & operator<< (std::ostream &os, const BilanElagage &b)
+{
+    return os << "Axe médian : " << b.nb_brutes << " boules, " << b.nb_signif
+              << " significatives, " << b.nb_gardees << " gardées (compression x"
+              << b.compression() << "), erreur " << b.erreur << " pixels ("
+              << b.erreur_pct() << " %)";
+}
+
+// Appelez ici vos transformations selon affi
+void effectuer_transformations (My::Affi affi, cv::Mat img_niv, const DemiMasque * dm,
+    const ParamsMorpho &pm = ParamsMorpho(),
+    const ParamsElagage &pe = ParamsElagage())
+{
+    switch (affi) {
+        case My::A_TRANS1 :
+
+            calculer_Rosenfeld_DT(img_niv,dm);
+            break;
+        case My::A_TRANS2 :
+            calculer_Rosenfeld_DT(img_niv,dm);
+            detecter_maximum_locaux (img_niv,dm);
+            break;
+        case My::A_TRANS3 :
+        calculer_Rosenfeld_DT(img_niv,dm);
+        extraire_axe_median(img_niv,dm);
+        calculer_Rosenfeld_RDT(img_niv,dm);
+            //transformer_bandes_diagonales (img_niv);
+            break;
         case My::A_TRANS5 :
           calculer_sedt_saito_toriwaki(img_niv);
            break;
         case My::A_TRANS6 :
           calculer_sedt_saito_toriwaki(img_niv);
           calculer_sedt_courbes_niveau(img_niv);
+          break;
+        case My::A_TRANS7 : {
+          cv::Mat ft;
+          calculer_eft (img_niv, ft);
+          calculer_sedt_eft (ft, img_niv);
+          } break;
+        case My::A_TRANS8 : {
+          cv::Mat ft;
+          calculer_eft (img_niv, ft);
+          calculer_voronoi_eft (ft, img_niv);
+          } break;
+        case My::A_EROSION :
+        case My::A_DILATATION :
+        case My::A_OUVERTURE :
+        case My::A_FERMETURE : {
+          cv::Mat dist = morphologie_sur_objet (affi)
+                       ? distance_objet_morpho (img_niv, dm, pm)
+                       : distance_fond_morpho (img_niv, dm, pm);
+          // Réécrit dans le buffer de img_niv, même taille et même type
+          effectuer_morphologie (affi, dist, dm, pm).convertTo (img_niv, CV_32SC1);
+          } break;
+        case My::A_GRANULO :
+          calculer_Rosenfeld_DT (img_niv, dm);
+          calculer_carte_granulo (img_niv, dm, img_niv);
+          break;
+        case My::A_ELAGAGE :
+          std::cout << effectuer_elagage (img_niv, dm, pe) << std::endl;
+          break;
         default : ;
     }
 }
 
+cv::Mat obtenir_etape (My &my, Etape etape);
+
+// Index des niveaux de gris de l'image source courante, reconstruit seulement
+// quand img_src a changé.
+const IndexNiveaux & obtenir_index_gris (My &my)
+{
+    if (my.index_gris.version != my.version_src)
+        my.index_gris.construire (obtenir_etape (my, E_GRIS), my.version_src);
+    return my.index_gris;
+}
+
+// Résultat de l'étape pour l'état courant de my, calculé à partir des étapes
+// précédentes et mémorisé dans le cache. Il est partagé avec le cache :
+// ne pas le modifier.
+cv::Mat obtenir_etape (My &my, Etape etape)
+{
+    NumeroMasque masque = my.dm_cour->num_masque;
+    CleEtape cle = { etape, my.version_src, my.seuil, masque };
+    if (etape == E_DIST_OBJET && my.morpho.euclidienne) cle.masque = M_LAST;
+    if (etape == E_GRIS) cle.seuil = 0;
+    if (etape == E_GRIS || etape == E_BINAIRE || etape == E_SEDT
+        || etape == E_COURBES || etape == E_EFT) cle.masque = 0;
+
+    cv::Mat res;
+    if (my.cache.chercher (cle, res)) return res;
+
+    switch (etape) {
+        case E_GRIS :
+            cv::cvtColor (my.img_src, res, cv::COLOR_BGR2GRAY);
+            break;
+        case E_BINAIRE : {
+            // Re-seuillage incrémental depuis le seuil précédent s'il est en cache
+            CleEtape prec = cle; prec.seuil = my.seuil_bin_prec;
+            if (my.seuil_bin_prec >= 0 && my.cache.extraire (prec, res)) {
+                reseuiller_binaire (res, obtenir_index_gris (my),
+                                    my.seuil_bin_prec, my.seuil);
+            } else {
+                // Reste en CV_8UC1 : les étapes suivantes convertissent
+                cv::threshold (obtenir_etape (my, E_GRIS), res, my.seuil, 255,
+                               cv::THRESH_BINARY);
+            }
+            my.seuil_bin_prec = my.seuil;
+          } break;
+        case E_DT : {
+            // Réparation locale de la DT du seuil précédent si elle est en cache
+            CleEtape prec = cle; prec.seuil = my.seuil_dt_prec;
+            if (my.seuil_dt_prec >= 0 && my.cache.extraire (prec, res)) {
+                int nb;
+                const int *pix = obtenir_index_gris (my).bascules
+                                   (my.seuil_dt_prec, my.seuil, nb);
+                reparer_Rosenfeld_DT (res, pix, nb, my.seuil > my.seuil_dt_prec,
+                                      my.dm_cour);
+            } else {
+                cv::Mat img_bin = obtenir_etape (my, E_BINAIRE);
+                img_bin.convertTo (res, type_Rosenfeld_DT (img_bin.rows,
+                                   img_bin.cols, my.dm_cour));
+                calculer_Rosenfeld_DT (res, my.dm_cour);
+            }
+            my.seuil_dt_prec = my.seuil;
+          } break;
+        case E_MAXIMA :
+            res = obtenir_etape (my, E_DT).clone();
+            detecter_maximum_locaux (res, my.dm_cour);
+            break;
+        case E_RDT :
+            obtenir_etape (my, E_DT).convertTo (res, CV_32SC1);
+            extraire_axe_median (res, my.dm_cour);
+            calculer_Rosenfeld_RDT (res, my.dm_cour);
+            break;
+        case E_SEDT :
+            obtenir_etape (my, E_BINAIRE).convertTo (res, CV_32SC1);
+            calculer_sedt_saito_toriwaki (res);
+            break;
+        case E_COURBES :
+            res = obtenir_etape (my, E_SEDT).clone();
+            calculer_sedt_courbes_niveau (res);
+            break;
+        case E_EFT :
+            calculer_eft (obtenir_etape (my, E_BINAIRE), res);
+            break;
+        case E_DIST_OBJET :
+            res = distance_objet_morpho (obtenir_etape (my, E_BINAIRE),
+                                         my.dm_cour, my.morpho);
+            break;
+    }
+    my.cache.ranger (cle, res);
+    return res;
+}
+
+// Nouvelle image img_niv pour la transformation courante, à partir de l'image
+// source seuillée ; les transformations sans étape en cache sont recalculées.
+cv::Mat calculer_img_niv (My &my)
+{
+    Etape etape;
+    switch (my.affi) {
+        case My::A_TRANS1 : etape = E_DT;      break;
+        case My::A_TRANS2 : etape = E_MAXIMA;  break;
+        case My::A_TRANS3 : etape = E_RDT;     break;
+        case My::A_TRANS5 : etape = E_SEDT;    break;
+        case My::A_TRANS6 : etape = E_COURBES; break;
+        case My::A_TRANS7 :
+        case My::A_TRANS8 : {
+            // Dérivées de l'EFT en cache, sans cache propre : un seul balayage
+            cv::Mat img;
+            obtenir_etape (my, E_BINAIRE).convertTo (img, CV_32SC1);
+            if (my.affi == My::A_TRANS7)
+                calculer_sedt_eft (obtenir_etape (my, E_EFT), img);
+            else calculer_voronoi_eft (obtenir_etape (my, E_EFT), img);
+            return img;
+          }
+        case My::A_EROSION :
+        case My::A_DILATATION :
+        case My::A_OUVERTURE :
+        case My::A_FERMETURE : {
+            // Les distances sont en cache : changer de rayon ne coûte qu'un
+            // seuillage (plus une DT pour l'ouverture et la fermeture)
+            cv::Mat dist;
+            if (morphologie_sur_objet (my.affi))
+                dist = obtenir_etape (my, E_DIST_OBJET);
+            else if (!my.morpho.euclidienne)
+                dist = obtenir_etape (my, E_DT);
+            else {
+                obtenir_etape (my, E_BINAIRE).convertTo (dist, CV_32SC1);
+                calculer_sedt_eft (obtenir_etape (my, E_EFT), dist);
+                borner_sedt_au_bord (dist);
+            }
+            cv::Mat img;
+            effectuer_morphologie (my.affi, dist, my.dm_cour, my.morpho)
+                .convertTo (img, CV_32SC1);
+            return img;
+          }
+        case My::A_GRANULO : {
+            cv::Mat img (my.img_src.rows, my.img_src.cols, CV_32SC1);
+            calculer_carte_granulo (obtenir_etape (my, E_DT), my.dm_cour, img);
+            return img;
+          }
+        case My::A_ELAGAGE : {
+            cv::Mat img (my.img_src.rows, my.img_src.cols, CV_32SC1);
+            cv::Mat dt = obtenir_etape (my, E_DT);
+            BilanElagage bilan;
+            std::vector<BouleMediane> boules = elaguer_axe_median (dt,
+                obtenir_etape (my, E_EFT), my.dm_cour, my.elagage, bilan);
+            representer_elagage (dt, boules, my.dm_cour, img, bilan);
+            std::cout << bilan << std::endl;
+            return img;
+          }
+        default : {
+            cv::Mat img;
+            obtenir_etape (my, E_BINAIRE).convertTo (img, CV_32SC1);
+            effectuer_transformations (my.affi, img, my.dm_cour);
+            return img;
+        }
+    }
+    // Les étapes peuvent être en type étroit, l'affichage est en CV_32SC1
+    cv::Mat img;
+    obtenir_etape (my, etape).convertTo (img, CV_32SC1);
+    return img;
+}
+
+
+//----------------------- C A L C U L   D E   F O N D -------------------------
+
+// Les transformations tournent dans un fil de calcul, pour que les fenêtres
+// restent réactives. La boucle d'événements dépose une demande (copie des
+// paramètres de my) ; une demande plus récente annule celle en cours. Les
+// images terminées reviennent par un triple tampon sans verrou : l'affichage
+// prend toujours la dernière terminée, sans jamais attendre.
+
+struct Trame
+{
+    cv::Mat img_niv, img_coul;
+};
+
+class TripleTampon
+{
+  public :
+    // Côté producteur : remplir arriere() puis publier()
+    Trame & arriere () { return trames[arr]; }
+    void publier ()
+    {
+        arr = milieu.exchange (arr | NOUVELLE, std::memory_order_acq_rel) & INDICE;
+    }
+
+    // Côté consommateur : true si une trame plus récente est dans avant()
+    bool recuperer ()
+    {
+        if (!(milieu.load (std::memory_order_acquire) & NOUVELLE)) return false;
+        av = milieu.exchange (av, std::memory_order_acq_rel) & INDICE;
+        return true;
+    }
+    Trame & avant () { return trames[av]; }
+
+  private :
+    enum { INDICE = 3, NOUVELLE = 4 };
+    Trame trames[3];
+    int arr = 0, av = 1;
+    std::atomic<int> milieu {2};
+};
+
+class CalculFond
+{
+  public :
+    void demarrer (size_t budget_cache)
+    {
+        calc.cache.fixer_budget (budget_cache);
+        fil = std::thread (&CalculFond::boucle, this);
+    }
+
+    void arreter ()
+    {
+        {
+            std::lock_guard<std::mutex> verrou (mutex);
+            fin = true;
+        }
+        derniere_demande++;
+        cond.notify_one();
+        if (fil.joinable()) fil.join();
+    }
+
+    // Dépose une demande pour l'état courant de my ; remplace celle en attente
+    // et annule celle en cours.
+    void demander (const My &my)
+    {
+        std::lock_guard<std::mutex> verrou (mutex);
+        travail.numero = ++derniere_demande;
+        travail.img_src = my.img_src;
+        travail.version_src = my.version_src;
+        travail.seuil = my.seuil;
+        travail.affi = my.affi;
+        travail.masque = my.dm_cour->num_masque;
+        travail.morpho = my.morpho;
+        travail.elagage = my.elagage;
+        a_faire = true;
+        cond.notify_one();
+    }
+
+    // Dernière trame terminée, s'il y en a une nouvelle depuis l'appel précédent
+    bool recuperer (cv::Mat &img_niv, cv::Mat &img_coul)
+    {
+        if (!tampon.recuperer()) return false;
+        img_niv  = tampon.avant().img_niv;
+        img_coul = tampon.avant().img_coul;
+        return true;
+    }
+
+  private :
+    struct Travail {
+        unsigned numero = 0;
+        cv::Mat img_src;
+        int version_src = 0, seuil = 0;
+        My::Affi affi = My::A_ORIG;
+        NumeroMasque masque = M_D4;
+        ParamsMorpho morpho;
+        ParamsElagage elagage;
+    };
+
+    My calc;                                // état propre au fil de calcul
+    std::thread fil;
+    std::mutex mutex;
+    std::condition_variable cond;
+    Travail travail;
+    bool a_faire = false, fin = false;
+    std::atomic<unsigned> derniere_demande {0};
+    TripleTampon tampon;
+
+    void boucle ()
+    {
+        glob_derniere_demande = &derniere_demande;
+        for (;;) {
+            Travail t;
+            {
+                std::unique_lock<std::mutex> verrou (mutex);
+                cond.wait (verrou, [this] { return a_faire || fin; });
+                if (fin) return;
+                t = travail;
+                a_faire = false;
+            }
+            glob_demande_en_cours = t.numero;
+
+            calc.img_src = t.img_src;
+            calc.version_src = t.version_src;
+            calc.seuil = t.seuil;
+            calc.affi = t.affi;
+            calc.dm_cour = demi_masque (t.masque);
+            calc.morpho = t.morpho;
+            calc.elagage = t.elagage;
+            obtenir_index_gris (calc);
+            try {
+                // Les images sont neuves à chaque trame : l'affichage peut
+                // encore tenir celles de la trame précédente.
+                Trame &tr = tampon.arriere();
+                tr.img_niv = calculer_img_niv (calc);
+                if (t.affi == My::A_ORIG) tr.img_coul = t.img_src.clone();
+                else {
+                    tr.img_coul = cv::Mat (tr.img_niv.rows, tr.img_niv.cols, CV_8UC3);
+                    representer_en_couleurs_vga (tr.img_niv, tr.img_coul);
+                }
+                tampon.publier();
+            } catch (const Annulation &) {
+                // une demande plus récente attend déjà
+            } catch (const std::exception &e) {
+                std::cerr << "Calcul : " << e.what() << std::endl;
+            }
+        }
+    }
+};
+
 
 //---------------------------- C A L L B A C K S ------------------------------
 
@@ -629,6 +2294,16 @@ void afficher_aide() {
         "   1    affiche la transformation 1\n"
         "   2    affiche la transformation 2\n"
         "   3    affiche la transformation 3\n"
+        "   5    affiche la transformation 5\n"
+        "   6    affiche la transformation 6\n"
+        "   7    affiche la SEDT exacte (plus proche du fond)\n"
+        "   8    affiche le diagramme de Voronoï du fond\n"
+        "  e E   érosion, dilatation par un disque (slider Rayon)\n"
+        "  u U   ouverture, fermeture par un disque\n"
+        "   g    granulométrie : rayon de la plus grande ouverture\n"
+        "   m    axe médian élagué (sliders Lambda, Theta) et sa reconstruction\n"
+        "   d    change le masque de distance\n"
+        "   D    distance euclidienne ou du masque pour e E u U\n"
         "  esc   quitte\n"
     << std::endl;
 }
@@ -663,7 +2338,10 @@ int onKeyPressEvent (int key, void *data)
           } break;
         case 'i' :
             std::cout << "Couleurs inversées" << std::endl;
+            // nouvelle image : le fil de calcul lit peut-être encore l'ancienne
+            my->img_src = my->img_src.clone();
             inverser_couleurs(my->img_src);
+            my->version_src++;
             my->set_recalc(My::R_SEUIL);
             break;
         case 'o' :
@@ -706,32 +2384,56 @@ int onKeyPressEvent (int key, void *data)
             my->affi = My::A_TRANS6;
             my->set_recalc(My::R_SEUIL);
             break;
+        case '7' :
+            std::cout << "Transformation 7" << std::endl;
+            my->affi = My::A_TRANS7;
+            my->set_recalc(My::R_SEUIL);
+            break;
+        case '8' :
+            std::cout << "Transformation 8" << std::endl;
+            my->affi = My::A_TRANS8;
+            my->set_recalc(My::R_SEUIL);
+            break;
+        case 'e' :
+            std::cout << "Erosion" << std::endl;
+            my->affi = My::A_EROSION;
+            my->set_recalc(My::R_SEUIL);
+            break;
+        case 'E' :
+            std::cout << "Dilatation" << std::endl;
+            my->affi = My::A_DILATATION;
+            my->set_recalc(My::R_SEUIL);
+            break;
+        case 'u' :
+            std::cout << "Ouverture" << std::endl;
+            my->affi = My::A_OUVERTURE;
+            my->set_recalc(My::R_SEUIL);
+            break;
+        case 'U' :
+            std::cout << "Fermeture" << std::endl;
+            my->affi = My::A_FERMETURE;
+            my->set_recalc(My::R_SEUIL);
+            break;
+        case 'g' :
+            std::cout << "Granulometrie" << std::endl;
+            my->affi = My::A_GRANULO;
+            my->set_recalc(My::R_SEUIL);
+            break;
+        case 'm' :
+            std::cout << "Elagage de l'axe median" << std::endl;
+            my->affi = My::A_ELAGAGE;
+            my->set_recalc(My::R_SEUIL);
+            break;
+        case 'D' :
+            my->morpho.euclidienne = !my->morpho.euclidienne;
+            std::cout << "Morphologie : distance "
+                      << (my->morpho.euclidienne ? "euclidienne" : my->dm_cour->name)
+                      << std::endl;
+            my->set_recalc(My::R_SEUIL);
+            break;
         case 'd':
-            switch (my->m_cour)
-            {
-              case M_D4:
-              my->m_cour = M_D8;
-              break;
-              case M_D8:
-              my->m_cour = M_2_3;
-              break;
-              case M_2_3:
-              my->m_cour = M_3_4;
-              break;
-              case M_3_4:
-              my->m_cour = M_5_7_11;
-              break;
-              case M_5_7_11:
-              my->m_cour = M_LAST;
-              break;
-              case M_LAST:
-              my->m_cour = M_D4;
-              break;
-              default:
-              my->m_cour = M_D4;
-            }
-
-            my->dm_cour = new DemiMasque(my->m_cour);
+            my->m_cour = NumeroMasque ((my->m_cour + 1) % M_LAST);
+            my->dm_cour = demi_masque (my->m_cour);
 
             std::cout<<"MASQUE : "<<my->dm_cour->name<<std::endl;
             my->set_recalc(My::R_SEUIL);
@@ -745,17 +2447,679 @@ int onKeyPressEvent (int key, void *data)
 }
 
 
+//------------------------------- B A T C H -----------------------------------
+
+// Mode sans fenêtre : applique une transformation à une liste d'images, en
+// parallèle sur un groupe de threads, et enregistre les résultats en couleurs.
+
+struct ParamsBatch
+{
+    char touche = '1';                // touche de la transformation
+    My::Affi affi = My::A_TRANS1;
+    int seuil = 127;
+    NumeroMasque masque = M_D4;
+    ParamsMorpho morpho;
+    ParamsElagage elagage;
+    int nb_threads = 0;               // 0 : nombre de coeurs
+    const char *dossier_sortie = NULL;
+    std::vector<std::string> images;
+};
+
+// Même correspondance touche -> transformation que onKeyPressEvent
+bool affi_depuis_touche (char touche, My::Affi *affi)
+{
+    switch (touche) {
+        case 'o' : *affi = My::A_ORIG;   return true;
+        case 's' : *affi = My::A_SEUIL;  return true;
+        case '1' : *affi = My::A_TRANS1; return true;
+        case '2' : *affi = My::A_TRANS2; return true;
+        case '3' : *affi = My::A_TRANS3; return true;
+        case '5' : *affi = My::A_TRANS5; return true;
+        case '6' : *affi = My::A_TRANS6; return true;
+        case '7' : *affi = My::A_TRANS7; return true;
+        case '8' : *affi = My::A_TRANS8; return true;
+        case 'e' : *affi = My::A_EROSION;    return true;
+        case 'E' : *affi = My::A_DILATATION; return true;
+        case 'u' : *affi = My::A_OUVERTURE;  return true;
+        case 'U' : *affi = My::A_FERMETURE;  return true;
+        case 'g' : *affi = My::A_GRANULO;    return true;
+        case 'm' : *affi = My::A_ELAGAGE;    return true;
+    }
+    return false;
+}
+
+// Ajoute à la liste un fichier image, le contenu d'un dossier, ou les lignes
+// d'un fichier liste .txt
+void lister_images (const char *nom, std::vector<std::string> &liste)
+{
+    DIR *dir = opendir (nom);
+    if (dir) {
+        std::vector<std::string> noms;
+        struct dirent *ent;
+        while ((ent = readdir (dir)) != NULL)
+            if (ent->d_name[0] != '.')
+                noms.push_back (std::string(nom) + "/" + ent->d_name);
+        closedir (dir);
+        std::sort (noms.begin(), noms.end());
+        liste.insert (liste.end(), noms.begin(), noms.end());
+        return;
+    }
+    size_t n = strlen (nom);
+    if (n > 4 && !strcmp (nom + n - 4, ".txt")) {
+        std::ifstream f (nom);
+        std::string ligne;
+        while (std::getline (f, ligne))
+            if (!ligne.empty()) liste.push_back (ligne);
+        return;
+    }
+    liste.push_back (nom);
+}
+
+std::string nom_sortie_batch (const ParamsBatch &pb, const std::string &nom_in,
+    const char *extension = ".png")
+{
+    size_t d = nom_in.find_last_of ('/');
+    std::string base = d == std::string::npos ? nom_in : nom_in.substr (d+1);
+    size_t p = base.find_last_of ('.');
+    if (p != std::string::npos) base = base.substr (0, p);
+    return std::string(pb.dossier_sortie) + "/" + base + "_" + pb.touche + extension;
+}
+
+bool traiter_image_batch (const ParamsBatch &pb, const std::string &nom_in)
+{
+    cv::Mat img_src = cv::imread (nom_in, cv::IMREAD_COLOR);
+    if (img_src.empty()) return false;
+
+    cv::Mat img_coul;
+    if (pb.affi == My::A_ORIG) img_coul = img_src;
+    else {
+        cv::Mat img_gry, img_niv;
+        cv::cvtColor (img_src, img_gry, cv::COLOR_BGR2GRAY);
+        cv::threshold (img_gry, img_gry, pb.seuil, 255, cv::THRESH_BINARY);
+        img_gry.convertTo (img_niv, CV_32SC1,1., 0.);
+        if (pb.affi == My::A_ELAGAGE) {
+            // Bilan en CSV plutôt que sur cout, partagé entre les fils
+            BilanElagage bilan = effectuer_elagage (img_niv,
+                demi_masque (pb.masque), pb.elagage);
+            if (!ecrire_elagage_csv (nom_sortie_batch (pb, nom_in, ".csv"), bilan))
+                return false;
+        } else if (pb.affi == My::A_TRANS7 || pb.affi == My::A_TRANS8) {
+            // EFT calculée une fois pour l'image et pour ses plans de
+            // coordonnées, en PNG 8 ou 16 bits
+            cv::Mat ft, fy, fx;
+            calculer_eft (img_niv, ft);
+            if (pb.affi == My::A_TRANS7) calculer_sedt_eft (ft, img_niv);
+            else calculer_voronoi_eft (ft, img_niv);
+            separer_coordonnees_eft (ft, fy, fx);
+            if (!cv::imwrite (nom_sortie_batch (pb, nom_in, "_fy.png"), fy) ||
+                !cv::imwrite (nom_sortie_batch (pb, nom_in, "_fx.png"), fx))
+                return false;
+        } else
+            effectuer_transformations (pb.affi, img_niv, demi_masque (pb.masque),
+                                       pb.morpho);
+        img_coul = cv::Mat(img_src.rows, img_src.cols, CV_8UC3);
+        representer_en_couleurs_vga (img_niv, img_coul);
+        if (pb.affi == My::A_GRANULO &&
+            !ecrire_granulo_csv (nom_sortie_batch (pb, nom_in, ".csv"),
+                                 spectre_granulo (img_niv)))
+            return false;
+    }
+    return cv::imwrite (nom_sortie_batch (pb, nom_in), img_coul);
+}
+
+int effectuer_batch (const ParamsBatch &pb)
+{
+    int nb_threads = pb.nb_threads;
+    if (nb_threads <= 0) nb_threads = std::thread::hardware_concurrency();
+    if (nb_threads <= 0) nb_threads = 1;
+    glob_nb_threads_couleurs = 1;
+    glob_nb_threads_calcul = 1;
+
+    // Les transformations écrivent sur std::cout : on le rend muet (badbit)
+    // pendant le batch, les messages passent par std::cerr.
+    std::streambuf *cout_buf = std::cout.rdbuf (NULL);
+
+    std::atomic<unsigned> suivante (0);
+    std::atomic<int> nb_erreurs (0);
+    std::mutex mutex_log;
+    int64 t0 = cv::getTickCount();
+
+    auto travailleur = [&] () {
+        for (;;) {
+            unsigned k = suivante++;
+            if (k >= pb.images.size()) break;
+            const std::string &nom_in = pb.images[k];
+            bool ok;
+            try {
+                ok = traiter_image_batch (pb, nom_in);
+            } catch (const std::exception &e) {
+                std::lock_guard<std::mutex> verrou (mutex_log);
+                std::cerr << nom_in << " : " << e.what() << std::endl;
+                ok = false;
+            }
+            std::lock_guard<std::mutex> verrou (mutex_log);
+            if (!ok) {
+                nb_erreurs++;
+                std::cerr << "Erreur sur " << nom_in << std::endl;
+            } else std::cerr << nom_in << " -> " << nom_sortie_batch (pb, nom_in)
+                             << std::endl;
+        }
+    };
+
+    std::vector<std::thread> groupe;
+    for (int i = 0; i < nb_threads; i++)
+        groupe.emplace_back (travailleur);
+    for (auto &t : groupe) t.join();
+
+    std::cout.rdbuf (cout_buf);
+    double ms = (cv::getTickCount() - t0) * 1000. / cv::getTickFrequency();
+    std::cerr << pb.images.size() << " images en " << ms << " ms sur "
+              << nb_threads << " threads, " << nb_erreurs << " erreurs"
+              << std::endl;
+    return nb_erreurs > 0 ? 1 : 0;
+}
+
+
+//---------------------------- S E Q U E N C E S ------------------------------
+
+// Mode vidéo : applique une transformation à chaque trame d'une vidéo ou
+// d'une suite d'images (motif printf, ex. trame_%04d.png), en chaîne de 4
+// étages sur des threads distincts : décodage -> seuillage -> transformation
+// -> encodage. Les trames circulent par des files bloquantes ; un lot fixe de
+// SEQ_NB_TRAMES trames est recyclé, si bien que les buffers ne sont alloués
+// qu'à la première trame. Le masque binaire est découpé en tuiles de
+// SEQ_TUILE pixels de côté dont on calcule une empreinte : si toutes les
+// empreintes sont identiques à celles de la trame précédente, le résultat
+// précédent est recopié sans relancer la transformation (une DT n'est pas
+// locale : un pixel modifié peut changer les distances dans tout l'objet).
+
+const int SEQ_TUILE = 64;
+const int SEQ_NB_TRAMES = 6;
+
+struct ParamsSequence
+{
+    char touche = '1';
+    My::Affi affi = My::A_TRANS1;
+    int seuil = 127;
+    NumeroMasque masque = M_D4;
+    ParamsMorpho morpho;
+    ParamsElagage elagage;
+    const char *entree = NULL;        // fichier vidéo ou motif printf
+    const char *sortie = NULL;        // idem ; motif si contient '%'
+    double fps = 25;                  // repris de la vidéo d'entrée
+};
+
+struct TrameSequence
+{
+    int numero = 0;
+    cv::Mat img_src, img_gry, img_bin, img_niv, img_coul;
+    std::vector<uint64_t> empreintes;
+};
+
+// File bloquante ; NULL marque la fin du flux
+class FileTrames
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<TrameSequence *> file;
+  public:
+    void deposer (TrameSequence *t)
+    {
+        { std::lock_guard<std::mutex> verrou (mutex); file.push_back (t); }
+        cond.notify_one();
+    }
+    TrameSequence *retirer ()
+    {
+        std::unique_lock<std::mutex> verrou (mutex);
+        cond.wait (verrou, [this] { return !file.empty(); });
+        TrameSequence *t = file.front();
+        file.pop_front();
+        return t;
+    }
+};
+
+// Empreinte FNV-1a par tuile, sur des mots de 8 octets
+void calculer_empreintes_tuiles (cv::Mat img_bin, std::vector<uint64_t> &emp)
+{
+    CHECK_MAT_TYPE(img_bin, CV_8UC1)
+    int nt_x = (img_bin.cols + SEQ_TUILE-1) / SEQ_TUILE,
+        nt_y = (img_bin.rows + SEQ_TUILE-1) / SEQ_TUILE;
+    emp.assign (size_t(nt_x) * nt_y, 14695981039346656037ULL);
+
+    for (int y = 0; y < img_bin.rows; y++) {
+        const unsigned char *ligne = img_bin.ptr<unsigned char>(y);
+        uint64_t *e = &emp[size_t(y / SEQ_TUILE) * nt_x];
+        for (int tx = 0; tx < nt_x; tx++) {
+            int x0 = tx * SEQ_TUILE, x1 = std::min (x0 + SEQ_TUILE, img_bin.cols);
+            uint64_t h = e[tx];
+            int x = x0;
+            for (; x + 8 <= x1; x += 8) {
+                uint64_t mot;
+                memcpy (&mot, ligne + x, 8);
+                h = (h ^ mot) * 1099511628211ULL;
+            }
+            for (; x < x1; x++)
+                h = (h ^ ligne[x]) * 1099511628211ULL;
+            e[tx] = h;
+        }
+    }
+}
+
+bool ecrire_trame_sequence (const ParamsSequence &ps, cv::VideoWriter &video,
+    const TrameSequence &t)
+{
+    if (!strchr (ps.sortie, '%')) {
+        if (!video.isOpened() &&
+            !video.open (ps.sortie, cv::VideoWriter::fourcc('M','J','P','G'),
+                         ps.fps, t.img_coul.size(), true))
+            return false;
+        video.write (t.img_coul);
+        return true;
+    }
+    char nom[1024];
+    snprintf (nom, sizeof(nom), ps.sortie, t.numero);
+    return cv::imwrite (nom, t.img_coul);
+}
+
+int effectuer_sequence (ParamsSequence &ps)
+{
+    cv::VideoCapture cap (ps.entree);
+    if (!cap.isOpened()) {
+        std::cerr << "Erreur d'ouverture de " << ps.entree << std::endl;
+        return 1;
+    }
+    double fps = cap.get (cv::CAP_PROP_FPS);
+    if (fps > 0) ps.fps = fps;
+    glob_nb_threads_couleurs = 1;
+    std::streambuf *cout_buf = std::cout.rdbuf (NULL);
+
+    TrameSequence trames[SEQ_NB_TRAMES];
+    FileTrames libres, a_seuiller, a_transformer, a_encoder;
+    for (int i = 0; i < SEQ_NB_TRAMES; i++) libres.deposer (&trames[i]);
+
+    int nb_reutilisees = 0;
+    std::atomic<bool> echec (false);
+    int64 t0 = cv::getTickCount();
+
+    // Décodage : read() réécrit dans le buffer de la trame s'il a déjà la
+    // bonne taille
+    std::thread decodeur ([&] () {
+        for (int numero = 0; ; numero++) {
+            TrameSequence *t = libres.retirer();
+            if (echec || !cap.read (t->img_src) || t->img_src.empty()) {
+                a_seuiller.deposer (NULL);
+                return;
+            }
+            t->numero = numero;
+            a_seuiller.deposer (t);
+        }
+    });
+
+    std::thread seuilleur ([&] () {
+        for (;;) {
+            TrameSequence *t = a_seuiller.retirer();
+            if (t == NULL) { a_transformer.deposer (NULL); return; }
+            if (t->img_src.channels() == 3)
+                cv::cvtColor (t->img_src, t->img_gry, cv::COLOR_BGR2GRAY);
+            else t->img_src.copyTo (t->img_gry);
+            cv::threshold (t->img_gry, t->img_bin, ps.seuil, 255,
+                cv::THRESH_BINARY);
+            calculer_empreintes_tuiles (t->img_bin, t->empreintes);
+            a_transformer.deposer (t);
+        }
+    });
+
+    // Transformation : garde le masque et le résultat de la trame précédente
+    std::thread transformeur ([&] () {
+        std::vector<uint64_t> empreintes_prec;
+        cv::Mat img_coul_prec;
+        for (;;) {
+            TrameSequence *t = a_transformer.retirer();
+            if (t == NULL) { a_encoder.deposer (NULL); return; }
+            try {
+                if (!img_coul_prec.empty() && t->empreintes == empreintes_prec
+                    && img_coul_prec.size() == t->img_src.size()) {
+                    img_coul_prec.copyTo (t->img_coul);
+                    nb_reutilisees++;
+                } else {
+                    if (ps.affi == My::A_ORIG)
+                        t->img_src.copyTo (t->img_coul);
+                    else {
+                        t->img_bin.convertTo (t->img_niv, CV_32SC1, 1., 0.);
+                        effectuer_transformations (ps.affi, t->img_niv,
+                            demi_masque (ps.masque), ps.morpho, ps.elagage);
+                        t->img_coul.create (t->img_src.rows, t->img_src.cols,
+                            CV_8UC3);
+                        representer_en_couleurs_vga (t->img_niv, t->img_coul);
+                    }
+                    t->img_coul.copyTo (img_coul_prec);
+                    empreintes_prec = t->empreintes;
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Trame " << t->numero << " : " << e.what()
+                          << std::endl;
+                echec = true;
+            }
+            a_encoder.deposer (t);
+        }
+    });
+
+    // Encodage dans le thread principal
+    cv::VideoWriter video;
+    int nb_trames = 0;
+    for (;;) {
+        TrameSequence *t = a_encoder.retirer();
+        if (t == NULL) break;
+        if (!echec && !ecrire_trame_sequence (ps, video, *t)) {
+            std::cerr << "Erreur d'écriture de " << ps.sortie << std::endl;
+            echec = true;
+        }
+        nb_trames++;
+        libres.deposer (t);
+    }
+    decodeur.join(); seuilleur.join(); transformeur.join();
+
+    std::cout.rdbuf (cout_buf);
+    double ms = (cv::getTickCount() - t0) * 1000. / cv::getTickFrequency();
+    std::cerr << nb_trames << " trames en " << ms << " ms ("
+              << (ms > 0 ? nb_trames * 1000. / ms : 0.) << " trames/s), "
+              << nb_reutilisees << " reprises sans recalcul" << std::endl;
+    return echec ? 1 : 0;
+}
+
+
+//--------------------------- B E N C H M A R K -------------------------------
+
+// Banc de mesures sans fenêtre, compilé à part avec -DBENCHMARK (cible
+// "bench" du Makefile) : DT et RDT de Rosenfeld pour chaque masque du
+// catalogue, et SEDT, sur le corpus puis sur des agrandissements de 1 à
+// 64 Mpix. Même format CSV et JSON que le banc du TP4.
+
+struct ParamsBench
+{
+    int seuil = 127;
+    int nb_chauffe = 1;               // exécutions non mesurées
+    int nb_repet = 5;                 // exécutions mesurées
+    int mpix_max = 64;                // 0 : pas d'images synthétiques
+    std::string filtre;               // sous-chaîne du nom des cas, "" : tous
+    std::string etiquette = __DATE__ " " __TIME__;
+    std::string prefixe = "bench_tp6";
+    std::vector<std::string> images;
+};
+
+struct CasBench
+{
+    std::string nom;
+    std::function<void(cv::Mat &)> preparer; // hors chrono, peut changer le type
+    std::function<void(cv::Mat)> mesurer;
+};
+
+struct ResultatBench
+{
+    std::string image, cas;
+    int rows, cols;
+    double ms_min, ms_med;
+    long pic_ko;
+};
+
+// Pic de mémoire résidente depuis la dernière remise à zéro (VmHWM) ; à
+// défaut, pic depuis le lancement du processus.
+void remettre_pic_memoire ()
+{
+    std::ofstream f ("/proc/self/clear_refs");
+    if (f) f << "5";
+}
+
+long lire_pic_memoire_ko ()
+{
+    std::ifstream f ("/proc/self/status");
+    std::string ligne;
+    while (std::getline (f, ligne))
+        if (!ligne.compare (0, 6, "VmHWM:"))
+            return atol (ligne.c_str() + 6);
+    struct rusage ru;
+    getrusage (RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+cv::Mat binariser_bench (const cv::Mat &img_src, int seuil)
+{
+    cv::Mat img_gry, img_niv;
+    cv::cvtColor (img_src, img_gry, cv::COLOR_BGR2GRAY);
+    cv::threshold (img_gry, img_gry, seuil, 255, cv::THRESH_BINARY);
+    img_gry.convertTo (img_niv, CV_32SC1,1., 0.);
+    return img_niv;
+}
+
+std::vector<CasBench> lister_cas_bench ()
+{
+    auto rien = [] (cv::Mat) {};
+    std::vector<CasBench> cas;
+    for (const DemiMasque &m : catalogue_masques) {
+        const DemiMasque *dm = &m;
+        auto dt = [dm] (cv::Mat img) { calculer_Rosenfeld_DT (img, dm); };
+        cas.push_back ({ std::string("rosenfeld_dt_") + m.name, rien, dt });
+        cas.push_back ({ std::string("rosenfeld_dt_etroite_") + m.name,
+            [dm] (cv::Mat &img) {
+                img.convertTo (img, type_Rosenfeld_DT (img.rows, img.cols, dm)); },
+            dt });
+        auto axe = [dm] (cv::Mat &img) {
+            calculer_Rosenfeld_DT (img, dm); extraire_axe_median (img, dm); };
+        cas.push_back ({ std::string("rosenfeld_rdt_") + m.name, axe,
+            [dm] (cv::Mat img) { calculer_Rosenfeld_RDT_tuiles (img, dm, 1); } });
+        cas.push_back ({ std::string("rosenfeld_rdt_tuiles_") + m.name, axe,
+            [dm] (cv::Mat img) { calculer_Rosenfeld_RDT (img, dm); } });
+    }
+    cas.push_back ({ "sedt_saito_toriwaki", rien, calculer_sedt_saito_toriwaki });
+    cas.push_back ({ "sedt_courbes_niveau", rien, [] (cv::Mat img) {
+        calculer_sedt_saito_toriwaki (img);
+        calculer_sedt_courbes_niveau (img); } });
+    cas.push_back ({ "eft", rien, [] (cv::Mat img) {
+        cv::Mat ft; calculer_eft (img, ft); } });
+    cas.push_back ({ "sedt_eft", rien, [] (cv::Mat img) {
+        cv::Mat ft; calculer_eft (img, ft); calculer_sedt_eft (ft, img); } });
+    for (NumeroMasque m : { M_D8, M_5_7_11 }) {
+        const DemiMasque *dm = demi_masque (m);
+        cas.push_back ({ std::string("granulometrie_") + dm->name,
+            [dm] (cv::Mat &img) { calculer_Rosenfeld_DT (img, dm); },
+            [dm] (cv::Mat img) {
+                cv::Mat carte (img.rows, img.cols, CV_32SC1);
+                calculer_carte_granulo (img, dm, carte);
+                spectre_granulo (carte); } });
+    }
+    for (NumeroMasque m : { M_D8, M_5_7_11 }) {
+        const DemiMasque *dm = demi_masque (m);
+        cas.push_back ({ std::string("elagage_") + dm->name, rien,
+            [dm] (cv::Mat img) { effectuer_elagage (img, dm, ParamsElagage()); } });
+    }
+    // Même coût attendu pour les deux rayons
+    for (int rayon : { 20, 200 })
+    for (bool euclidienne : { false, true }) {
+        ParamsMorpho pm;
+        pm.rayon = rayon;
+        pm.euclidienne = euclidienne;
+        const DemiMasque *dm = demi_masque (M_5_7_11);
+        std::string suffixe = std::string(euclidienne ? "euclidienne" : dm->name)
+                            + "_r" + std::to_string (rayon);
+        cas.push_back ({ "ouverture_" + suffixe, rien, [dm, pm] (cv::Mat img) {
+            effectuer_transformations (My::A_OUVERTURE, img, dm, pm); } });
+    }
+    return cas;
+}
+
+ResultatBench mesurer_cas_bench (const ParamsBench &pb, const CasBench &c,
+    const std::string &nom_image, const cv::Mat &img_bin)
+{
+    remettre_pic_memoire();
+    std::vector<double> durees;
+    for (int k = 0; k < pb.nb_chauffe + pb.nb_repet; k++) {
+        cv::Mat img = img_bin.clone();
+        c.preparer (img);
+        int64 t0 = cv::getTickCount();
+        c.mesurer (img);
+        int64 t1 = cv::getTickCount();
+        if (k >= pb.nb_chauffe)
+            durees.push_back ((t1 - t0) * 1000. / cv::getTickFrequency());
+    }
+    std::sort (durees.begin(), durees.end());
+
+    ResultatBench r;
+    r.image = nom_image;
+    r.cas = c.nom;
+    r.rows = img_bin.rows;
+    r.cols = img_bin.cols;
+    r.ms_min = durees.front();
+    r.ms_med = durees[durees.size() / 2];
+    r.pic_ko = lire_pic_memoire_ko();
+    return r;
+}
+
+// Agrandissements au plus proche voisin de l'image binaire : les formes sont
+// conservées, seule leur échelle change.
+std::vector<std::pair<std::string, cv::Mat>> images_synthetiques_bench (
+    const std::string &nom, const cv::Mat &img_bin, int mpix_max)
+{
+    std::vector<std::pair<std::string, cv::Mat>> liste;
+    for (int mpix = 1; mpix <= mpix_max; mpix *= 2) {
+        double f = sqrt (mpix * 1e6 / img_bin.total());
+        cv::Mat img;
+        cv::resize (img_bin, img, cv::Size (int(img_bin.cols * f + .5),
+            int(img_bin.rows * f + .5)), 0, 0, cv::INTER_NEAREST);
+        liste.push_back ({ nom + "@" + std::to_string(mpix) + "Mpix", img });
+    }
+    return liste;
+}
+
+void ecrire_resultats_bench (const ParamsBench &pb,
+    const std::vector<ResultatBench> &res)
+{
+    std::ofstream csv (pb.prefixe + ".csv");
+    csv << "etiquette,image,cas,rows,cols,repet,ms_min,ms_med,mpix_s,ns_pixel,"
+           "pic_rss_ko\n";
+    std::ofstream json (pb.prefixe + ".json");
+    json << "{\n  \"etiquette\": \"" << pb.etiquette << "\",\n"
+         << "  \"chauffe\": " << pb.nb_chauffe << ",\n"
+         << "  \"repet\": " << pb.nb_repet << ",\n  \"mesures\": [";
+
+    for (unsigned int i = 0; i < res.size(); i++) {
+        const ResultatBench &r = res[i];
+        double pix = double(r.rows) * r.cols;
+        double mpix_s = r.ms_med > 0 ? pix / (r.ms_med * 1e3) : 0;
+        double ns_pixel = r.ms_med * 1e6 / pix;
+        csv << pb.etiquette << "," << r.image << "," << r.cas << ","
+            << r.rows << "," << r.cols << "," << pb.nb_repet << ","
+            << r.ms_min << "," << r.ms_med << "," << mpix_s << ","
+            << ns_pixel << "," << r.pic_ko << "\n";
+        json << (i ? ",\n" : "\n") << "    { \"image\": \"" << r.image
+             << "\", \"cas\": \"" << r.cas << "\", \"rows\": " << r.rows
+             << ", \"cols\": " << r.cols << ", \"ms_min\": " << r.ms_min
+             << ", \"ms_med\": " << r.ms_med << ", \"mpix_s\": " << mpix_s
+             << ", \"ns_pixel\": " << ns_pixel << ", \"pic_rss_ko\": "
+             << r.pic_ko << " }";
+    }
+    json << "\n  ]\n}\n";
+    std::cerr << res.size() << " mesures dans " << pb.prefixe << ".csv et "
+              << pb.prefixe << ".json" << std::endl;
+}
+
+int effectuer_bench (const ParamsBench &pb)
+{
+    std::vector<std::pair<std::string, cv::Mat>> entrees;
+    for (const std::string &nom : pb.images) {
+        cv::Mat img_src = cv::imread (nom, cv::IMREAD_COLOR);
+        if (img_src.empty()) {
+            std::cerr << "Ignoré : " << nom << std::endl;
+            continue;
+        }
+        entrees.push_back ({ nom, binariser_bench (img_src, pb.seuil) });
+    }
+    if (entrees.empty()) {
+        std::cerr << "Aucune image lisible" << std::endl;
+        return 1;
+    }
+    auto synth = images_synthetiques_bench (entrees[0].first,
+        entrees[0].second, pb.mpix_max);
+    entrees.insert (entrees.end(), synth.begin(), synth.end());
+
+    glob_nb_threads_couleurs = 1;
+    std::vector<CasBench> cas = lister_cas_bench();
+    std::vector<ResultatBench> res;
+
+    // std::cout muet pendant les mesures, comme en batch
+    std::streambuf *cout_buf = std::cout.rdbuf (NULL);
+    for (auto &e : entrees)
+    for (const CasBench &c : cas) {
+        if (c.nom.find (pb.filtre) == std::string::npos) continue;
+        res.push_back (mesurer_cas_bench (pb, c, e.first, e.second));
+        std::cerr << e.first << " " << c.nom << " : " << res.back().ms_med
+                  << " ms" << std::endl;
+    }
+    std::cout.rdbuf (cout_buf);
+
+    ecrire_resultats_bench (pb, res);
+    return 0;
+}
+
+int main_bench (int argc, char**argv)
+{
+    ParamsBench pb;
+    char *nom_prog = argv[0];
+    auto usage = [nom_prog] () {
+        std::cerr << "Usage: " << nom_prog << " [-thr seuil]"
+                  << " [-w chauffe] [-r repet] [-mpix max] [-cas filtre]"
+                  << " [-tag etiquette] [-o prefixe] [in1|dossier|liste.txt ...]"
+                  << "\n  par défaut ../IMAGES" << std::endl;
+        return 1;
+    };
+
+    while (argc-1 > 0 && argv[1][0] == '-') {
+        if (argc-1 < 2) return usage();
+        std::string opt = argv[1];
+        if      (opt == "-thr")  pb.seuil      = atoi(argv[2]);
+        else if (opt == "-w")    pb.nb_chauffe = atoi(argv[2]);
+        else if (opt == "-r")    pb.nb_repet   = std::max (atoi(argv[2]), 1);
+        else if (opt == "-mpix") pb.mpix_max   = atoi(argv[2]);
+        else if (opt == "-cas")  pb.filtre     = argv[2];
+        else if (opt == "-tag")  pb.etiquette  = argv[2];
+        else if (opt == "-o")    pb.prefixe    = argv[2];
+        else return usage();
+        argc -= 2; argv += 2;
+    }
+    for (int k = 1; k < argc; k++)
+        lister_images (argv[k], pb.images);
+    if (pb.images.empty())
+        lister_images ("../IMAGES", pb.images);
+    return effectuer_bench (pb);
+}
+
+
 //---------------------------------- M A I N ----------------------------------
 
 void afficher_usage (char *nom_prog) {
     std::cout << "Usage: " << nom_prog
-              << "[-mag width height] [-thr seuil] in1 [out2]"
+              << "[-mag width height] [-thr seuil] [-cache Mo] in1 [out2]\n"
+              << "       " << nom_prog
+              << " -batch touche dossier_out [-j threads] [-thr seuil]"
+              << " [-msk 0..4] [-ray rayon] [-euc]\n"
+              << "         [-lam lambda] [-the theta] in1|dossier|liste.txt ...\n"
+              << "         (touches 7 et 8 : aussi les coordonnées du pixel de fond"
+              << " le plus proche, _fy.png et _fx.png)\n"
+              << "       " << nom_prog
+              << " -video touche entree sortie [-thr seuil] [-msk 0..4]"
+              << " [-ray rayon] [-euc] [-lam lambda] [-the theta]\n"
+              << "         (entree, sortie : vidéo ou motif printf trame_%04d.png)\n"
+              << "       masques : 0 d4, 1 d8, 2 2-3, 3 3-4, 4 5-7-11"
               << std::endl;
 }
 
 int main (int argc, char**argv)
 {
+#ifdef BENCHMARK
+    return main_bench (argc, argv);
+#endif
     My my;
+    ParamsBatch pb;
+    ParamsSequence ps;
     char *nom_in1, *nom_out2, *nom_prog = argv[0];
     int zoom_w = 600, zoom_h = 500;
 
@@ -769,8 +3133,71 @@ int main (int argc, char**argv)
             if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
             my.seuil = atoi(argv[2]);
             argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-cache")) {
+            if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+            my.cache.fixer_budget (size_t(atoi(argv[2])) << 20);
+            argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-msk")) {
+            if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+            int m = atoi(argv[2]);
+            if (m < 0 || m >= M_LAST) { afficher_usage(nom_prog); return 1; }
+            pb.masque = my.m_cour = NumeroMasque(m);
+            my.dm_cour = demi_masque (my.m_cour);
+            argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-ray")) {
+            if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+            my.morpho.rayon = atoi(argv[2]);
+            argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-euc")) {
+            my.morpho.euclidienne = true;
+            argc -= 1; argv += 1;
+        } else if (!strcmp(argv[1], "-lam")) {
+            if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+            my.elagage.lambda = atoi(argv[2]);
+            argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-the")) {
+            if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+            my.elagage.theta = atoi(argv[2]);
+            argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-j")) {
+            if (argc-1 < 2) { afficher_usage(nom_prog); return 1; }
+            pb.nb_threads = atoi(argv[2]);
+            argc -= 2; argv += 2;
+        } else if (!strcmp(argv[1], "-batch")) {
+            if (argc-1 < 3 || !affi_depuis_touche(argv[2][0], &pb.affi))
+                { afficher_usage(nom_prog); return 1; }
+            pb.touche = argv[2][0];
+            pb.dossier_sortie = argv[3];
+            argc -= 3; argv += 3;
+        } else if (!strcmp(argv[1], "-video")) {
+            if (argc-1 < 4 || !affi_depuis_touche(argv[2][0], &ps.affi))
+                { afficher_usage(nom_prog); return 1; }
+            ps.touche = argv[2][0];
+            ps.entree = argv[3];
+            ps.sortie = argv[4];
+            argc -= 4; argv += 4;
         } else break;
     }
+
+    if (ps.entree) {
+        if (argc-1 > 0) { afficher_usage(nom_prog); return 1; }
+        ps.seuil = my.seuil;
+        ps.masque = pb.masque;
+        ps.morpho = my.morpho;
+        ps.elagage = my.elagage;
+        return effectuer_sequence (ps);
+    }
+
+    if (pb.dossier_sortie) {
+        if (argc-1 < 1) { afficher_usage(nom_prog); return 1; }
+        for (int k = 1; k < argc; k++)
+            lister_images (argv[k], pb.images);
+        pb.seuil = my.seuil;
+        pb.morpho = my.morpho;
+        pb.elagage = my.elagage;
+        return effectuer_batch (pb);
+    }
+
     if (argc-1 < 1 or argc-1 > 2) { afficher_usage(nom_prog); return 1; }
     nom_in1  = argv[1];
     nom_out2 = (argc-1 == 2) ? argv[2] : NULL;
@@ -786,7 +3213,7 @@ int main (int argc, char**argv)
     my.img_res1 = cv::Mat(my.img_src.rows, my.img_src.cols, CV_8UC3);
     my.img_res2 = cv::Mat(zoom_h, zoom_w, CV_8UC3);
     my.img_niv  = cv::Mat(my.img_src.rows, my.img_src.cols, CV_32SC1);
-    my.img_coul = cv::Mat(my.img_src.rows, my.img_src.cols, CV_8UC3);
+    my.img_coul = my.img_src.clone();
     my.loupe.reborner(my.img_res1, my.img_res2);
 
     // Création fenêtre
@@ -795,6 +3222,12 @@ int main (int argc, char**argv)
         onZoomSlide, &my);
     cv::createTrackbar ("Seuil", "ImageSrc", &my.seuil, 255,
         onSeuilSlide, &my);
+    cv::createTrackbar ("Rayon", "ImageSrc", &my.morpho.rayon, 200,
+        onSeuilSlide, &my);
+    cv::createTrackbar ("Lambda", "ImageSrc", &my.elagage.lambda, 50,
+        onSeuilSlide, &my);
+    cv::createTrackbar ("Theta", "ImageSrc", &my.elagage.theta, 180,
+        onSeuilSlide, &my);
     cv::setMouseCallback ("ImageSrc", onMouseEventSrc, &my);
 
     cv::namedWindow ("Loupe", cv::WINDOW_AUTOSIZE);
@@ -802,25 +3235,23 @@ int main (int argc, char**argv)
 
     afficher_aide();
 
+    CalculFond calcul;
+    calcul.demarrer (my.cache.limite());
+
     // Boucle d'événements
     for (;;) {
 
-        if (my.need_recalc(My::R_SEUIL))
+        if (my.need_recalc(My::R_TRANSFOS))
         {
-            // std::cout << "Calcul seuil" << std::endl;
-            cv::Mat img_gry;
-            cv::cvtColor (my.img_src, img_gry, cv::COLOR_BGR2GRAY);
-            cv::threshold (img_gry, img_gry, my.seuil, 255, cv::THRESH_BINARY);
-            img_gry.convertTo (my.img_niv, CV_32SC1,1., 0.);
+            // Demande au fil de calcul ; l'affichage garde l'image précédente
+            // jusqu'à ce que la nouvelle soit prête
+            calcul.demander (my);
         }
 
-        if (my.need_recalc(My::R_TRANSFOS))
+        if (calcul.recuperer (my.img_niv, my.img_coul))
         {
-            // std::cout << "Calcul transfos" << std::endl;
-            if (my.affi != My::A_ORIG) {
-                effectuer_transformations (my.affi, my.img_niv,my.dm_cour);
-                representer_en_couleurs_vga (my.img_niv, my.img_coul);
-            } else my.img_coul = my.img_src.clone();
+            my.loupe.invalider();
+            my.set_recalc(My::R_LOUPE);
         }
 
         if (my.need_recalc(My::R_LOUPE)) {
@@ -831,8 +3262,6 @@ int main (int argc, char**argv)
             cv::imshow ("Loupe"   , my.img_res2);
         }
         my.reset_recalc();
-        my.dm_cour = new DemiMasque(M_D4);
-        //my.m_cour = M_D4;
 
         // Attente du prochain événement sur toutes les fenêtres, avec un
         // timeout de 15ms pour détecter les changements de flags
@@ -843,6 +3272,7 @@ int main (int argc, char**argv)
         // appelées par waitKey lors de l'attente.
         if (onKeyPressEvent (key, &my) < 0) break;
     }
+    calcul.arreter();
 
     // Enregistrement résultat
     if (nom_out2) {